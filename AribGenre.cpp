@@ -0,0 +1,159 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <initializer_list>
+
+// ARIB STD-B10 の番組ジャンル (content_nibble_level1/2) の名前
+// 表はすべてコンパイル時に作り、「大分類 - 中分類」の文字列も前もってつないでおく。
+// 引くのは添字だけで、返すのは静的な UTF-8 の string_view
+class AribGenre {
+public:
+	enum Language {
+		LANG_JA,
+		LANG_EN,
+		LANG_COUNT
+	};
+	static constexpr std::string_view LanguageNames[LANG_COUNT] = { "ja", "en" };
+
+	static constexpr size_t Level1Count = 16;
+	static constexpr size_t Level2Count = 16;
+	static constexpr size_t DefinedLevel1Count = 12;  // 0xC 以降は「その他」
+
+	// 空のものは規格で決まっていない (その他として扱う)
+	struct Names {
+		std::string_view Name;
+		std::string_view SubNames[Level2Count];
+	};
+
+	static constexpr Names Table[LANG_COUNT][DefinedLevel1Count] = {
+		{
+			{ "ニュース／報道", { "定時・総合", "天気", "特集・ドキュメント", "政治・国会", "経済・市況", "海外・国際", "解説", "討論・会談", "報道特番", "ローカル・地域", "交通" } },
+			{ "スポーツ", { "スポーツニュース", "野球", "サッカー", "ゴルフ", "その他の球技", "相撲・格闘技", "国際大会", "陸上・マラソン", "モータースポーツ", "マリン・ウィンタースポーツ", "競馬・公営競技" } },
+			{ "情報／ワイドショー", { "芸能・ワイドショー", "ファッション", "暮らし・住まい", "健康・医療", "ショッピング・通販", "グルメ・料理", "イベント", "番組紹介・お知らせ" } },
+			{ "ドラマ", { "国内ドラマ", "海外ドラマ", "時代劇" } },
+			{ "音楽", { "国内ロック・ポップス", "海外ロック・ポップス", "クラシック・オペラ", "ジャズ・フュージョン", "歌謡曲・演歌", "ライブ・コンサート", "ランキング・リクエスト", "カラオケ・のど自慢", "民謡・邦楽", "童謡・キッズ", "民族音楽・ワールドミュージック" } },
+			{ "バラエティ", { "クイズ", "ゲーム", "トークバラエティ", "お笑い・コメディ", "音楽バラエティ", "旅バラエティ", "料理バラエティ" } },
+			{ "映画", { "洋画", "邦画", "アニメ" } },
+			{ "アニメ／特撮", { "国内アニメ", "海外アニメ", "特撮" } },
+			{ "ドキュメンタリー／教養", { "社会・時事", "歴史・紀行", "自然・動物・環境", "宇宙・科学・医学", "カルチャー・伝統文化", "文学・文芸", "スポーツ", "ドキュメンタリー全般", "インタビュー・討論" } },
+			{ "劇場／公演", { "現代劇・新劇", "ミュージカル", "ダンス・バレエ", "落語・演芸", "歌舞伎・古典" } },
+			{ "趣味／教育", { "旅・釣り・アウトドア", "園芸・ペット・手芸", "音楽・美術・工芸", "囲碁・将棋", "麻雀・パチンコ", "車・オートバイ", "コンピュータ・TVゲーム", "会話・語学", "幼児・小学生", "中学生・高校生", "大学生・受験", "生涯教育・資格", "教育問題" } },
+			{ "福祉", { "高齢者", "障害者", "社会福祉", "ボランティア", "手話", "文字（字幕）", "音声解説" } },
+		},
+		{
+			{ "News/Reports", { "Regular/General", "Weather", "Special/Documentary", "Politics/Diet", "Economy/Market", "Overseas/International", "Commentary", "Discussion/Conference", "Special report", "Local/Regional", "Traffic" } },
+			{ "Sports", { "Sports news", "Baseball", "Soccer", "Golf", "Other ball games", "Sumo/Martial arts", "International events", "Track and field/Marathon", "Motor sports", "Marine/Winter sports", "Horse racing/Public races" } },
+			{ "Information/Tabloid shows", { "Entertainment/Tabloid shows", "Fashion", "Living/Housing", "Health/Medical", "Shopping/Mail order", "Gourmet/Cooking", "Events", "Program guide/Announcements" } },
+			{ "Drama", { "Japanese drama", "Overseas drama", "Period drama" } },
+			{ "Music", { "Japanese rock/Pop", "Overseas rock/Pop", "Classical/Opera", "Jazz/Fusion", "Kayokyoku/Enka", "Live/Concert", "Ranking/Request", "Karaoke/Amateur singing", "Folk/Traditional Japanese music", "Children's songs/Kids", "Ethnic/World music" } },
+			{ "Variety", { "Quiz", "Game", "Talk variety", "Comedy", "Music variety", "Travel variety", "Cooking variety" } },
+			{ "Movies", { "Foreign films", "Japanese films", "Animation" } },
+			{ "Anime/Tokusatsu", { "Japanese anime", "Overseas anime", "Tokusatsu" } },
+			{ "Documentary/Culture", { "Society/Current affairs", "History/Travel", "Nature/Animals/Environment", "Space/Science/Medicine", "Culture/Traditional culture", "Literature", "Sports", "General documentary", "Interview/Discussion" } },
+			{ "Theater/Performance", { "Modern/New drama", "Musical", "Dance/Ballet", "Rakugo/Entertainment", "Kabuki/Classical" } },
+			{ "Hobby/Education", { "Travel/Fishing/Outdoors", "Gardening/Pets/Handicrafts", "Music/Art/Crafts", "Go/Shogi", "Mahjong/Pachinko", "Cars/Motorcycles", "Computers/Video games", "Conversation/Languages", "Preschool/Elementary school", "Junior high/High school", "University/Entrance exams", "Lifelong learning/Qualifications", "Education issues" } },
+			{ "Welfare", { "Elderly", "Disabled", "Social welfare", "Volunteering", "Sign language", "Captions", "Audio description" } },
+		},
+	};
+	static constexpr std::string_view Other[LANG_COUNT] = { "その他", "Other" };
+	static constexpr std::string_view Separator = " - ";
+
+	// 大分類の名前。決まっていないものは「その他」
+	static constexpr std::string_view GetName(uint8_t level1, Language lang = LANG_JA) {
+		return level1 < DefinedLevel1Count ? Table[lang][level1].Name : Other[lang];
+	}
+
+	// 中分類の名前。決まっていないものは空
+	static constexpr std::string_view GetSubName(uint8_t level1, uint8_t level2, Language lang = LANG_JA) {
+		return level1 < DefinedLevel1Count && level2 < Level2Count ? Table[lang][level1].SubNames[level2] : std::string_view();
+	}
+
+	// 「大分類 - 中分類」。中分類が決まっていなければ「大分類 - その他」、大分類もなければ「その他」
+	static std::string_view GetLabel(uint8_t level1, uint8_t level2, Language lang = LANG_JA);
+
+	static bool FindLanguage(std::string_view name, Language& lang) {
+		for (int i = 0; i < LANG_COUNT; i++) {
+			if (LanguageNames[i] == name) {
+				lang = static_cast<Language>(i);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// つないだ文字列の置き場。同じ大分類の「… - その他」は 1 つを共有する
+	template<size_t Size>
+	struct Labels {
+		char Text[Size] = {};
+		uint32_t Offsets[LANG_COUNT][Level1Count][Level2Count] = {};
+		uint8_t Lengths[LANG_COUNT][Level1Count][Level2Count] = {};
+
+		constexpr std::string_view Get(uint8_t level1, uint8_t level2, Language lang) const {
+			level1 &= 0x0F;
+			level2 &= 0x0F;
+			return std::string_view(Text + Offsets[lang][level1][level2], Lengths[lang][level1][level2]);
+		}
+	};
+
+	static constexpr size_t GetLabelsSize() {
+		size_t size = 0;
+		for (int lang = 0; lang < LANG_COUNT; lang++) {
+			size += Other[lang].size();
+			for (const auto& names : Table[lang]) {
+				size += names.Name.size() + Separator.size() + Other[lang].size();
+				for (const auto& sub : names.SubNames) {
+					if (!sub.empty()) size += names.Name.size() + Separator.size() + sub.size();
+				}
+			}
+		}
+		return size;
+	}
+
+	template<size_t Size>
+	static constexpr Labels<Size> BuildLabels() {
+		Labels<Size> labels;
+		size_t pos = 0;
+		auto append = [&](std::initializer_list<std::string_view> parts) {
+			const size_t start = pos;
+			for (auto part : parts) {
+				for (char c : part) labels.Text[pos++] = c;
+			}
+			return start;
+		};
+		for (int lang = 0; lang < LANG_COUNT; lang++) {
+			const size_t other = append({ Other[lang] });
+			for (size_t level1 = 0; level1 < Level1Count; level1++) {
+				size_t fallback = other;
+				size_t fallbackLength = Other[lang].size();
+				std::string_view name;
+				if (level1 < DefinedLevel1Count) {
+					name = Table[lang][level1].Name;
+					fallback = append({ name, Separator, Other[lang] });
+					fallbackLength = pos - fallback;
+				}
+				for (size_t level2 = 0; level2 < Level2Count; level2++) {
+					std::string_view sub;
+					if (level1 < DefinedLevel1Count) sub = Table[lang][level1].SubNames[level2];
+					if (sub.empty()) {
+						labels.Offsets[lang][level1][level2] = static_cast<uint32_t>(fallback);
+						labels.Lengths[lang][level1][level2] = static_cast<uint8_t>(fallbackLength);
+					}
+					else {
+						const size_t start = append({ name, Separator, sub });
+						labels.Offsets[lang][level1][level2] = static_cast<uint32_t>(start);
+						labels.Lengths[lang][level1][level2] = static_cast<uint8_t>(pos - start);
+					}
+				}
+			}
+		}
+		return labels;
+	}
+};
+
+// クラスの中ではまだ AribGenre の constexpr 関数を呼べないので、つないだものは外に置く
+inline constexpr auto AribGenreLabels = AribGenre::BuildLabels<AribGenre::GetLabelsSize()>();
+
+inline std::string_view AribGenre::GetLabel(uint8_t level1, uint8_t level2, Language lang) {
+	return AribGenreLabels.Get(level1, level2, lang);
+}
@@ -6,6 +6,7 @@
 #include <mutex>
 #include "LibISDB/LibISDB/LibISDB.hpp"
 #include "LibISDB/LibISDB/Base/Stream.hpp"
+#include "Metrics.cpp"
 
 using namespace LibISDB;
 
@@ -57,14 +58,18 @@ public:
 
         std::lock_guard<std::mutex> lock(m_Mutex);
         const uint8_t* data = static_cast<const uint8_t*>(pBuff);
+        size_t dropped = 0;
 
         for (size_t i = 0; i < Size; ++i) {
             if (m_Buffer.size() >= m_MaxSize) {
                 m_Buffer.pop(); // Âf[^폜
+                dropped++;
             }
             m_Buffer.push(data[i]); // obt@̖ɒǉ
         }
 
+        Metrics::Add(Metrics::COUNTER_STREAM_BYTES, Size);
+        if (dropped > 0) Metrics::Add(Metrics::COUNTER_STREAM_DROPPED_BYTES, dropped);
         return Size;
     }
 
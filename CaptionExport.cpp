@@ -0,0 +1,156 @@
+﻿#pragma once
+
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+
+#include <windows.h>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <mutex>
+#include <algorithm>
+#include "CaptionStore.cpp"
+
+// 字幕を WebVTT / SRT で書き出す
+// 次の字幕が来て終わりの時刻が決まった時点でキューを 1 つずつ整形してためておくので、
+// 録画中に何度ダウンロードされても連結済みのバッファを返すだけで済む
+class CaptionExport {
+public:
+	// 次の字幕が来なくてもこれ以上は表示しない
+	static constexpr int64_t MaxCueDurationMs = 10 * 1000;
+
+private:
+	struct Cue {
+		int64_t StartMs = 0;
+		std::string Text;  // UTF-8
+	};
+
+	std::string m_vtt;
+	std::string m_srt;
+	size_t m_cueCount = 0;
+	size_t m_next = 0;           // 次に読むストアの番号
+	uint64_t m_generation = 0;
+	int64_t m_originMs = 0;      // 最初の字幕の TOT。キューの時刻はここからの経過時間
+	bool m_fHasOrigin = false;
+	bool m_fHasPending = false;  // 終わりの時刻が決まっていないキュー
+	Cue m_pending;
+	mutable std::mutex m_mutex;
+
+public:
+	CaptionExport() { ResetLocked(); }
+
+	// ストアに追加された分を読む。字幕が確定するたびに呼ぶ
+	void Update(const CaptionStore& store) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		const uint64_t generation = store.GetGeneration();
+		if (generation != m_generation) {
+			ResetLocked();
+			m_generation = generation;
+		}
+		store.ForEach(m_next, [this](size_t i, const CaptionStore::Caption& caption) {
+			m_next = i + 1;
+			if (caption.Flags & CaptionStore::FLAG_MARKER) return;
+			auto text = FormatText(caption.Text);
+			if (text.empty()) return;
+
+			if (!m_fHasOrigin) {
+				m_originMs = caption.TotMs;
+				m_fHasOrigin = true;
+			}
+			const int64_t startMs = std::max<int64_t>(caption.TotMs - m_originMs, 0);
+			if (m_fHasPending) Emit(m_pending, startMs);
+			m_pending = { startMs, std::move(text) };
+			m_fHasPending = true;
+			});
+	}
+
+	std::string GetVtt() const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		std::string out = m_vtt;
+		if (m_fHasPending) AppendVttCue(out, m_pending, m_pending.StartMs + MaxCueDurationMs);
+		return out;
+	}
+
+	std::string GetSrt() const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		std::string out = m_srt;
+		if (m_fHasPending) AppendSrtCue(out, m_cueCount + 1, m_pending, m_pending.StartMs + MaxCueDurationMs);
+		return out;
+	}
+
+private:
+	void ResetLocked() {
+		m_vtt = "WEBVTT\n\n";
+		m_srt.clear();
+		m_cueCount = 0;
+		m_next = 0;
+		m_fHasOrigin = false;
+		m_fHasPending = false;
+	}
+
+	void Emit(const Cue& cue, int64_t nextStartMs) {
+		int64_t endMs = std::min(nextStartMs, cue.StartMs + MaxCueDurationMs);
+		if (endMs <= cue.StartMs) endMs = cue.StartMs + 1;
+		AppendVttCue(m_vtt, cue, endMs);
+		AppendSrtCue(m_srt, ++m_cueCount, cue, endMs);
+	}
+
+	static void AppendVttCue(std::string& out, const Cue& cue, int64_t endMs) {
+		out += FormatTime(cue.StartMs, '.');
+		out += " --> ";
+		out += FormatTime(endMs, '.');
+		out += '\n';
+		for (char c : cue.Text) {
+			switch (c) {
+			case '&': out += "&amp;"; break;
+			case '<': out += "&lt;"; break;
+			case '>': out += "&gt;"; break;
+			default: out += c; break;
+			}
+		}
+		out += "\n\n";
+	}
+
+	static void AppendSrtCue(std::string& out, size_t number, const Cue& cue, int64_t endMs) {
+		out += std::to_string(number);
+		out += '\n';
+		out += FormatTime(cue.StartMs, ',');
+		out += " --> ";
+		out += FormatTime(endMs, ',');
+		out += '\n';
+		out += cue.Text;
+		out += "\n\n";
+	}
+
+	// hh:mm:ss.mmm (SRT は小数点がカンマ)
+	static std::string FormatTime(int64_t ms, char separator) {
+		char buffer[32] = {};
+		snprintf(buffer, sizeof(buffer), "%02lld:%02lld:%02lld%c%03lld",
+			ms / 3600000, ms / 60000 % 60, ms / 1000 % 60, separator, ms % 1000);
+		return buffer;
+	}
+
+	// 空行があるとキューの終わりとみなされるので、空行を除いて UTF-8 にする
+	static std::string FormatText(std::wstring_view text) {
+		std::wstring joined;
+		size_t pos = 0;
+		while (pos <= text.size()) {
+			size_t end = text.find(L'\n', pos);
+			if (end == std::wstring_view::npos) end = text.size();
+			auto line = text.substr(pos, end - pos);
+			if (!line.empty() && line.back() == L'\r') line.remove_suffix(1);
+			if (!line.empty()) {
+				if (!joined.empty()) joined += L'\n';
+				joined.append(line);
+			}
+			pos = end + 1;
+		}
+		if (joined.empty()) return std::string();
+
+		int size = WideCharToMultiByte(CP_UTF8, 0, joined.data(), static_cast<int>(joined.size()), nullptr, 0, nullptr, nullptr);
+		std::string utf8(size, '\0');
+		WideCharToMultiByte(CP_UTF8, 0, joined.data(), static_cast<int>(joined.size()), utf8.data(), size, nullptr, nullptr);
+		return utf8;
+	}
+};
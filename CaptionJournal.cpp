@@ -0,0 +1,273 @@
+﻿#pragma once
+
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+
+#include <windows.h>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <algorithm>
+#include <functional>
+
+// 字幕をディスクに追記していくジャーナル
+// captions.dat に UTF-8 のテキストをそのまま連結し、
+// captions.idx に (TOT, サービスID, イベントID) → オフセット の固定長エントリを追記する。
+// 読み出しはどちらもメモリマップして、TOT の二分探索で引く。
+// TOT は録画の再生などで戻ることがあるので、そのまま書いておき、TOT が単調に増える区間ごとに探す
+class CaptionJournal {
+public:
+#pragma pack(push, 1)
+	struct IndexEntry {
+		int64_t TotMs;       // TOT (UNIX 時間のミリ秒)
+		uint16_t ServiceID;
+		uint16_t EventID;
+		uint32_t Length;     // テキストのバイト数
+		uint64_t Offset;     // captions.dat 内の位置
+	};
+#pragma pack(pop)
+	static_assert(sizeof(IndexEntry) == 24);
+
+	struct Record {
+		uint64_t Index;
+		int64_t TotMs;
+		uint16_t ServiceID;
+		uint16_t EventID;
+		std::string_view Text;
+	};
+
+private:
+	class MappedFile {
+		HANDLE m_hMapping = nullptr;
+		const uint8_t* m_pView = nullptr;
+		uint64_t m_size = 0;
+
+	public:
+		~MappedFile() { Unmap(); }
+
+		bool Map(HANDLE hFile, uint64_t size) {
+			Unmap();
+			if (size == 0) return true;
+			m_hMapping = CreateFileMappingW(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if (!m_hMapping) return false;
+			m_pView = static_cast<const uint8_t*>(MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, static_cast<SIZE_T>(size)));
+			if (!m_pView) {
+				Unmap();
+				return false;
+			}
+			m_size = size;
+			return true;
+		}
+
+		void Unmap() {
+			if (m_pView) UnmapViewOfFile(m_pView);
+			if (m_hMapping) CloseHandle(m_hMapping);
+			m_pView = nullptr;
+			m_hMapping = nullptr;
+			m_size = 0;
+		}
+
+		const uint8_t* Data() const { return m_pView; }
+		uint64_t Size() const { return m_size; }
+	};
+
+	HANDLE m_hData = INVALID_HANDLE_VALUE;
+	HANDLE m_hIndex = INVALID_HANDLE_VALUE;
+	uint64_t m_dataSize = 0;
+	uint64_t m_entryCount = 0;
+	int64_t m_lastTotMs = 0;
+	// TOT が前のエントリより戻ったところで始まる区間の先頭。区間の中は TOT の順に並んでいる
+	std::vector<uint64_t> m_runStarts;
+
+	// (サービスID, イベントID) → [最初のエントリ, 最後のエントリ]
+	// 番組単位の問い合わせで全体を走査しないようにする
+	std::map<uint32_t, std::pair<uint64_t, uint64_t>> m_events;
+
+	MappedFile m_dataView;
+	MappedFile m_indexView;
+	uint64_t m_mappedEntryCount = 0;
+	uint64_t m_mappedDataSize = 0;
+
+	// 書き込みは m_mutex、読み出しは共有ロック
+	mutable std::shared_mutex m_mutex;
+
+	static uint32_t EventKey(uint16_t serviceID, uint16_t eventID) {
+		return (static_cast<uint32_t>(serviceID) << 16) | eventID;
+	}
+
+	static HANDLE OpenAppend(const std::wstring& path) {
+		return CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+			OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	}
+
+	static uint64_t GetSize(HANDLE hFile) {
+		LARGE_INTEGER size = {};
+		return GetFileSizeEx(hFile, &size) ? static_cast<uint64_t>(size.QuadPart) : 0;
+	}
+
+	static bool WriteAt(HANDLE hFile, uint64_t offset, const void* pData, DWORD size) {
+		OVERLAPPED ov = {};
+		ov.Offset = static_cast<DWORD>(offset);
+		ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+		DWORD written = 0;
+		return WriteFile(hFile, pData, size, &written, &ov) && written == size;
+	}
+
+	bool IsMapped() const { return m_mappedEntryCount == m_entryCount && m_mappedDataSize == m_dataSize; }
+
+	// 問い合わせの前に、追記された分が見えるようにマップし直す
+	// Open で壊れたエントリを捨てた後は、数が同じでも大きさが違うことがあるので両方の大きさで比べる
+	void Remap() {
+		{
+			std::shared_lock<std::shared_mutex> lock(m_mutex);
+			if (IsMapped()) return;
+		}
+		std::unique_lock<std::shared_mutex> lock(m_mutex);
+		if (IsMapped()) return;
+		if (m_indexView.Map(m_hIndex, m_entryCount * sizeof(IndexEntry)) && m_dataView.Map(m_hData, m_dataSize)) {
+			m_mappedEntryCount = m_entryCount;
+			m_mappedDataSize = m_dataSize;
+		}
+		else {
+			m_indexView.Unmap();
+			m_dataView.Unmap();
+			m_mappedEntryCount = 0;
+			m_mappedDataSize = 0;
+		}
+	}
+
+	void AddEntry(uint64_t index, const IndexEntry& entry) {
+		auto [it, inserted] = m_events.try_emplace(EventKey(entry.ServiceID, entry.EventID), index, index);
+		if (!inserted) it->second.second = index;
+		if (index == 0 || entry.TotMs < m_lastTotMs) m_runStarts.push_back(index);
+		m_lastTotMs = entry.TotMs;
+	}
+
+	const IndexEntry* Entries() const { return reinterpret_cast<const IndexEntry*>(m_indexView.Data()); }
+
+	Record ToRecord(uint64_t index) const {
+		const IndexEntry& entry = Entries()[index];
+		return {
+			index, entry.TotMs, entry.ServiceID, entry.EventID,
+			std::string_view(reinterpret_cast<const char*>(m_dataView.Data() + entry.Offset), entry.Length),
+		};
+	}
+
+public:
+	~CaptionJournal() { Close(); }
+
+	bool Open(const std::wstring& directory) {
+		Close();
+		CreateDirectoryW(directory.c_str(), nullptr);
+		m_hData = OpenAppend(directory + L"\\captions.dat");
+		m_hIndex = OpenAppend(directory + L"\\captions.idx");
+		if (m_hData == INVALID_HANDLE_VALUE || m_hIndex == INVALID_HANDLE_VALUE) {
+			Close();
+			return false;
+		}
+
+		m_dataSize = GetSize(m_hData);
+		m_entryCount = GetSize(m_hIndex) / sizeof(IndexEntry);
+		m_mappedEntryCount = ~0ULL;
+		Remap();
+
+		// 書き込み途中で落ちた場合や、ファイルが壊れたり片方だけ差し替えられたりした場合に備えて、
+		// テキストが captions.dat に収まらないか、前のテキストと重なるエントリから後ろは捨てる
+		// ToRecord はここで確かめた範囲だけを読む
+		const IndexEntry* entries = Entries();
+		if (!entries) m_entryCount = 0;
+		uint64_t end = 0;
+		for (uint64_t i = 0; i < m_entryCount; i++) {
+			const IndexEntry& entry = entries[i];
+			if (entry.Offset < end || entry.Offset > m_dataSize || entry.Length > m_dataSize - entry.Offset) {
+				m_entryCount = i;
+				break;
+			}
+			AddEntry(i, entry);
+			end = entry.Offset + entry.Length;
+		}
+		m_dataSize = end;
+		// 捨てた分を見えないようにする
+		Remap();
+		return true;
+	}
+
+	void Close() {
+		std::unique_lock<std::shared_mutex> lock(m_mutex);
+		m_indexView.Unmap();
+		m_dataView.Unmap();
+		if (m_hData != INVALID_HANDLE_VALUE) CloseHandle(m_hData);
+		if (m_hIndex != INVALID_HANDLE_VALUE) CloseHandle(m_hIndex);
+		m_hData = INVALID_HANDLE_VALUE;
+		m_hIndex = INVALID_HANDLE_VALUE;
+		m_dataSize = 0;
+		m_entryCount = 0;
+		m_mappedEntryCount = 0;
+		m_mappedDataSize = 0;
+		m_lastTotMs = 0;
+		m_events.clear();
+		m_runStarts.clear();
+	}
+
+	bool IsOpen() const { return m_hIndex != INVALID_HANDLE_VALUE; }
+
+	// 追記したエントリの番号を返す。失敗したら -1
+	int64_t Append(int64_t totMs, uint16_t serviceID, uint16_t eventID, std::string_view text) {
+		std::unique_lock<std::shared_mutex> lock(m_mutex);
+		if (!IsOpen() || text.empty()) return -1;
+
+		IndexEntry entry = { totMs, serviceID, eventID, static_cast<uint32_t>(text.size()), m_dataSize };
+		if (!WriteAt(m_hData, m_dataSize, text.data(), static_cast<DWORD>(text.size()))) return -1;
+		if (!WriteAt(m_hIndex, m_entryCount * sizeof(IndexEntry), &entry, sizeof(entry))) return -1;
+
+		AddEntry(m_entryCount, entry);
+		m_dataSize += text.size();
+		m_entryCount++;
+		return static_cast<int64_t>(m_entryCount - 1);
+	}
+
+	// [fromMs, toMs) の字幕。書いた順に返す
+	void QueryByTime(int64_t fromMs, int64_t toMs, const std::function<void(const Record&)>& callback) {
+		Remap();
+		std::shared_lock<std::shared_mutex> lock(m_mutex);
+		const IndexEntry* entries = Entries();
+		if (!entries) return;
+		for (size_t run = 0; run < m_runStarts.size() && m_runStarts[run] < m_mappedEntryCount; run++) {
+			const IndexEntry* begin = entries + m_runStarts[run];
+			const IndexEntry* end = entries + (run + 1 < m_runStarts.size() ? std::min(m_runStarts[run + 1], m_mappedEntryCount) : m_mappedEntryCount);
+			auto it = std::lower_bound(begin, end, fromMs, [](const IndexEntry& e, int64_t t) { return e.TotMs < t; });
+			for (; it != end && it->TotMs < toMs; ++it) {
+				callback(ToRecord(it - entries));
+			}
+		}
+	}
+
+	// 番組の字幕
+	void QueryByEvent(uint16_t serviceID, uint16_t eventID, const std::function<void(const Record&)>& callback) {
+		Remap();
+		std::shared_lock<std::shared_mutex> lock(m_mutex);
+		auto found = m_events.find(EventKey(serviceID, eventID));
+		if (found == m_events.end() || !Entries()) return;
+		const IndexEntry* entries = Entries();
+		const uint64_t last = std::min(found->second.second, m_mappedEntryCount - 1);
+		for (uint64_t i = found->second.first; i <= last && i < m_mappedEntryCount; i++) {
+			if (entries[i].ServiceID == serviceID && entries[i].EventID == eventID) {
+				callback(ToRecord(i));
+			}
+		}
+	}
+
+	// エントリ番号を指定して引く (検索結果の確認用)
+	void QueryByIndex(const std::vector<uint64_t>& indexes, const std::function<void(const Record&)>& callback) {
+		Remap();
+		std::shared_lock<std::shared_mutex> lock(m_mutex);
+		if (!Entries()) return;
+		for (uint64_t index : indexes) {
+			if (index < m_mappedEntryCount) callback(ToRecord(index));
+		}
+	}
+};
@@ -0,0 +1,122 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <shared_mutex>
+#include <algorithm>
+#include <iterator>
+#include <functional>
+#include "CaptionJournal.cpp"
+
+// 字幕の全文検索
+// 日本語は単語の区切りがないので、文字の bigram からジャーナルのエントリ番号を引く転置インデックスにする。
+// 候補を posting list の積で絞ってから、本文に含まれるかを確かめる
+class CaptionSearch {
+	// bigram → エントリ番号 (昇順)
+	std::unordered_map<uint64_t, std::vector<uint32_t>> m_postings;
+	mutable std::shared_mutex m_mutex;
+
+public:
+	// 1 文字の検索語は posting list を引けない
+	static constexpr size_t MinQueryLength = 2;
+
+	void Add(uint64_t index, std::string_view text) {
+		auto normalized = Normalize(text);
+		if (normalized.size() < 2) return;
+
+		std::unique_lock<std::shared_mutex> lock(m_mutex);
+		for (size_t i = 0; i + 1 < normalized.size(); i++) {
+			auto& posting = m_postings[Bigram(normalized[i], normalized[i + 1])];
+			// 同じエントリ内で繰り返し出てくる bigram は 1 つにまとめる
+			if (posting.empty() || posting.back() != index) posting.push_back(static_cast<uint32_t>(index));
+		}
+	}
+
+	void Clear() {
+		std::unique_lock<std::shared_mutex> lock(m_mutex);
+		m_postings.clear();
+	}
+
+	// ジャーナルにあるものから作り直す
+	void Build(CaptionJournal& journal) {
+		Clear();
+		journal.QueryByTime(INT64_MIN, INT64_MAX, [this](const CaptionJournal::Record& record) {
+			Add(record.Index, record.Text);
+			});
+	}
+
+	// 新しいものから最大 limit 件
+	void Search(CaptionJournal& journal, std::string_view query, size_t limit, const std::function<void(const CaptionJournal::Record&)>& callback) const {
+		auto needle = Normalize(query);
+		if (needle.size() < MinQueryLength || limit == 0) return;
+
+		auto candidates = Candidates(needle);
+		std::vector<uint64_t> indexes;
+		// 新しいものから確かめて、limit 件見つかったら打ち切る
+		for (auto it = candidates.rbegin(); it != candidates.rend(); ++it) {
+			indexes.assign(1, *it);
+			bool fMatched = false;
+			journal.QueryByIndex(indexes, [&](const CaptionJournal::Record& record) {
+				if (Normalize(record.Text).find(needle) != std::u32string::npos) {
+					callback(record);
+					fMatched = true;
+				}
+				});
+			if (fMatched && --limit == 0) break;
+		}
+	}
+
+private:
+	static uint64_t Bigram(char32_t a, char32_t b) {
+		return (static_cast<uint64_t>(a) << 32) | b;
+	}
+
+	std::vector<uint32_t> Candidates(const std::u32string& needle) const {
+		std::shared_lock<std::shared_mutex> lock(m_mutex);
+		std::vector<const std::vector<uint32_t>*> lists;
+		for (size_t i = 0; i + 1 < needle.size(); i++) {
+			auto it = m_postings.find(Bigram(needle[i], needle[i + 1]));
+			if (it == m_postings.end()) return {};
+			lists.push_back(&it->second);
+		}
+		// 短いものから積を取る
+		std::sort(lists.begin(), lists.end(), [](auto a, auto b) { return a->size() < b->size(); });
+		std::vector<uint32_t> result = *lists.front();
+		std::vector<uint32_t> next;
+		for (size_t i = 1; i < lists.size() && !result.empty(); i++) {
+			next.clear();
+			std::set_intersection(result.begin(), result.end(), lists[i]->begin(), lists[i]->end(), std::back_inserter(next));
+			result.swap(next);
+		}
+		return result;
+	}
+
+	// 空白と改行を除き、全角英数は半角に、英字は小文字にそろえる
+	static std::u32string Normalize(std::string_view utf8) {
+		std::u32string out;
+		out.reserve(utf8.size() / 2);
+		size_t i = 0;
+		while (i < utf8.size()) {
+			char32_t c = DecodeUtf8(utf8, i);
+			if (c >= 0xFF01 && c <= 0xFF5E) c -= 0xFEE0;
+			if (c >= U'A' && c <= U'Z') c += U'a' - U'A';
+			if (c == U' ' || c == U'\t' || c == U'\r' || c == U'\n' || c == U'\f' || c == 0x3000) continue;
+			out += c;
+		}
+		return out;
+	}
+
+	static char32_t DecodeUtf8(std::string_view s, size_t& i) {
+		const auto lead = static_cast<unsigned char>(s[i++]);
+		int extra = lead >= 0xF0 ? 3 : lead >= 0xE0 ? 2 : lead >= 0xC0 ? 1 : 0;
+		char32_t c = extra == 3 ? lead & 0x07 : extra == 2 ? lead & 0x0F : extra == 1 ? lead & 0x1F : lead;
+		for (; extra > 0 && i < s.size(); extra--) {
+			c = (c << 6) | (static_cast<unsigned char>(s[i++]) & 0x3F);
+		}
+		return c;
+	}
+};
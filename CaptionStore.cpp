@@ -0,0 +1,105 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <mutex>
+#include <shared_mutex>
+
+// 受信した字幕をタイムスタンプ付きで保持する
+// 列ごとに配列を分けて (struct-of-arrays) 持ち、本文は 1 本の文字列に連結する。
+// 時刻の列だけを舐める処理 (VTT/SRT の書き出しなど) で本文を読まずに済む
+class CaptionStore {
+public:
+	static constexpr int64_t NoPts = -1;
+
+	enum Flag : uint8_t {
+		FLAG_NONE = 0x00,
+		FLAG_MARKER = 0x01,  // チャンネル名の見出しなど、字幕ではないもの
+	};
+
+	struct Caption {
+		int64_t Pts;      // 字幕 PES の PTS (90kHz)。なければ NoPts
+		int64_t TotMs;    // TOT (UNIX 時間のミリ秒)
+		uint16_t ServiceID;
+		uint16_t EventID;
+		uint8_t Flags;
+		std::wstring_view Text;
+	};
+
+private:
+	std::vector<int64_t> m_pts;
+	std::vector<int64_t> m_totMs;
+	std::vector<uint16_t> m_serviceIDs;
+	std::vector<uint16_t> m_eventIDs;
+	std::vector<uint8_t> m_flags;
+	std::vector<size_t> m_textEnds;  // m_text 内の終わりの位置
+	std::wstring m_text;
+	uint64_t m_generation = 0;  // Clear するたびに増やす
+	mutable std::shared_mutex m_mutex;
+
+	Caption At(size_t i) const {
+		const size_t begin = i == 0 ? 0 : m_textEnds[i - 1];
+		return {
+			m_pts[i], m_totMs[i], m_serviceIDs[i], m_eventIDs[i], m_flags[i],
+			std::wstring_view(m_text).substr(begin, m_textEnds[i] - begin),
+		};
+	}
+
+public:
+	// 追加した字幕の番号を返す
+	size_t Add(int64_t pts, int64_t totMs, uint16_t serviceID, uint16_t eventID, std::wstring_view text, uint8_t flags = FLAG_NONE) {
+		std::unique_lock<std::shared_mutex> lock(m_mutex);
+		m_pts.push_back(pts);
+		m_totMs.push_back(totMs);
+		m_serviceIDs.push_back(serviceID);
+		m_eventIDs.push_back(eventID);
+		m_flags.push_back(flags);
+		m_text.append(text);
+		m_textEnds.push_back(m_text.size());
+		return m_pts.size() - 1;
+	}
+
+	void AddMarker(std::wstring_view text) {
+		Add(NoPts, 0, 0, 0, text, FLAG_MARKER);
+	}
+
+	void Clear() {
+		std::unique_lock<std::shared_mutex> lock(m_mutex);
+		m_pts.clear();
+		m_totMs.clear();
+		m_serviceIDs.clear();
+		m_eventIDs.clear();
+		m_flags.clear();
+		m_textEnds.clear();
+		m_text.clear();
+		m_generation++;
+	}
+
+	size_t Size() const {
+		std::shared_lock<std::shared_mutex> lock(m_mutex);
+		return m_pts.size();
+	}
+
+	// 差分を読む側が、消されて最初からになったことを知るため
+	uint64_t GetGeneration() const {
+		std::shared_lock<std::shared_mutex> lock(m_mutex);
+		return m_generation;
+	}
+
+	// 見出しも含めてすべて連結したもの
+	std::wstring GetText() const {
+		std::shared_lock<std::shared_mutex> lock(m_mutex);
+		return m_text;
+	}
+
+	// from 番目以降を順に渡す。コールバックの中では Add しないこと
+	template<class Callback>
+	void ForEach(size_t from, Callback callback) const {
+		std::shared_lock<std::shared_mutex> lock(m_mutex);
+		for (size_t i = from; i < m_pts.size(); i++) {
+			callback(i, At(i));
+		}
+	}
+};
@@ -0,0 +1,43 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <string>
+
+// OnCaption で字幕の文字列を整える
+// LibISDB の型に依存しないようにしてあり、tests/CaptionTextTest.cpp で以前の実装と突き合わせる
+class CaptionText {
+public:
+	// 小さい文字の範囲を飛ばし、\f を置き換えながら 1 回の走査で out に書き出す
+	// erase を繰り返すと字幕の長さの 2 乗になるため。out は呼び出し側で使い回す
+	// formats は Pos の昇順に並んだ書式の変わり目で、先頭の formatCount 個を見る。isSmall(format) の範囲を除く
+	// fContinue は前の字幕が → で続いていたか
+	template<class FormatList, class IsSmall>
+	static void Compact(const wchar_t* pText, int length, const FormatList& formats, size_t formatCount, IsSmall isSmall, bool fContinue, std::wstring& out) {
+		size_t format = 0;       // pos までに始まった書式の数
+		bool fFirst = true;      // 小さい文字を除いた後の先頭の文字
+		bool fKeepNext = false;  // \f の次の 1 文字は調べずに残す (以前の erase/replace の結果と合わせる)
+		out.clear();
+		for (int pos = 0; pos < length; pos++) {
+			while (format < formatCount && formats[format].Pos <= static_cast<size_t>(pos))
+				format++;
+			if (format > 0 && isSmall(formats[format - 1]))
+				continue;
+
+			const wchar_t c = pText[pos];
+			const bool fFirstChar = fFirst;
+			fFirst = false;
+			if (fKeepNext) {
+				fKeepNext = false;
+				out += c;
+			}
+			else if (c == L'\f') {
+				if (fFirstChar && !fContinue)
+					out += L'\n';
+				fKeepNext = true;
+			}
+			else {
+				out += c;
+			}
+		}
+	}
+};
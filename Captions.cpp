@@ -12,24 +12,101 @@
 #include "LibISDB/LibISDB/Filters/FilterBase.hpp"
 #include "LibISDB/LibISDB/Filters/StreamSourceFilter.hpp"
 #include "LibISDB/LibISDB/Filters/TSPacketParserFilter.hpp"
+#include "LibISDB/LibISDB/TS/TSPacket.hpp"
+#include <functional>
+#include <atomic>
+#include <chrono>
 #include "ByteStream.cpp"
+#include "CaptionText.cpp"
 #include "Engine.cpp"
+#include "CaptionStore.cpp"
+#include "ZapTrace.cpp"
+#include "LiveStream.cpp"
+#include "TimeShiftBuffer.cpp"
+#include "TsAnalyzer.cpp"
 
 using namespace LibISDB;
 
+//  PES  PTS oĂ CaptionFilter
+// OnCaption ɂ͎nȂ̂ŁAOɒʂ PES  PTS g
+// ngł͓ TS ɂق̃T[rX⃏ZO̎̂ŁAfR[hĂ鎚 PID ̂̂
+class TimedCaptionFilter : public CaptionFilter {
+public:
+    static constexpr uint16_t NoPid = 0xFFFF;
+
+private:
+    // Reset ̓Cxg̃XbhAProcessData ̓Xg[~ÕXbhĂ΂
+    std::atomic<int64_t> LastPts = CaptionStore::NoPts;
+    std::atomic<uint16_t> TargetPid = NoPid;
+
+public:
+    bool ProcessData(DataStream* pData) override {
+        pData->Enumerate<TSPacket>([this](TSPacket* pPacket) -> bool {
+            ParsePts(pPacket);
+            return true;
+        });
+        return CaptionFilter::ProcessData(pData);
+    }
+
+    void Reset() override {
+        CaptionFilter::Reset();
+        LastPts = CaptionStore::NoPts;
+        TargetPid = NoPid;
+    }
+
+    // oT[rXƁA̎ PID (킩Ȃ NoPid)
+    void SetTarget(uint16_t serviceID, uint16_t pid) {
+        SetTargetStream(serviceID);
+        TargetPid = pid;
+    }
+
+    int64_t GetLastPts() const { return LastPts; }
+
+private:
+    void ParsePts(const TSPacket* pPacket) {
+        if (pPacket->GetPID() != TargetPid.load(std::memory_order_relaxed)) return;
+        if (!pPacket->GetPayloadUnitStartIndicator()) return;
+        const uint8_t* p = pPacket->GetPayloadData();
+        const size_t Size = pPacket->GetPayloadSize();
+        if (!p || Size < 14 || p[0] != 0x00 || p[1] != 0x00 || p[2] != 0x01) return;
+        // private_stream_1  PTS 
+        if (p[3] != 0xBD || (p[7] & 0x80) == 0) return;
+        // data_identifier  0x80 Ȃ玚 (0x81 ͕X[p[)
+        const size_t DataPos = 9 + static_cast<size_t>(p[8]);
+        if (DataPos >= Size || p[DataPos] != 0x80) return;
+        LastPts.store(
+            (static_cast<int64_t>(p[9] & 0x0E) << 29) |
+            (static_cast<int64_t>(p[10]) << 22) |
+            (static_cast<int64_t>(p[11] & 0xFE) << 14) |
+            (static_cast<int64_t>(p[12]) << 7) |
+            (static_cast<int64_t>(p[13]) >> 1), std::memory_order_relaxed);
+    }
+};
+
 class Captions {
+public:
+    // m肷邲ƂɌĂ΂BTOT  UNIX Ԃ̃~b
+    using CaptionListener = std::function<void(int64_t totMs, uint16_t serviceID, uint16_t eventID, const std::wstring& text)>;
+
+private:
     ByteStream* Stream = nullptr;
     Engine Engine;
     AnalyzerFilter* Analyzer = nullptr;
+    TimedCaptionFilter* Caption = nullptr;
+    CaptionStore& Store;
 
     class : public CaptionFilter::Handler {
     private:
-        std::wstringstream wss;
         bool fClearLast = false;
         bool fContinue = false;
+        // Reset ̓Cxg̃XbhĂ΂̂ŁA OnCaption (Xg[~ÕXbh) ŏ
+        std::atomic<bool> fResetRequested = false;
         static const bool m_fIgnoreSmall = true;
+        std::wstring Buff;  // OnCaption ƂɎg
 
     public:
+        std::function<void(const std::wstring&)> OnText;
+
         void OnLanguageUpdate(CaptionFilter* pFilter, CaptionParser* pParser) {}
         void OnCaption(
             CaptionFilter* pFilter, CaptionParser* pParser,
@@ -38,6 +115,10 @@ class Captions {
 #ifdef _DEBUG
             OutputDebugStringW(reinterpret_cast<const wchar_t*>(pText));
 #endif
+            if (fResetRequested.exchange(false, std::memory_order_acquire)) {
+                fClearLast = false;
+                fContinue = false;
+            }
             const int Length = ::lstrlen(pText);
 
             if (Length > 0) {
@@ -56,66 +137,110 @@ class Captions {
                     fClearLast = false;
                 }
 
-                std::wstring Buff;
-                if (pText) {
-                    // CharType*  wchar_t* ɃLXg std::wstring ɕϊ
-                    Buff = std::wstring(reinterpret_cast<const wchar_t*>(pText));
-                }
-
-                if (m_fIgnoreSmall && !pParser->Is1Seg()) {
-                    for (int i = static_cast<int>(pFormatList->size()) - 1; i >= 0; i--) {
-                        if ((*pFormatList)[i].Size == ARIBStringDecoder::CharSize::Small) {
-                            const size_t Pos = (*pFormatList)[i].Pos;
-                            if (Pos < Buff.length()) {
-                                if (i + 1 < static_cast<int>(pFormatList->size())) {
-                                    const size_t NextPos = std::min(Buff.length(), (*pFormatList)[i + 1].Pos);
-                                    //TRACE(TEXT("Caption exclude : {}\n"), StringView(&Buff[Pos], NextPos - Pos));
-                                    Buff.erase(Pos, NextPos - Pos);
-                                }
-                                else {
-                                    Buff.erase(Pos);
-                                }
-                            }
-                        }
-                    }
-                }
-
-                for (size_t i = 0; i < Buff.length(); i++) {
-                    if (Buff[i] == '\f') {
-                        if (i == 0 && !fContinue) {
-                            Buff.replace(0, 1, L"\n");
-                            i++;
-                        }
-                        else {
-                            Buff.erase(i, 1);
-                        }
-                    }
-                }
+                const size_t FormatCount = m_fIgnoreSmall && !pParser->Is1Seg() ? pFormatList->size() : 0;
+                CaptionText::Compact(reinterpret_cast<const wchar_t*>(pText), Length, *pFormatList, FormatCount,
+                    [](const auto& Format) { return Format.Size == ARIBStringDecoder::CharSize::Small; },
+                    fContinue, Buff);
                 fContinue =
                     Buff.length() > 1 && Buff.back() == L'';
                 if (fContinue)
                     Buff.pop_back();
-                if (!Buff.empty()) {
-                    wss << Buff;
+                if (!Buff.empty() && OnText) {
+                    OnText(Buff);
                 }
             }
         }
-        std::wstring GetStockedCaptions() { return wss.str(); }
-        void ClearStockedCaptions() { wss.str(L""); wss.clear(); }
-        void InitCaptions(std::wstring captions) {
-            wss.str(captions);
-            wss.clear(); // Xg[ԂZbg
-            wss.seekp(0, std::ios::end); // ǋLʒu𖖔Ɉړ
-        }
+        void Reset() { fResetRequested.store(true, std::memory_order_release); }
     } CaptionHandler;
 
+    // `lύX̌Aŏ PAT/PMT/TOT 擾L^
+    class : public AnalyzerFilter::EventListener {
+    public:
+        std::atomic<ZapTracer*> Tracer = nullptr;
+        std::function<void(AnalyzerFilter*)> OnServicesUpdated;
+
+        void OnPATUpdated(AnalyzerFilter* pAnalyzer) override {
+            Mark(ZapTracer::STAGE_FIRST_PAT);
+            if (OnServicesUpdated) OnServicesUpdated(pAnalyzer);
+        }
+        void OnPMTUpdated(AnalyzerFilter* pAnalyzer, uint16_t ServiceID) override {
+            Mark(ZapTracer::STAGE_FIRST_PMT);
+            if (OnServicesUpdated) OnServicesUpdated(pAnalyzer);
+        }
+        void OnTOTUpdated(AnalyzerFilter* pAnalyzer) override { Mark(ZapTracer::STAGE_FIRST_TOT); }
+
+    private:
+        void Mark(ZapTracer::Stage stage) {
+            if (auto pTracer = Tracer.load(std::memory_order_relaxed)) pTracer->Mark(stage);
+        }
+    } AnalyzerHandler;
+
+    CaptionListener Listener;
+    std::atomic<uint16_t> ServiceID = 0;
+    std::atomic<ZapTracer*> Tracer = nullptr;
+    std::atomic<LiveStream*> Live = nullptr;
+    TimeShiftBuffer* TimeShift = nullptr;
+    TsAnalyzer* PidAnalyzer = nullptr;
+
+    void OnCaptionText(const std::wstring& text) {
+        uint16_t serviceID = ServiceID;
+        // ̃T[rX킩Ȃ΍ŏ̃T[rX
+        if (serviceID == 0) serviceID = Analyzer->GetServiceID(0);
+        const int index = Analyzer->GetServiceIndexByID(serviceID);
+        const uint16_t eventID = index >= 0 ? Analyzer->GetEventID(index) : 0;
+        Metrics::Add(Metrics::COUNTER_CAPTIONS);
+        if (auto pTracer = Tracer.load(std::memory_order_relaxed)) pTracer->Mark(ZapTracer::STAGE_FIRST_CAPTION);
+        const int64_t totMs = GetTOTUnixMs();
+        Store.Add(Caption->GetLastPts(), totMs, serviceID, eventID, text);
+        if (Listener) Listener(totMs, serviceID, eventID, text);
+    }
+
+    // ̃T[rX (킩Ȃ΍ŏ̃T[rX) ̎ CaptionFilter Ŏo
+    void UpdateCaptionTarget(AnalyzerFilter* pAnalyzer) {
+        uint16_t serviceID = ServiceID;
+        if (serviceID == 0) serviceID = pAnalyzer->GetServiceID(0);
+        uint16_t pid = TimedCaptionFilter::NoPid;
+        AnalyzerFilter::ServiceInfo Info;
+        const int index = pAnalyzer->GetServiceIndexByID(serviceID);
+        if (index >= 0 && pAnalyzer->GetServiceInfo(index, &Info) && !Info.CaptionESList.empty()) {
+            pid = Info.CaptionESList.front().PID;
+        }
+        Caption->SetTarget(serviceID, pid);
+    }
+
+    // live  1 ̃T[rXɍi邽߂ PID ̕\蒼
+    void UpdateServiceMap(AnalyzerFilter* pAnalyzer) {
+        auto pLive = Live.load(std::memory_order_relaxed);
+        if (!pLive) return;
+        auto Map = std::make_shared<ServiceMap>();
+        Map->TransportStreamID = pAnalyzer->GetTransportStreamID();
+        const int Count = pAnalyzer->GetServiceCount();
+        for (int i = 0; i < Count; i++) {
+            AnalyzerFilter::ServiceInfo Info;
+            if (!pAnalyzer->GetServiceInfo(i, &Info) || !Info.IsPMTAcquired) continue;
+            auto& Service = Map->Services[Info.ServiceID];
+            Service.PMTPID = Info.PMTPID;
+            Service.PIDs.set(Info.PMTPID);
+            if (Info.PCRPID < 0x1FFF) Service.PIDs.set(Info.PCRPID);
+            if (!Info.VideoESList.empty()) {
+                Service.VideoPID = Info.VideoESList.front().PID;
+                Service.VideoStreamType = Info.VideoESList.front().StreamType;
+            }
+            for (const auto* pList : { &Info.VideoESList, &Info.AudioESList, &Info.CaptionESList }) {
+                for (const auto& ES : *pList) Service.PIDs.set(ES.PID & 0x1FFF);
+            }
+        }
+        pLive->SetServiceMap(std::move(Map));
+    }
+
 public:
-    Captions(std::wstring captions = L"") {
+    //  store ɒǋLĂ
+    Captions(CaptionStore& store, CaptionListener listener = nullptr) : Store(store), Listener(std::move(listener)) {
         // n unique_ptr Ƃēo^̂ŁA delete Ȃ
         auto Source = new StreamSourceFilter;
         auto Parser = new TSPacketParserFilter;
         auto Analyzer = this->Analyzer = new AnalyzerFilter;
-        auto Caption = new CaptionFilter;
+        auto Caption = this->Caption = new TimedCaptionFilter;
         Stream = new ByteStream;
 
         Engine.BuildEngine({
@@ -124,20 +249,55 @@ public:
             Analyzer,
             Caption,
             });
+        CaptionHandler.OnText = [this](const std::wstring& text) { OnCaptionText(text); };
         Caption->SetCaptionHandler(&CaptionHandler);
+        AnalyzerHandler.OnServicesUpdated = [this](AnalyzerFilter* pAnalyzer) {
+            UpdateCaptionTarget(pAnalyzer);
+            UpdateServiceMap(pAnalyzer);
+        };
+        Analyzer->AddEventListener(&AnalyzerHandler);
         Engine.SetStartStreamingOnSourceOpen(true);
         Engine.OpenSource(Stream);
-
-        CaptionHandler.InitCaptions(captions);
     }
 
     static BOOL CALLBACK StreamCallback(BYTE* pData, void* pClientData) {
         auto pThis = static_cast<Captions*>(pClientData);
+        Metrics::Add(Metrics::COUNTER_STREAM_PACKETS);
+        if (auto pTracer = pThis->Tracer.load(std::memory_order_relaxed)) pTracer->Mark(ZapTracer::STAGE_FIRST_PACKET);
+        if (auto pLive = pThis->Live.load(std::memory_order_relaxed)) pLive->Write(pData);
+        if (pThis->TimeShift) pThis->TimeShift->Write(pData);
+        if (pThis->PidAnalyzer) pThis->PidAnalyzer->Write(pData);
         if (pThis->Stream) pThis->Stream->Write(pData, 188);
         return TRUE;
     }
-    std::wstring GetStockedCaptions() { return CaptionHandler.GetStockedCaptions(); }
-    void ClearStockedCaptions() { CaptionHandler.ClearStockedCaptions(); }
+    void SetServiceID(uint16_t serviceID) {
+        ServiceID = serviceID;
+        UpdateCaptionTarget(Analyzer);
+    }
+    void SetZapTracer(ZapTracer* pTracer) {
+        Tracer = pTracer;
+        AnalyzerHandler.Tracer = pTracer;
+    }
+    // 󂯎pPbĝ܂ live ɂ
+    void SetLiveStream(LiveStream* pLive) { Live = pLive; }
+    // ^CVtgp̃t@CɂށBXg[R[obNo^OɌĂ
+    void SetTimeShift(TimeShiftBuffer* pTimeShift) {
+        TimeShift = pTimeShift;
+        pTimeShift->SetClock([this]() { return GetTOTUnixMs(); });
+    }
+    // PID Ƃ̓vBXg[R[obNo^OɌĂ
+    void SetTsAnalyzer(TsAnalyzer* pAnalyzer) { PidAnalyzer = pAnalyzer; }
+
+    // `lύXɌĂ
+    // tB^OtƃXg[R[obN͂̂܂܎gAԂ
+    // tB^͎g̃bN̒ŏB̃nh̓Xg[~ÕXbhŏ
+    void Reset() {
+        Stream->Close(); // Õ`l̃pPbĝĂ
+        Engine.ResetFilters();
+        CaptionHandler.Reset();
+        ServiceID = 0;
+        if (auto pLive = Live.load(std::memory_order_relaxed)) pLive->SetServiceMap(nullptr);
+    }
     std::string GetTOTTime() {
         LibISDB::DateTime time;
         if (Analyzer->GetInterpolatedTOTTime(&time)) {
@@ -148,4 +308,16 @@ public:
         }
         return std::string();
     }
+
+    // TOT  UNIX Ԃ̃~bŕԂB܂MĂȂ PC ̎v
+    int64_t GetTOTUnixMs() {
+        LibISDB::DateTime time;
+        if (Analyzer->GetInterpolatedTOTTime(&time)) {
+            std::tm tm = time.ToTm();
+            // TOT  JST
+            return (static_cast<int64_t>(_mkgmtime(&tm)) - 9 * 60 * 60) * 1000 + time.Millisecond;
+        }
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
 };
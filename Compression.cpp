@@ -0,0 +1,164 @@
+﻿#pragma once
+
+#include <string>
+#include <string_view>
+#include <cstdlib>
+#include <cctype>
+#include <zlib.h>
+#include <brotli/encode.h>
+
+enum class ContentEncoding {
+	Identity,
+	Gzip,
+	Brotli,
+};
+
+// Accept-Encoding のネゴシエーションと gzip/brotli 圧縮
+class Compression {
+public:
+	// 動的なレスポンスは速さ優先、起動時に一度だけ圧縮する静的ファイルは圧縮率優先
+	static constexpr int DynamicGzipLevel = 6;
+	static constexpr int DynamicBrotliQuality = 5;
+	static constexpr int StaticGzipLevel = 9;
+	static constexpr int StaticBrotliQuality = BROTLI_MAX_QUALITY;
+
+	// q 値が最も大きいものを選ぶ。同じなら brotli を優先し、q=0 は使わない
+	static ContentEncoding Negotiate(std::string_view acceptEncoding) {
+		ContentEncoding best = ContentEncoding::Identity;
+		double bestQ = 0.0;
+		size_t pos = 0;
+		while (pos < acceptEncoding.size()) {
+			size_t end = acceptEncoding.find(',', pos);
+			if (end == std::string_view::npos) end = acceptEncoding.size();
+			auto item = Trim(acceptEncoding.substr(pos, end - pos));
+			pos = end + 1;
+
+			double q = 1.0;
+			auto semicolon = item.find(';');
+			auto name = Trim(item.substr(0, semicolon));
+			if (semicolon != std::string_view::npos) {
+				auto param = Trim(item.substr(semicolon + 1));
+				if (param.size() > 2 && (param[0] == 'q' || param[0] == 'Q') && param[1] == '=') {
+					q = std::strtod(std::string(param.substr(2)).c_str(), nullptr);
+				}
+			}
+			if (q <= 0.0) continue;
+
+			ContentEncoding encoding;
+			if (EqualsIgnoreCase(name, "br")) encoding = ContentEncoding::Brotli;
+			else if (EqualsIgnoreCase(name, "gzip") || EqualsIgnoreCase(name, "x-gzip")) encoding = ContentEncoding::Gzip;
+			else continue;
+
+			if (q > bestQ || (q == bestQ && encoding == ContentEncoding::Brotli)) {
+				best = encoding;
+				bestQ = q;
+			}
+		}
+		return best;
+	}
+
+	static const char* Name(ContentEncoding encoding) {
+		switch (encoding) {
+		case ContentEncoding::Gzip: return "gzip";
+		case ContentEncoding::Brotli: return "br";
+		default: return "identity";
+		}
+	}
+
+	// 圧縮して効果のある Content-Type か
+	static bool IsCompressibleType(std::string_view contentType) {
+		return contentType.starts_with("text/")
+			|| contentType.starts_with("application/json")
+			|| contentType.starts_with("application/javascript")
+			|| contentType.starts_with("application/xml")
+			|| contentType.starts_with("application/x-ndjson")
+			|| contentType.starts_with("application/x-subrip")
+			|| contentType.starts_with("image/bmp");
+	}
+
+	static bool Compress(ContentEncoding encoding, std::string_view input, std::string& output, bool fStatic = false) {
+		switch (encoding) {
+		case ContentEncoding::Gzip:
+			return Gzip(input, output, fStatic ? StaticGzipLevel : DynamicGzipLevel);
+		case ContentEncoding::Brotli:
+			return Brotli(input, output, fStatic ? StaticBrotliQuality : DynamicBrotliQuality);
+		default:
+			return false;
+		}
+	}
+
+	static bool Gzip(std::string_view input, std::string& output, int level) {
+		z_stream strm = {};
+		// windowBits に 16 を足すと gzip ヘッダ付きになる
+		if (deflateInit2(&strm, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+			return false;
+		}
+		output.resize(deflateBound(&strm, static_cast<uLong>(input.size())));
+		strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+		strm.avail_in = static_cast<uInt>(input.size());
+		strm.next_out = reinterpret_cast<Bytef*>(output.data());
+		strm.avail_out = static_cast<uInt>(output.size());
+		int ret = deflate(&strm, Z_FINISH);
+		output.resize(strm.total_out);
+		deflateEnd(&strm);
+		return ret == Z_STREAM_END;
+	}
+
+	static bool Brotli(std::string_view input, std::string& output, int quality) {
+		size_t size = BrotliEncoderMaxCompressedSize(input.size());
+		if (size == 0) return false;
+		output.resize(size);
+		if (!BrotliEncoderCompress(quality, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT,
+				input.size(), reinterpret_cast<const uint8_t*>(input.data()),
+				&size, reinterpret_cast<uint8_t*>(output.data()))) {
+			return false;
+		}
+		output.resize(size);
+		return true;
+	}
+
+private:
+	static std::string_view Trim(std::string_view s) {
+		while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) s.remove_prefix(1);
+		while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) s.remove_suffix(1);
+		return s;
+	}
+
+	static bool EqualsIgnoreCase(std::string_view a, std::string_view b) {
+		if (a.size() != b.size()) return false;
+		for (size_t i = 0; i < a.size(); i++) {
+			if (std::tolower(static_cast<unsigned char>(a[i])) != b[i]) return false;
+		}
+		return true;
+	}
+};
+
+// 起動時に一度だけ圧縮しておく静的なコンテンツ
+struct PrecompressedContent {
+	std::string Identity;
+	std::string Gzip;
+	std::string Brotli;
+
+	static PrecompressedContent Create(std::string content) {
+		PrecompressedContent result;
+		if (!Compression::Compress(ContentEncoding::Gzip, content, result.Gzip, true)) result.Gzip.clear();
+		if (!Compression::Compress(ContentEncoding::Brotli, content, result.Brotli, true)) result.Brotli.clear();
+		result.Identity = std::move(content);
+		return result;
+	}
+
+	// 圧縮に失敗していたら無圧縮にフォールバックする
+	ContentEncoding Select(ContentEncoding preferred) const {
+		if (preferred == ContentEncoding::Brotli && !Brotli.empty()) return ContentEncoding::Brotli;
+		if (preferred != ContentEncoding::Identity && !Gzip.empty()) return ContentEncoding::Gzip;
+		return ContentEncoding::Identity;
+	}
+
+	const std::string& Get(ContentEncoding encoding) const {
+		switch (encoding) {
+		case ContentEncoding::Gzip: return Gzip;
+		case ContentEncoding::Brotli: return Brotli;
+		default: return Identity;
+		}
+	}
+};
@@ -0,0 +1,285 @@
+﻿#pragma once
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+
+#include <windows.h>
+#endif
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <memory>
+#include <atomic>
+#include <cstdlib>
+#include <utility>
+#include <charconv>
+#include <type_traits>
+
+// HttpRemocon.ini の [Server] [Captions] [TimeShift] [Fake] セクションと環境変数から読み込むサーバ設定
+// 環境変数 (HTTPREMOCON_PORT など) は ini の値より優先する
+// Windows 以外 (tools/FakeServer.cpp) では ini は読まず、LoadEnvironment で環境変数だけを見る
+struct ServerConfig {
+	std::string Host = "0.0.0.0";
+	int Port = 8080;
+	int ThreadCount = 8;
+	int KeepAliveMaxCount = 5;
+	int KeepAliveTimeoutSec = 5;
+	int ReadTimeoutSec = 5;
+	int WriteTimeoutSec = 5;
+	size_t PayloadMaxLength = 64 * 1024;
+	// これより小さいレスポンスは圧縮しない (負の値で圧縮しない)
+	int CompressionMinSize = 1024;
+	// 開発用: HttpRemoconCli.html の更新を監視して読み直す
+	bool WatchStaticFiles = false;
+	// 字幕をディスクに残して、チャンネル変更や再起動の後も検索できるようにする
+	bool CaptionJournal = true;
+	// 空ならプラグインと同じフォルダの Captions
+	std::wstring CaptionJournalDirectory;
+	// ライブの TS を残しておく分数 (0 で使わない) と、ファイルの大きさを決めるためのビットレート (Mbps)
+	int TimeShiftMinutes = 0;
+	int TimeShiftBitRate = 24;
+	// 空なら一時フォルダの HttpRemoconTimeShift.ts
+	std::wstring TimeShiftFile;
+
+	// 負荷試験用: TVTest の代わりに FakeTVTestApp を使う (プラグインは HTTPREMOCON_FAKE_BACKEND でビルドしたときだけ)
+	bool FakeBackend = false;
+	// すべての API にかける待ち (マイクロ秒)。[FakeLatency] セクションの "API 名=マイクロ秒" で API ごとに変えられる
+	// 環境変数では HTTPREMOCON_FAKE_LATENCY=GetEpgEventList=2000,SetChannel=50000 のようにカンマで区切る
+	int FakeLatencyUs = 0;
+	std::map<std::string, int> FakeLatencies;
+	int FakeServices = 12;
+	int FakeEventsPerService = 48;
+
+	// ルートごとの同時実行数の上限 (0 は無制限)
+	// 遅いルートがワーカーを使い切って /status などが詰まらないようにする
+	// /live.ts は接続している間ワーカーを使い続けるので、LoadEnvironment で ThreadCount - 2 以下にする
+	std::map<std::string, int> RouteConcurrency = {
+		{ "/play", 1 },
+		{ "/view/cap", 1 },
+		{ "/live.ts", 4 },
+	};
+
+#ifdef _WIN32
+	static ServerConfig Load(const std::wstring& iniPath) {
+		ServerConfig config;
+		const wchar_t* ini = iniPath.c_str();
+
+		WCHAR szHost[64] = {};
+		std::wstring defaultHost(config.Host.begin(), config.Host.end());
+		GetPrivateProfileStringW(L"Server", L"Host", defaultHost.c_str(), szHost, _countof(szHost), ini);
+		config.Host = NarrowAscii(szHost);
+		config.Port = GetPrivateProfileIntW(L"Server", L"Port", config.Port, ini);
+		config.ThreadCount = GetPrivateProfileIntW(L"Server", L"ThreadCount", config.ThreadCount, ini);
+		config.KeepAliveMaxCount = GetPrivateProfileIntW(L"Server", L"KeepAliveMaxCount", config.KeepAliveMaxCount, ini);
+		config.KeepAliveTimeoutSec = GetPrivateProfileIntW(L"Server", L"KeepAliveTimeout", config.KeepAliveTimeoutSec, ini);
+		config.ReadTimeoutSec = GetPrivateProfileIntW(L"Server", L"ReadTimeout", config.ReadTimeoutSec, ini);
+		config.WriteTimeoutSec = GetPrivateProfileIntW(L"Server", L"WriteTimeout", config.WriteTimeoutSec, ini);
+		config.PayloadMaxLength = GetPrivateProfileIntW(L"Server", L"PayloadMaxLength", static_cast<int>(config.PayloadMaxLength), ini);
+		config.CompressionMinSize = GetPrivateProfileIntW(L"Server", L"CompressionMinSize", config.CompressionMinSize, ini);
+		config.WatchStaticFiles = GetPrivateProfileIntW(L"Server", L"WatchStaticFiles", config.WatchStaticFiles, ini) != 0;
+
+		config.CaptionJournal = GetPrivateProfileIntW(L"Captions", L"Journal", config.CaptionJournal, ini) != 0;
+		WCHAR szJournalDirectory[MAX_PATH] = {};
+		GetPrivateProfileStringW(L"Captions", L"JournalDirectory", L"", szJournalDirectory, _countof(szJournalDirectory), ini);
+		config.CaptionJournalDirectory = szJournalDirectory;
+
+		config.TimeShiftMinutes = GetPrivateProfileIntW(L"TimeShift", L"Minutes", config.TimeShiftMinutes, ini);
+		config.TimeShiftBitRate = GetPrivateProfileIntW(L"TimeShift", L"BitRate", config.TimeShiftBitRate, ini);
+		WCHAR szTimeShiftFile[MAX_PATH] = {};
+		GetPrivateProfileStringW(L"TimeShift", L"File", L"", szTimeShiftFile, _countof(szTimeShiftFile), ini);
+		config.TimeShiftFile = szTimeShiftFile;
+
+		config.FakeBackend = GetPrivateProfileIntW(L"Fake", L"Enabled", config.FakeBackend, ini) != 0;
+		config.FakeLatencyUs = GetPrivateProfileIntW(L"Fake", L"LatencyUs", config.FakeLatencyUs, ini);
+		config.FakeServices = GetPrivateProfileIntW(L"Fake", L"Services", config.FakeServices, ini);
+		config.FakeEventsPerService = GetPrivateProfileIntW(L"Fake", L"EventsPerService", config.FakeEventsPerService, ini);
+
+		// [Concurrency] セクションは "ルート=上限" の形式
+		LoadIntSection(ini, L"Concurrency", config.RouteConcurrency);
+		LoadIntSection(ini, L"FakeLatency", config.FakeLatencies);
+
+		config.LoadEnvironment();
+		return config;
+	}
+
+	// プラグインと同じフォルダ
+	static std::wstring GetPluginDirectory(HINSTANCE hinst) {
+		WCHAR szPath[MAX_PATH] = {};
+		GetModuleFileNameW(hinst, szPath, MAX_PATH);
+		std::wstring path(szPath);
+		auto pos = path.find_last_of(L"\\/");
+		return pos == std::wstring::npos ? std::wstring() : path.substr(0, pos + 1);
+	}
+
+	// プラグインと同じ場所にある .ini のパス
+	static std::wstring GetIniPath(HINSTANCE hinst) {
+		WCHAR szPath[MAX_PATH] = {};
+		GetModuleFileNameW(hinst, szPath, MAX_PATH);
+		std::wstring path(szPath);
+		auto pos = path.find_last_of(L'.');
+		if (pos != std::wstring::npos) path.erase(pos);
+		return path + L".ini";
+	}
+#endif
+
+	// 環境変数で上書きする
+	void LoadEnvironment() {
+		ApplyEnvironment("HTTPREMOCON_HOST", Host);
+		ApplyEnvironment("HTTPREMOCON_PORT", Port);
+		ApplyEnvironment("HTTPREMOCON_THREAD_COUNT", ThreadCount);
+		ApplyEnvironment("HTTPREMOCON_KEEP_ALIVE_MAX_COUNT", KeepAliveMaxCount);
+		ApplyEnvironment("HTTPREMOCON_KEEP_ALIVE_TIMEOUT", KeepAliveTimeoutSec);
+		ApplyEnvironment("HTTPREMOCON_READ_TIMEOUT", ReadTimeoutSec);
+		ApplyEnvironment("HTTPREMOCON_WRITE_TIMEOUT", WriteTimeoutSec);
+		ApplyEnvironment("HTTPREMOCON_COMPRESSION_MIN_SIZE", CompressionMinSize);
+		ApplyEnvironment("HTTPREMOCON_PAYLOAD_MAX_LENGTH", PayloadMaxLength);
+		int fake = FakeBackend;
+		ApplyEnvironment("HTTPREMOCON_FAKE", fake);
+		FakeBackend = fake != 0;
+		ApplyEnvironment("HTTPREMOCON_FAKE_LATENCY_US", FakeLatencyUs);
+		ApplyEnvironment("HTTPREMOCON_FAKE_LATENCY", FakeLatencies);
+		ApplyEnvironment("HTTPREMOCON_FAKE_SERVICES", FakeServices);
+		ApplyEnvironment("HTTPREMOCON_FAKE_EVENTS_PER_SERVICE", FakeEventsPerService);
+		// [Concurrency] と同じく "ルート=上限" をカンマで区切る
+		ApplyEnvironment("HTTPREMOCON_CONCURRENCY", RouteConcurrency);
+
+		if (ThreadCount < 1) ThreadCount = 1;
+		// 視聴者がワーカーを使い切っても /status や /vol に応えられるように残す (0 で無制限にもさせない)
+		int& live = RouteConcurrency["/live.ts"];
+		const int maxLive = ThreadCount > 3 ? ThreadCount - 2 : 1;
+		if (live <= 0 || live > maxLive) live = maxLive;
+	}
+
+private:
+#ifdef _WIN32
+	// "キー=整数" が並んだセクション
+	static void LoadIntSection(const wchar_t* ini, const wchar_t* name, std::map<std::string, int>& values) {
+		std::vector<WCHAR> section(8192);
+		DWORD length = GetPrivateProfileSectionW(name, section.data(), static_cast<DWORD>(section.size()), ini);
+		for (const WCHAR* p = section.data(); p < section.data() + length && *p != L'\0'; p += wcslen(p) + 1) {
+			std::wstring entry(p);
+			auto pos = entry.find(L'=');
+			if (pos == std::wstring::npos) continue;
+			values[NarrowAscii(entry.substr(0, pos).c_str())] = _wtoi(entry.substr(pos + 1).c_str());
+		}
+	}
+
+	static std::string NarrowAscii(const WCHAR* s) {
+		std::string out;
+		for (; *s; s++) out += static_cast<char>(*s);
+		return out;
+	}
+#endif
+
+	static void ApplyEnvironment(const char* name, std::string& value) {
+#ifdef _MSC_VER
+		char* env = nullptr;
+		size_t len = 0;
+		if (_dupenv_s(&env, &len, name) == 0 && env) {
+			value = env;
+			free(env);
+		}
+#else
+		if (const char* env = std::getenv(name)) value = env;
+#endif
+	}
+
+	// 数として読めない値は無視して ini の値のままにする
+	template<class T, std::enable_if_t<std::is_integral_v<T>, int> = 0>
+	static void ApplyEnvironment(const char* name, T& value) {
+		std::string s;
+		ApplyEnvironment(name, s);
+		if (s.empty()) return;
+		T parsed;
+		const char* last = s.data() + s.size();
+		auto [ptr, ec] = std::from_chars(s.data(), last, parsed);
+		if (ec == std::errc() && ptr == last) value = parsed;
+	}
+
+	// "キー=整数,キー=整数" で values を足したり上書きしたりする。読めない項目は飛ばす
+	static void ApplyEnvironment(const char* name, std::map<std::string, int>& values) {
+		std::string s;
+		ApplyEnvironment(name, s);
+		size_t pos = 0;
+		while (pos < s.size()) {
+			size_t end = s.find(',', pos);
+			if (end == std::string::npos) end = s.size();
+			const std::string_view item(s.data() + pos, end - pos);
+			pos = end + 1;
+			const size_t eq = item.find('=');
+			if (eq == 0 || eq == std::string_view::npos) continue;
+			int parsed;
+			const char* last = item.data() + item.size();
+			auto [ptr, ec] = std::from_chars(item.data() + eq + 1, last, parsed);
+			if (ec == std::errc() && ptr == last) values[std::string(item.substr(0, eq))] = parsed;
+		}
+	}
+};
+
+// ルートごとの同時実行数を制限する
+// 上限に達した場合は待たずに 503 を返し、ワーカースレッドを解放する
+class RouteLimiter {
+	struct Slot {
+		std::atomic<int> Active = 0;
+		int Limit = 0;
+	};
+	// 起動時に作ってからは変更しないのでロックなしで参照できる
+	std::map<std::string, std::unique_ptr<Slot>> m_slots;
+
+public:
+	class Permit {
+		Slot* m_slot;
+	public:
+		explicit Permit(Slot* slot) : m_slot(slot) {}
+		Permit(const Permit&) = delete;
+		Permit& operator=(const Permit&) = delete;
+		~Permit() { if (m_slot) m_slot->Active.fetch_sub(1, std::memory_order_release); }
+	};
+
+	// ハンドラを呼んでいる間の許可を Hold で取り出せるようにする
+	class Scope {
+		std::shared_ptr<Permit> m_previous;
+	public:
+		explicit Scope(std::shared_ptr<Permit> permit) : m_previous(std::exchange(Current(), std::move(permit))) {}
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+		~Scope() { Current() = std::move(m_previous); }
+	};
+
+	// チャンクで返すハンドラは、ハンドラから戻った後もコンテンツプロバイダがワーカーを使い続ける
+	// 返した許可をプロバイダの状態に持たせて、送り終わるまで上限に数えさせる
+	static std::shared_ptr<Permit> Hold() { return Current(); }
+
+	void Configure(const std::map<std::string, int>& limits) {
+		m_slots.clear();
+		for (const auto& [route, limit] : limits) {
+			if (limit <= 0) continue;
+			auto slot = std::make_unique<Slot>();
+			slot->Limit = limit;
+			m_slots.emplace(route, std::move(slot));
+		}
+	}
+
+	// 制限のないルートは nullptr
+	Slot* Find(const std::string& route) const {
+		auto it = m_slots.find(route);
+		return it == m_slots.end() ? nullptr : it->second.get();
+	}
+
+	static bool TryAcquire(Slot* slot) {
+		if (!slot) return true;
+		int active = slot->Active.load(std::memory_order_relaxed);
+		do {
+			if (active >= slot->Limit) return false;
+		} while (!slot->Active.compare_exchange_weak(active, active + 1, std::memory_order_acquire));
+		return true;
+	}
+
+private:
+	static std::shared_ptr<Permit>& Current() {
+		thread_local std::shared_ptr<Permit> current;
+		return current;
+	}
+};
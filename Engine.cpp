@@ -48,4 +48,11 @@ public:
 
 		return true;
 	}
+
+	// tB^Ot蒼ɁAetB^̏Ԃ
+	// `lύXɑÕ`l PAT/PMT ⎚̏Ԃ̂Ă̂Ɏg
+	void ResetFilters() {
+		ResetEngine();
+		ResetStatus();
+	}
 };
@@ -0,0 +1,76 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <optional>
+
+// /status で使う番組のジャンルなどを (ネットワークID, TSID, サービスID, イベントID) ごとに保持する LRU キャッシュ
+// 一度取れたら同じ番組の間は GetEpgEventInfo を呼ばずに済む
+class EpgCache {
+public:
+	struct Key {
+		uint16_t NetworkID;
+		uint16_t TransportStreamID;
+		uint16_t ServiceID;
+		uint16_t EventID;
+
+		uint64_t Pack() const {
+			return (static_cast<uint64_t>(NetworkID) << 48)
+				| (static_cast<uint64_t>(TransportStreamID) << 32)
+				| (static_cast<uint64_t>(ServiceID) << 16)
+				| EventID;
+		}
+	};
+
+	struct Summary {
+		bool HasContent = false;
+		uint8_t ContentNibbleLevel1 = 0;
+		uint8_t ContentNibbleLevel2 = 0;
+	};
+
+private:
+	using Entry = std::pair<uint64_t, Summary>;
+
+	size_t m_capacity;
+	std::list<Entry> m_entries;  // 先頭が最近使ったもの
+	std::unordered_map<uint64_t, std::list<Entry>::iterator> m_index;
+	mutable std::mutex m_mutex;
+
+public:
+	explicit EpgCache(size_t capacity = 64) : m_capacity(capacity) {}
+
+	std::optional<Summary> Find(const Key& key) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto it = m_index.find(key.Pack());
+		if (it == m_index.end()) return std::nullopt;
+		m_entries.splice(m_entries.begin(), m_entries, it->second);
+		return it->second->second;
+	}
+
+	void Insert(const Key& key, Summary summary) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto packed = key.Pack();
+		auto it = m_index.find(packed);
+		if (it != m_index.end()) {
+			it->second->second = std::move(summary);
+			m_entries.splice(m_entries.begin(), m_entries, it->second);
+			return;
+		}
+		m_entries.emplace_front(packed, std::move(summary));
+		m_index.emplace(packed, m_entries.begin());
+		if (m_entries.size() > m_capacity) {
+			m_index.erase(m_entries.back().first);
+			m_entries.pop_back();
+		}
+	}
+
+	// 番組情報が更新されたときに呼ぶ
+	void Clear() {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_entries.clear();
+		m_index.clear();
+	}
+};
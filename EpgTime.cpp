@@ -0,0 +1,105 @@
+﻿#pragma once
+
+#include <cstdio>
+#include <string>
+#include "TVTestApp.cpp"
+
+// EPG の日時 (SYSTEMTIME、UTC+9) と UNIX 時間の変換
+// Win32 の API (SystemTimeToFileTime や GetDateFormatEx) を使わずに計算するので、Windows 以外でも同じ結果になる
+class EpgTime {
+public:
+	static constexpr long long Offset = 9 * 3600;
+
+	// SystemTimeToFileTime が受け付ける範囲 (1601 年から 30827 年) の日付か
+	static bool IsValidDate(const SYSTEMTIME& st) {
+		if (st.wYear < 1601 || st.wYear > 30827 || st.wMonth < 1 || st.wMonth > 12) return false;
+		return st.wDay >= 1 && st.wDay <= DaysInMonth(st.wYear, st.wMonth);
+	}
+
+	static bool IsValidTime(const SYSTEMTIME& st) {
+		return st.wHour < 24 && st.wMinute < 60 && st.wSecond < 60 && st.wMilliseconds < 1000;
+	}
+
+	// 秒より下は切り捨てる。正しくない日時は 0
+	static long long ToUnixTime(const SYSTEMTIME& st) {
+		if (!IsValidDate(st) || !IsValidTime(st)) return 0;
+		return DaysFromCivil(st.wYear, st.wMonth, st.wDay) * 86400
+			+ st.wHour * 3600LL + st.wMinute * 60LL + st.wSecond - Offset;
+	}
+
+	// ToUnixTime の逆。曜日も入れる
+	static SYSTEMTIME FromUnixTime(long long time) {
+		const long long local = time + Offset;
+		long long days = local / 86400;
+		long long seconds = local % 86400;
+		if (seconds < 0) {
+			seconds += 86400;
+			days--;
+		}
+		int year, month, day;
+		CivilFromDays(days, year, month, day);
+
+		SYSTEMTIME st = {};
+		st.wYear = static_cast<WORD>(year);
+		st.wMonth = static_cast<WORD>(month);
+		st.wDay = static_cast<WORD>(day);
+		st.wDayOfWeek = static_cast<WORD>(((days + 4) % 7 + 7) % 7);  // 1970-01-01 は木曜日
+		st.wHour = static_cast<WORD>(seconds / 3600);
+		st.wMinute = static_cast<WORD>(seconds / 60 % 60);
+		st.wSecond = static_cast<WORD>(seconds % 60);
+		return st;
+	}
+
+	// "2024-01-02T03:04:05+09:00"
+	// 以前の GetDateFormatEx / GetTimeFormatEx と同じく、日付か時刻の一方が正しくなければその部分だけにする
+	static std::string ToIsoString(const SYSTEMTIME& st) {
+		const bool fDate = IsValidDate(st);
+		const bool fTime = IsValidTime(st);
+		char buffer[32];
+		if (fDate && fTime) {
+			std::snprintf(buffer, sizeof(buffer), "%04u-%02u-%02uT%02u:%02u:%02u+09:00", st.wYear, st.wMonth, st.wDay, st.wHour, st.wMinute, st.wSecond);
+		}
+		else if (fDate) {
+			std::snprintf(buffer, sizeof(buffer), "%04u-%02u-%02u", st.wYear, st.wMonth, st.wDay);
+		}
+		else if (fTime) {
+			std::snprintf(buffer, sizeof(buffer), "%02u:%02u:%02u", st.wHour, st.wMinute, st.wSecond);
+		}
+		else {
+			return std::string();
+		}
+		return buffer;
+	}
+
+private:
+	static bool IsLeapYear(int year) {
+		return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+	}
+
+	static int DaysInMonth(int year, int month) {
+		static constexpr int days[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+		return month == 2 && IsLeapYear(year) ? 29 : days[month - 1];
+	}
+
+	// 1970-01-01 からの日数 (http://howardhinnant.github.io/date_algorithms.html)
+	static long long DaysFromCivil(int year, int month, int day) {
+		year -= month <= 2;
+		const long long era = (year >= 0 ? year : year - 399) / 400;
+		const long long yoe = year - era * 400;
+		const long long doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+		const long long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+		return era * 146097 + doe - 719468;
+	}
+
+	static void CivilFromDays(long long days, int& year, int& month, int& day) {
+		days += 719468;
+		const long long era = (days >= 0 ? days : days - 146096) / 146097;
+		const long long doe = days - era * 146097;
+		const long long yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+		const long long doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+		const long long mp = (5 * doy + 2) / 153;
+		day = static_cast<int>(doy - (153 * mp + 2) / 5 + 1);
+		month = static_cast<int>(mp < 10 ? mp + 3 : mp - 9);
+		year = static_cast<int>(yoe + era * 400 + (month <= 2));
+	}
+};
@@ -0,0 +1,527 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <cwchar>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <ctime>
+#include <algorithm>
+#include "TVTestApp.cpp"
+#include "EpgTime.cpp"
+#include "Config.cpp"
+
+// TvtPlay の代わり。開いたファイルを duration ミリ秒のものとして、時計に合わせて位置を進める
+class FakeTvtPlay : public ITvtPlay {
+	using Clock = std::chrono::steady_clock;
+
+	std::mutex m_mutex;
+	bool m_fOpen = false;
+	bool m_fPaused = false;
+	long m_duration;
+	long m_position = 0;  // m_started の時点の位置
+	Clock::time_point m_started;
+
+	long GetPositionLocked() const {
+		if (!m_fOpen) return 0;
+		long position = m_position;
+		if (!m_fPaused) position += static_cast<long>(std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - m_started).count());
+		return std::min(position, m_duration);
+	}
+
+public:
+	explicit FakeTvtPlay(long duration = 30 * 60 * 1000) : m_duration(duration) {}
+
+	// /play/pause は DoCommand で来るので、FakeTVTestApp から切り替える
+	void TogglePause() {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_position = GetPositionLocked();
+		m_started = Clock::now();
+		m_fPaused = !m_fPaused;
+	}
+
+	bool IsRunning() override { return true; }
+
+	bool IsOpen() override {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_fOpen;
+	}
+
+	long GetPosition() override {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return GetPositionLocked();
+	}
+
+	long GetDuration() override {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_fOpen ? m_duration : 0;
+	}
+
+	bool IsPaused() override {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_fPaused;
+	}
+
+	int GetStretch() override { return 100; }
+
+	bool Seek(int msec, bool fRelative) override {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		const long position = fRelative ? GetPositionLocked() + msec : msec;
+		m_position = std::clamp(position, 0L, m_duration);
+		m_started = Clock::now();
+		return true;
+	}
+
+	bool OpenFile(const std::wstring& path) override {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_fOpen = !path.empty();
+		m_fPaused = false;
+		m_position = 0;
+		m_started = Clock::now();
+		return true;
+	}
+};
+
+// 負荷試験用の TVTest の代わり
+// Win32 の API は使わないので、tools/FakeServer.cpp から Windows 以外でも動かせる。
+// チャンネルと番組表はサーバを起動する前に入れておき、起動してからは変えない (返す文字列はここを指す)。
+// 呼び出しごとに決めた時間だけ待つので、TVTest の API が遅いときにハンドラがどう詰まるかを TVTest なしで見られる
+class FakeTVTestApp : public ITVTestApp {
+public:
+	struct Service {
+		std::wstring Tuner;
+		int Space = 0;
+		int Channel = 0;
+		WORD NetworkID = 0;
+		WORD TransportStreamID = 0;
+		WORD ServiceID = 0;
+		std::wstring Name;
+	};
+
+	struct Event {
+		WORD NetworkID = 0;
+		WORD TransportStreamID = 0;
+		WORD ServiceID = 0;
+		WORD EventID = 0;
+		long long Start = 0;  // Unix 時間 (EpgTime::ToUnixTime と同じ)
+		DWORD Duration = 0;   // 秒
+		std::wstring Name;
+		std::wstring Text;
+		std::wstring ExtText;
+		BYTE Genre1 = 0xFF;   // 0xFF はジャンルなし
+		BYTE Genre2 = 0;
+	};
+
+private:
+	// Free* に返ってきたものを元の型に戻して消す
+	struct EventHolder : TVTest::EpgEventInfo {
+		TVTest::EpgEventContentInfo Content;
+	};
+	struct SpaceHolder : TVTest::DriverTuningSpaceInfo {
+		TVTest::TuningSpaceInfo Space;
+		std::vector<TVTest::ChannelInfo> Channels;
+		std::vector<TVTest::ChannelInfo*> ChannelPointers;
+	};
+
+	std::vector<Service> m_services;
+	std::vector<Event> m_events;
+	std::vector<std::wstring> m_tuners;  // 登録順
+
+	std::chrono::microseconds m_defaultLatency{ 0 };
+	std::map<std::string, std::chrono::microseconds, std::less<>> m_latencies;
+
+	// ここから下はハンドラのスレッドから変わる
+	std::mutex m_mutex;
+	size_t m_current = 0;  // m_services の添字
+	std::wstring m_driver;
+	int m_volume = 50;
+	bool m_fRecording = false;
+	FILETIME m_recordStart = {};
+	FakeTvtPlay* m_tvtPlay = nullptr;
+
+public:
+	// API 名 ("GetEpgEventList" など) ごとの待ち。登録のないものは SetDefaultLatency の値
+	void SetDefaultLatency(std::chrono::microseconds latency) { m_defaultLatency = latency; }
+	void SetLatency(const std::string& api, std::chrono::microseconds latency) { m_latencies[api] = latency; }
+
+	void AddService(const Service& service) {
+		if (std::find(m_tuners.begin(), m_tuners.end(), service.Tuner) == m_tuners.end()) m_tuners.push_back(service.Tuner);
+		m_services.push_back(service);
+		if (m_services.size() == 1) m_driver = service.Tuner;
+	}
+
+	void AddEvent(const Event& event) { m_events.push_back(event); }
+
+	// tvtplay.tvtp:Pause を渡す先
+	void SetTvtPlay(FakeTvtPlay* tvtPlay) { m_tvtPlay = tvtPlay; }
+
+	// services 個のサービスに、start から 30 分ずつの番組を eventsPerService 個ずつ入れる
+	void GenerateSample(int services, int eventsPerService, long long start) {
+		static constexpr WORD NetworkID = 0x7FE0;
+		static constexpr int ServicesPerStream = 3;
+		for (int i = 0; i < services; i++) {
+			Service ch;
+			ch.Tuner = L"BonDriver_Fake.dll";
+			ch.Channel = i / ServicesPerStream;
+			ch.NetworkID = NetworkID;
+			ch.TransportStreamID = static_cast<WORD>(NetworkID + ch.Channel);
+			ch.ServiceID = static_cast<WORD>(1024 + i);
+			ch.Name = L"Fake " + std::to_wstring(i + 1);
+			AddService(ch);
+
+			for (int j = 0; j < eventsPerService; j++) {
+				Event ev;
+				ev.NetworkID = ch.NetworkID;
+				ev.TransportStreamID = ch.TransportStreamID;
+				ev.ServiceID = ch.ServiceID;
+				ev.EventID = static_cast<WORD>(j + 1);
+				ev.Start = start + j * 1800LL;
+				ev.Duration = 1800;
+				ev.Name = ch.Name + L" 番組 " + std::to_wstring(j + 1);
+				ev.Text = L"番組の説明";
+				ev.Genre1 = static_cast<BYTE>((i + j) % 12);
+				ev.Genre2 = static_cast<BYTE>(j % 3);
+				AddEvent(ev);
+			}
+		}
+	}
+
+	bool SetDriverName(LPCWSTR pszName) override {
+		Wait("SetDriverName");
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_driver = pszName ? pszName : L"";
+		return true;
+	}
+
+	int GetDriverName(LPWSTR pszName, int MaxLength) override {
+		Wait("GetDriverName");
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return CopyString(pszName, MaxLength, m_driver);
+	}
+
+	int EnumDriver(int Index, LPWSTR pszFileName, int MaxLength) override {
+		Wait("EnumDriver");
+		if (Index < 0 || Index >= static_cast<int>(m_tuners.size())) return 0;
+		return CopyString(pszFileName, MaxLength, m_tuners[Index]);
+	}
+
+	bool GetDriverTuningSpaceList(LPCWSTR pszDriverName, TVTest::DriverTuningSpaceList* pList) override {
+		Wait("GetDriverTuningSpaceList");
+		const std::wstring_view driver = pszDriverName ? pszDriverName : L"";
+		std::vector<SpaceHolder*> spaces;
+		for (const auto& ch : m_services) {
+			if (ch.Tuner != driver) continue;
+			while (static_cast<int>(spaces.size()) <= ch.Space) {
+				SpaceHolder* space = new SpaceHolder();
+				space->Space.Size = sizeof(space->Space);
+				space->Space.Space = TVTest::TUNINGSPACE_UNKNOWN;
+				swprintf(space->Space.szName, _countof(space->Space.szName), L"Space %d", static_cast<int>(spaces.size()));
+				space->pInfo = &space->Space;
+				spaces.push_back(space);
+			}
+			TVTest::ChannelInfo info;
+			FillChannelInfo(ch, info);
+			spaces[ch.Space]->Channels.push_back(info);
+		}
+		if (spaces.empty()) return false;
+
+		pList->NumSpaces = static_cast<DWORD>(spaces.size());
+		pList->SpaceList = new TVTest::DriverTuningSpaceInfo*[spaces.size()];
+		for (size_t i = 0; i < spaces.size(); i++) {
+			SpaceHolder* space = spaces[i];
+			for (auto& info : space->Channels) space->ChannelPointers.push_back(&info);
+			space->NumChannels = static_cast<DWORD>(space->Channels.size());
+			space->ChannelList = space->ChannelPointers.data();
+			pList->SpaceList[i] = space;
+		}
+		return true;
+	}
+
+	void FreeDriverTuningSpaceList(TVTest::DriverTuningSpaceList* pList) override {
+		for (DWORD i = 0; i < pList->NumSpaces; i++) delete static_cast<SpaceHolder*>(pList->SpaceList[i]);
+		delete[] pList->SpaceList;
+		pList->NumSpaces = 0;
+		pList->SpaceList = nullptr;
+	}
+
+	bool SetChannel(int Space, int Channel) override {
+		Wait("SetChannel");
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (size_t i = 0; i < m_services.size(); i++) {
+			const auto& ch = m_services[i];
+			if (ch.Tuner == m_driver && ch.Space == Space && ch.Channel == Channel) {
+				m_current = i;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool SelectChannel(const TVTest::ChannelSelectInfo* pInfo) override {
+		Wait("SelectChannel");
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (size_t i = 0; i < m_services.size(); i++) {
+			const auto& ch = m_services[i];
+			if (pInfo->pszTuner && ch.Tuner != pInfo->pszTuner) continue;
+			if (pInfo->Space >= 0 && ch.Space != pInfo->Space) continue;
+			if (pInfo->Channel >= 0 && ch.Channel != pInfo->Channel) continue;
+			if (pInfo->ServiceID != 0 && ch.ServiceID != pInfo->ServiceID) continue;
+			m_current = i;
+			m_driver = ch.Tuner;
+			return true;
+		}
+		return false;
+	}
+
+	bool GetCurrentChannelInfo(TVTest::ChannelInfo* pInfo) override {
+		Wait("GetCurrentChannelInfo");
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_services.empty()) return false;
+		FillChannelInfo(m_services[m_current], *pInfo);
+		return true;
+	}
+
+	bool GetCurrentProgramInfo(TVTest::ProgramInfo* pInfo, bool fNext) override {
+		Wait("GetCurrentProgramInfo");
+		const Event* current = FindCurrentEvent(std::time(nullptr));
+		if (current && fNext) current = FindEventAt(*current, current->Start + static_cast<long long>(current->Duration));
+		if (!current) return false;
+
+		pInfo->ServiceID = current->ServiceID;
+		pInfo->EventID = current->EventID;
+		if (pInfo->pszEventName) CopyString(pInfo->pszEventName, pInfo->MaxEventName, current->Name);
+		if (pInfo->pszEventText) CopyString(pInfo->pszEventText, pInfo->MaxEventText, current->Text);
+		if (pInfo->pszEventExtText) CopyString(pInfo->pszEventExtText, pInfo->MaxEventExtText, current->ExtText);
+		pInfo->StartTime = UnixTimeToEpgTime(current->Start);
+		pInfo->Duration = current->Duration;
+		return true;
+	}
+
+	TVTest::EpgEventInfo* GetEpgEventInfo(const TVTest::EpgEventQueryInfo* pInfo) override {
+		Wait("GetEpgEventInfo");
+		// 日時は UTC の FILETIME
+		const long long time = pInfo->Type == TVTest::EPG_EVENT_QUERY_TIME
+			? static_cast<long long>(((static_cast<ULONGLONG>(pInfo->Time.dwHighDateTime) << 32) | pInfo->Time.dwLowDateTime) / 10000000ULL) - 11644473600LL
+			: 0;
+		for (const auto& ev : m_events) {
+			if (ev.NetworkID != pInfo->NetworkID || ev.TransportStreamID != pInfo->TransportStreamID || ev.ServiceID != pInfo->ServiceID) continue;
+			if (pInfo->Type == TVTest::EPG_EVENT_QUERY_EVENTID ? ev.EventID == pInfo->EventID : ev.Start <= time && time < ev.Start + static_cast<long long>(ev.Duration)) {
+				return CreateEventInfo(ev);
+			}
+		}
+		return nullptr;
+	}
+
+	void FreeEpgEventInfo(TVTest::EpgEventInfo* pEventInfo) override {
+		delete static_cast<EventHolder*>(pEventInfo);
+	}
+
+	bool GetEpgEventList(TVTest::EpgEventList* pList) override {
+		Wait("GetEpgEventList");
+		std::vector<TVTest::EpgEventInfo*> events;
+		for (const auto& ev : m_events) {
+			if (ev.NetworkID == pList->NetworkID && ev.TransportStreamID == pList->TransportStreamID && ev.ServiceID == pList->ServiceID) {
+				events.push_back(CreateEventInfo(ev));
+			}
+		}
+		if (events.empty()) return false;
+
+		pList->NumEvents = static_cast<WORD>(std::min<size_t>(events.size(), 0xFFFF));
+		pList->EventList = new TVTest::EpgEventInfo*[pList->NumEvents];
+		std::copy_n(events.begin(), pList->NumEvents, pList->EventList);
+		for (size_t i = pList->NumEvents; i < events.size(); i++) FreeEpgEventInfo(events[i]);
+		return true;
+	}
+
+	void FreeEpgEventList(TVTest::EpgEventList* pList) override {
+		for (WORD i = 0; i < pList->NumEvents; i++) FreeEpgEventInfo(pList->EventList[i]);
+		delete[] pList->EventList;
+		pList->NumEvents = 0;
+		pList->EventList = nullptr;
+	}
+
+	bool GetStatus(TVTest::StatusInfo* pInfo) override {
+		Wait("GetStatus");
+		pInfo->SignalLevel = 30.0f;
+		pInfo->BitRate = 16 * 1000 * 1000;
+		pInfo->ErrorPacketCount = 0;
+		pInfo->ScramblePacketCount = 0;
+		if (pInfo->Size >= sizeof(TVTest::StatusInfo)) {
+			pInfo->DropPacketCount = 0;
+			pInfo->Reserved = 0;
+		}
+		return true;
+	}
+
+	bool GetRecordStatus(TVTest::RecordStatusInfo* pInfo) override {
+		Wait("GetRecordStatus");
+		std::lock_guard<std::mutex> lock(m_mutex);
+		pInfo->Status = m_fRecording ? TVTest::RECORD_STATUS_RECORDING : TVTest::RECORD_STATUS_NOTRECORDING;
+		pInfo->StartTime = m_recordStart;
+		pInfo->RecordTime = 0;
+		pInfo->PauseTime = 0;
+		pInfo->StopTimeSpec = TVTest::RECORD_STOP_NOTSPECIFIED;
+		if (pInfo->pszFileName && pInfo->MaxFileName > 0) pInfo->pszFileName[0] = L'\0';
+		return true;
+	}
+
+	bool StopRecord() override {
+		Wait("StopRecord");
+		std::lock_guard<std::mutex> lock(m_mutex);
+		const bool fRecording = m_fRecording;
+		m_fRecording = false;
+		return fRecording;
+	}
+
+	int GetVolume() override {
+		Wait("GetVolume");
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_volume;
+	}
+
+	bool SetVolume(int Volume) override {
+		Wait("SetVolume");
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_volume = std::clamp(Volume, 0, 100);
+		return true;
+	}
+
+	// 録画と TvtPlay の一時停止のコマンドだけ状態を変え、ほかは受け付けたことにする
+	bool DoCommand(LPCWSTR pszCommand) override {
+		Wait("DoCommand");
+		if (!pszCommand || pszCommand[0] == L'\0') return false;
+		const std::wstring_view command = pszCommand;
+		if (command == L"RecordEvent" || command == L"TimeShiftRecording") {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (!m_fRecording) {
+				m_fRecording = true;
+				m_recordStart = CurrentFileTime();
+			}
+		}
+		else if (command == L"tvtplay.tvtp:Pause" && m_tvtPlay) {
+			m_tvtPlay->TogglePause();
+		}
+		return true;
+	}
+
+	// 映像がないので保存できない
+	bool SaveImage() override {
+		Wait("SaveImage");
+		return false;
+	}
+
+	DWORD GetSetting(LPCWSTR pszName, LPWSTR pszString, DWORD MaxLength) override {
+		Wait("GetSetting");
+		return 0;
+	}
+
+	bool Reset(TVTest::ResetFlag Flags) override {
+		Wait("Reset");
+		return true;
+	}
+
+private:
+	void Wait(std::string_view api) const {
+		auto it = m_latencies.find(api);
+		const auto latency = it != m_latencies.end() ? it->second : m_defaultLatency;
+		if (latency.count() > 0) std::this_thread::sleep_for(latency);
+	}
+
+	// 終端を含めずに写した長さ
+	static int CopyString(LPWSTR pszDest, int MaxLength, std::wstring_view src) {
+		if (!pszDest || MaxLength <= 0) return 0;
+		const int length = std::min(static_cast<int>(src.size()), MaxLength - 1);
+		std::copy_n(src.data(), length, pszDest);
+		pszDest[length] = L'\0';
+		return length;
+	}
+
+	static void FillChannelInfo(const Service& ch, TVTest::ChannelInfo& info) {
+		info = {};
+		info.Size = sizeof(info);
+		info.Space = ch.Space;
+		info.Channel = ch.Channel;
+		info.NetworkID = ch.NetworkID;
+		info.TransportStreamID = ch.TransportStreamID;
+		info.ServiceID = ch.ServiceID;
+		info.Flags = TVTest::CHANNEL_FLAG_NONE;
+		CopyString(info.szChannelName, _countof(info.szChannelName), ch.Name);
+	}
+
+	// EpgTime::ToUnixTime の逆
+	static SYSTEMTIME UnixTimeToEpgTime(long long time) {
+		return EpgTime::FromUnixTime(time);
+	}
+
+	// GetSystemTimeAsFileTime の代わり (1601 年からの 100 ナノ秒単位)
+	static FILETIME CurrentFileTime() {
+		const auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+		const ULONGLONG value = static_cast<ULONGLONG>(now / 100) + 116444736000000000ULL;
+		FILETIME ft;
+		ft.dwLowDateTime = static_cast<DWORD>(value);
+		ft.dwHighDateTime = static_cast<DWORD>(value >> 32);
+		return ft;
+	}
+
+	static TVTest::EpgEventInfo* CreateEventInfo(const Event& ev) {
+		EventHolder* info = new EventHolder();
+		info->EventID = ev.EventID;
+		info->StartTime = UnixTimeToEpgTime(ev.Start);
+		info->Duration = ev.Duration;
+		info->pszEventName = ev.Name.c_str();
+		info->pszEventText = ev.Text.empty() ? nullptr : ev.Text.c_str();
+		info->pszEventExtendedText = ev.ExtText.empty() ? nullptr : ev.ExtText.c_str();
+		if (ev.Genre1 != 0xFF) {
+			info->Content.ContentNibbleLevel1 = ev.Genre1;
+			info->Content.ContentNibbleLevel2 = ev.Genre2;
+			info->ContentList = &info->Content;
+			info->ContentListLength = 1;
+		}
+		return info;
+	}
+
+	// 今のチャンネルで time にやっている番組
+	const Event* FindCurrentEvent(long long time) {
+		Service ch;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_services.empty()) return nullptr;
+			ch = m_services[m_current];
+		}
+		Event key;
+		key.NetworkID = ch.NetworkID;
+		key.TransportStreamID = ch.TransportStreamID;
+		key.ServiceID = ch.ServiceID;
+		return FindEventAt(key, time);
+	}
+
+	const Event* FindEventAt(const Event& service, long long time) const {
+		for (const auto& ev : m_events) {
+			if (ev.NetworkID == service.NetworkID && ev.TransportStreamID == service.TransportStreamID && ev.ServiceID == service.ServiceID
+				&& ev.Start <= time && time < ev.Start + static_cast<long long>(ev.Duration)) {
+				return &ev;
+			}
+		}
+		return nullptr;
+	}
+};
+
+// 負荷試験用: TVTest と TvtPlay の代わりに、config の [Fake] に従って作り物のチャンネルと番組表を返すものを作る
+inline void CreateFakeBackend(const ServerConfig& config, std::unique_ptr<ITVTestApp>& app, std::unique_ptr<ITvtPlay>& tvtPlay) {
+	auto fakeTvtPlay = std::make_unique<FakeTvtPlay>();
+	auto fakeApp = std::make_unique<FakeTVTestApp>();
+	fakeApp->SetTvtPlay(fakeTvtPlay.get());
+	fakeApp->SetDefaultLatency(std::chrono::microseconds(config.FakeLatencyUs));
+	for (const auto& [api, latency] : config.FakeLatencies) {
+		fakeApp->SetLatency(api, std::chrono::microseconds(latency));
+	}
+	const long long now = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	fakeApp->GenerateSample(config.FakeServices, config.FakeEventsPerService, now - now % 3600 - 3600);
+	app = std::move(fakeApp);
+	tvtPlay = std::move(fakeTvtPlay);
+}
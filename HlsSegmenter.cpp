@@ -0,0 +1,291 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include "LiveStream.cpp"
+#include "ServiceRemux.cpp"
+
+// ライブの TS を HLS のセグメントに切る (トランスコードはしない)
+// 映像のランダムアクセスポイントで 2 秒程度ごとに切り、固定数のリングに置く。
+// セグメントは作ったら書き換えないので、複数のクライアントに同じバッファをそのまま送れる。
+// プレイリストが読まれている間だけ LiveStream を購読する
+class HlsSegmenter {
+public:
+	static constexpr int64_t TargetDuration = 2 * 90000;       // PTS (90kHz)
+	static constexpr int64_t MaxDuration = 30 * 90000;         // これより長いものは PTS が飛んだとみなす
+	static constexpr size_t Capacity = 16;
+	static constexpr size_t PlaylistSize = 6;
+	static constexpr size_t MaxSegmentBytes = 16 * 1024 * 1024;
+	// この間プレイリストもセグメントも読まれなければ止める
+	static constexpr std::chrono::seconds IdleTimeout = std::chrono::seconds(30);
+
+	using Buffer = std::vector<uint8_t>;
+
+	struct Segment {
+		uint64_t Sequence = 0;
+		uint64_t DiscontinuitySequence = 0;
+		bool fDiscontinuity = false;  // 前のセグメントとつながっていない
+		double Duration = 0;          // 秒
+		std::shared_ptr<const Buffer> Data;
+	};
+
+private:
+	static constexpr size_t PacketSize = ServiceRemux::PacketSize;
+	static constexpr int64_t PtsMask = (int64_t(1) << 33) - 1;
+
+	LiveStream& m_stream;
+	std::atomic<uint16_t> m_serviceID = 0;  // 0 なら最初のサービス
+
+	// 出来上がったセグメント
+	Segment m_ring[Capacity];
+	uint64_t m_count = 0;  // 最新は m_ring[(m_count - 1) % Capacity]
+	mutable std::mutex m_mutex;
+
+	std::thread m_thread;
+	std::mutex m_threadMutex;
+	std::atomic<bool> m_fRunning = false;
+	std::atomic<int64_t> m_lastAccess = 0;  // steady_clock のミリ秒
+
+	// ここからは購読スレッドだけが触る
+	std::unique_ptr<ServiceRemux> m_remux;
+	uint16_t m_remuxServiceID = 0;
+	Buffer m_remuxed;
+	std::shared_ptr<Buffer> m_current;  // 作成中のセグメント
+	int64_t m_currentPts = -1;
+	std::chrono::steady_clock::time_point m_currentStart;
+	bool m_fNextDiscontinuity = false;
+	uint64_t m_discontinuitySequence = 0;
+	uint8_t m_pat[PacketSize] = {};
+	bool m_fHasPat = false;
+	Buffer m_pmt;  // 直近の PMT のパケット。セグメントの先頭に付ける
+
+public:
+	explicit HlsSegmenter(LiveStream& stream) : m_stream(stream) {}
+	~HlsSegmenter() { Stop(); }
+
+	void SetServiceID(uint16_t serviceID) { m_serviceID = serviceID; }
+
+	// リクエストのたびに呼ぶ。止まっていれば購読を始める
+	void Touch() {
+		m_lastAccess = NowMs();
+		if (m_fRunning) return;
+		std::lock_guard<std::mutex> lock(m_threadMutex);
+		if (m_fRunning) return;
+		if (m_thread.joinable()) m_thread.join();  // 待機が長くて自分で終わったもの
+		m_fRunning = true;
+		m_thread = std::thread([this]() { Run(); });
+	}
+
+	// LiveStream を Close してから呼ぶ
+	void Stop() {
+		std::lock_guard<std::mutex> lock(m_threadMutex);
+		if (m_thread.joinable()) m_thread.join();
+	}
+
+	// 新しいものを最大 PlaylistSize 個、古い順に
+	std::vector<Segment> GetPlaylist() const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		std::vector<Segment> segments;
+		const uint64_t first = m_count > PlaylistSize ? m_count - PlaylistSize : 0;
+		for (uint64_t i = first; i < m_count; i++) segments.push_back(m_ring[i % Capacity]);
+		return segments;
+	}
+
+	// リングに残っていなければ nullptr
+	std::shared_ptr<const Buffer> GetSegment(uint64_t sequence) const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (sequence >= m_count || m_count - sequence > Capacity) return nullptr;
+		return m_ring[sequence % Capacity].Data;
+	}
+
+	std::string GetM3u8() const {
+		auto segments = GetPlaylist();
+		double maxDuration = 0;
+		for (const auto& segment : segments) maxDuration = std::max(maxDuration, segment.Duration);
+
+		std::string out = "#EXTM3U\n#EXT-X-VERSION:3\n";
+		char buffer[64];
+		snprintf(buffer, sizeof(buffer), "#EXT-X-TARGETDURATION:%d\n", std::max(1, static_cast<int>(std::ceil(maxDuration))));
+		out += buffer;
+		if (!segments.empty()) {
+			out += "#EXT-X-MEDIA-SEQUENCE:" + std::to_string(segments.front().Sequence) + "\n";
+			out += "#EXT-X-DISCONTINUITY-SEQUENCE:" + std::to_string(segments.front().DiscontinuitySequence) + "\n";
+		}
+		for (size_t i = 0; i < segments.size(); i++) {
+			if (i > 0 && segments[i].fDiscontinuity) out += "#EXT-X-DISCONTINUITY\n";
+			snprintf(buffer, sizeof(buffer), "#EXTINF:%.3f,\n", segments[i].Duration);
+			out += buffer;
+			out += std::to_string(segments[i].Sequence) + ".ts\n";
+		}
+		return out;
+	}
+
+private:
+	static int64_t NowMs() {
+		return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	void Run() {
+		LiveStream::Subscriber subscriber(m_stream);
+		while (true) {
+			auto chunks = subscriber.Read(std::chrono::milliseconds(500));
+			if (!chunks || NowMs() - m_lastAccess > std::chrono::milliseconds(IdleTimeout).count()) break;
+
+			auto services = m_stream.GetServiceMap();
+			const ServiceMap::Service* pService = services ? FindService(*services) : nullptr;
+			if (!pService) {
+				// チャンネル変更直後。PMT を取得するまで待つ
+				DiscardCurrent();
+				continue;
+			}
+			m_remuxed.clear();
+			for (const auto& chunk : *chunks) m_remux->Process(*services, chunk->data(), chunk->size(), m_remuxed);
+			for (size_t pos = 0; pos + PacketSize <= m_remuxed.size(); pos += PacketSize) {
+				ProcessPacket(*pService, m_remuxed.data() + pos);
+			}
+		}
+
+		// 止めたら作成中のものも出来上がったものも捨てる
+		DiscardCurrent();
+		m_remux.reset();
+		m_fHasPat = false;
+		m_pmt.clear();
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			for (auto& segment : m_ring) segment.Data.reset();
+			m_count = 0;
+		}
+		m_fRunning = false;
+	}
+
+	const ServiceMap::Service* FindService(const ServiceMap& services) {
+		uint16_t serviceID = m_serviceID;
+		if (serviceID == 0 && !services.Services.empty()) serviceID = services.Services.begin()->first;
+		auto it = services.Services.find(serviceID);
+		if (it == services.Services.end()) return nullptr;
+		if (!m_remux || m_remuxServiceID != serviceID) {
+			m_remux = std::make_unique<ServiceRemux>(serviceID);
+			m_remuxServiceID = serviceID;
+			DiscardCurrent();
+			m_fHasPat = false;
+			m_pmt.clear();
+		}
+		return &it->second;
+	}
+
+	void DiscardCurrent() {
+		if (m_current || m_currentPts >= 0) m_fNextDiscontinuity = true;
+		m_current.reset();
+		m_currentPts = -1;
+	}
+
+	void ProcessPacket(const ServiceMap::Service& service, const uint8_t* p) {
+		const uint16_t pid = static_cast<uint16_t>(((p[1] & 0x1F) << 8) | p[2]);
+		const bool fStart = (p[1] & 0x40) != 0;
+
+		// セグメントの先頭に付けるために PAT と PMT をとっておく
+		if (pid == ServiceRemux::PID_PAT) {
+			std::memcpy(m_pat, p, PacketSize);
+			m_fHasPat = true;
+		}
+		else if (pid == service.PMTPID) {
+			if (fStart) m_pmt.clear();
+			if (fStart || !m_pmt.empty()) m_pmt.insert(m_pmt.end(), p, p + PacketSize);
+		}
+		else if (pid == service.VideoPID && fStart) {
+			const int64_t pts = ParsePts(p);
+			if (pts >= 0 && IsRandomAccess(p, service.VideoStreamType)) {
+				if (m_current) {
+					const int64_t elapsed = (pts - m_currentPts) & PtsMask;
+					if (elapsed >= TargetDuration) Finish(elapsed);
+				}
+				if (!m_current && m_fHasPat && !m_pmt.empty()) Begin(pts);
+			}
+		}
+
+		if (!m_current) return;
+		m_current->insert(m_current->end(), p, p + PacketSize);
+		if (m_current->size() > MaxSegmentBytes) DiscardCurrent();
+	}
+
+	void Begin(int64_t pts) {
+		m_current = std::make_shared<Buffer>();
+		m_current->reserve(4 * 1024 * 1024);
+		m_current->insert(m_current->end(), m_pat, m_pat + PacketSize);
+		m_current->insert(m_current->end(), m_pmt.begin(), m_pmt.end());
+		m_currentPts = pts;
+		m_currentStart = std::chrono::steady_clock::now();
+	}
+
+	void Finish(int64_t elapsed) {
+		Segment segment;
+		if (m_fNextDiscontinuity) {
+			segment.fDiscontinuity = true;
+			m_discontinuitySequence++;
+			m_fNextDiscontinuity = false;
+		}
+		// PTS が飛んだときは経過時間で代用し、次のセグメントとは切り離す
+		if (elapsed < MaxDuration) {
+			segment.Duration = elapsed / 90000.0;
+		}
+		else {
+			segment.Duration = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_currentStart).count();
+			m_fNextDiscontinuity = true;
+		}
+		segment.DiscontinuitySequence = m_discontinuitySequence;
+		m_current->shrink_to_fit();
+		segment.Data = std::move(m_current);
+		m_currentPts = -1;
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		segment.Sequence = m_count;
+		m_ring[m_count % Capacity] = std::move(segment);
+		m_count++;
+	}
+
+	// PES ヘッダの PTS。なければ -1
+	static int64_t ParsePts(const uint8_t* p) {
+		size_t pos = 4;
+		if (p[3] & 0x20) pos += 1 + p[4];  // adaptation_field
+		if (!(p[3] & 0x10) || pos + 14 > PacketSize) return -1;
+		const uint8_t* pes = p + pos;
+		if (pes[0] != 0x00 || pes[1] != 0x00 || pes[2] != 0x01 || !(pes[7] & 0x80)) return -1;
+		return
+			(static_cast<int64_t>(pes[9] & 0x0E) << 29) |
+			(static_cast<int64_t>(pes[10]) << 22) |
+			(static_cast<int64_t>(pes[11] & 0xFE) << 14) |
+			(static_cast<int64_t>(pes[12]) << 7) |
+			(static_cast<int64_t>(pes[13]) >> 1);
+	}
+
+	// random_access_indicator か、ペイロードの先頭に MPEG-2 のシーケンスヘッダ / H.264 の SPS / H.265 の VPS があるか
+	static bool IsRandomAccess(const uint8_t* p, uint8_t streamType) {
+		size_t pos = 4;
+		if (p[3] & 0x20) {
+			if (p[4] > 0 && (p[5] & 0x40)) return true;
+			pos += 1 + p[4];
+		}
+		if (pos + 9 > PacketSize) return false;
+		pos += 9 + p[pos + 8];  // PES ヘッダ
+		for (; pos + 4 <= PacketSize; pos++) {
+			if (p[pos] != 0x00 || p[pos + 1] != 0x00 || p[pos + 2] != 0x01) continue;
+			const uint8_t code = p[pos + 3];
+			switch (streamType) {
+			case 0x02: if (code == 0xB3) return true; break;                   // sequence_header
+			case 0x1B: if ((code & 0x9F) == 7) return true; break;             // SPS
+			case 0x24: if ((code & 0xFE) == (32 << 1)) return true; break;     // VPS
+			}
+		}
+		return false;
+	}
+};
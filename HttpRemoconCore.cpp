@@ -0,0 +1,1201 @@
+﻿#include "HttpRemoconCore.h"
+#include <thread>
+#include <chrono>
+#include <limits>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include "Compression.cpp"
+#include "RequestParser.cpp"
+#include "StringConvert.cpp"
+#include "EpgTime.cpp"
+
+static const char* allowOrigin = "*";
+static const char delimiter = ',';
+
+static std::string MsecToTime(int msec) {
+	int total_sec = msec / 1000;
+	int s = total_sec % 60;
+	int m = (total_sec / 60) % 60;
+	int h = total_sec / 3600;
+
+	std::ostringstream oss;
+	if (h > 0) oss << h << ":";
+	oss << std::setw(2) << std::setfill('0') << m << ":"
+		<< std::setw(2) << std::setfill('0') << s;
+	return oss.str();
+}
+
+static std::wstring GetTvtpStatus(ITvtPlay& tvtPlay, long position, long duration) {
+	if (position == -1) {
+		return std::wstring();
+	}
+	if (position >= duration || (position == 0 && duration == 0)) {
+		return L"finished";
+	}
+
+	if (!tvtPlay.IsRunning()) {
+		return std::wstring();
+	}
+	return tvtPlay.IsPaused() ? L"paused" : L"playing";
+}
+
+static void PrintChannel(std::ostringstream& output, const WCHAR* szDriver, const TVTest::ChannelInfo& ch) {
+	std::string sDriver = WideCharToUTF8(szDriver);
+	std::string sChannelName = WideCharToUTF8(ch.szChannelName);
+
+	output << sDriver << delimiter
+		<< ch.Space << delimiter
+		<< ch.Channel << delimiter
+		<< ch.ServiceID << ": "
+		<< sChannelName << "\n";
+}
+
+// 例外のメッセージを UTF-8 にする。Windows の what() は ANSI コードページ
+static std::string ExceptionMessage(const char* what) {
+#ifdef _WIN32
+	int len = MultiByteToWideChar(CP_ACP, 0, what, -1, nullptr, 0);
+	if (len == 0) {
+		return "";
+	}
+	std::wstring wstr(len - 1, L'\0'); // 終端文字分を引く
+	MultiByteToWideChar(CP_ACP, 0, what, -1, &wstr[0], len);
+	return convertWstringToUtf8(wstr);
+#else
+	return what;
+#endif
+}
+
+
+HttpRemoconCore::HttpRemoconCore(std::unique_ptr<ITVTestApp> app, std::unique_ptr<ITvtPlay> tvtPlay, const ServerConfig& config)
+	: m_app(std::move(app))
+	, m_tvtPlay(std::move(tvtPlay))
+	, m_config(config)
+{
+	// 同じ名前とラベルのものは前に登録したものが返るので、作り直しても増えない
+	for (int i = 0; i < API_COUNT; i++) {
+		m_apiHistograms[i] = Metrics::RegisterHistogram("httpremocon_tvtest_api_duration_seconds", "TVTest API call latency", "api", ApiNames[i]);
+	}
+	m_limiter.Configure(m_config.RouteConcurrency);
+}
+
+
+void HttpRemoconCore::Start(const std::filesystem::path& assetDirectory)
+{
+	// クライアントの HTML は起動時に読み込んで圧縮しておく
+	m_assets.Load(assetDirectory);
+	if (m_config.WatchStaticFiles) {
+		m_assets.StartWatching();
+	}
+
+	m_signalHistory.Start([this](SignalHistory::Sample& sample) {
+		TVTest::StatusInfo status = {};
+		if (!CallApi(API_GET_STATUS, [&] { return m_app->GetStatus(&status); })) return false;
+		sample.SignalLevel = status.SignalLevel;
+		sample.BitRate = status.BitRate;
+		sample.Drop = status.DropPacketCount;
+		sample.Error = status.ErrorPacketCount;
+		sample.Scramble = status.ScramblePacketCount;
+		return true;
+		});
+}
+
+
+bool HttpRemoconCore::Listen(const std::function<void()>& addRoutes)
+{
+	// 止めてからもう一度起動したときは登録し直す
+	m_router.Clear();
+	AddCoreRoutes();
+	if (addRoutes) addRoutes();
+
+	m_server.set_exception_handler([](const auto& req, auto& res, std::exception_ptr ep) {
+		try {
+			std::rethrow_exception(ep);
+		}
+		catch (std::exception& e) {
+			res.set_content(ExceptionMessage(e.what()), "text/plain");
+		}
+		catch (...) {
+			res.set_content("Unknown Exception", "text/plain");
+		}
+		res.status = 500;
+		});
+
+	// httplib には何にでも当たるものを 1 つずつ登録し、振り分けは m_router でする
+	auto dispatch = [this](const httplib::Request& req, httplib::Response& res) { Dispatch(req, res); };
+	m_server.Get(".*", dispatch);
+	m_server.Post(".*", dispatch);
+	m_server.Delete(".*", dispatch);
+	// CORS のプリフライト。JSON の本文を POST するときに来る
+	m_server.Options(".*", [this](const httplib::Request& req, httplib::Response& res) {
+		const unsigned methods = req.path == "*" ? (1u << Router::METHOD_COUNT) - 1 : m_router.GetMethods(req.path);
+		if (methods == 0) {
+			res.status = 404;
+			return;
+		}
+		const auto allow = Router::FormatMethods(methods);
+		res.set_header("Allow", allow);
+		res.set_header("Access-Control-Allow-Methods", allow);
+		res.set_header("Access-Control-Allow-Headers", "Content-Type, Accept");
+		res.status = 204;
+		});
+	m_server.set_default_headers({
+		{ "Access-Control-Allow-Origin", allowOrigin },
+		});
+	const auto threadCount = m_config.ThreadCount;
+	m_server.new_task_queue = [threadCount] { return new httplib::ThreadPool(threadCount); };
+	m_server.set_keep_alive_max_count(m_config.KeepAliveMaxCount);
+	m_server.set_keep_alive_timeout(m_config.KeepAliveTimeoutSec);
+	m_server.set_read_timeout(m_config.ReadTimeoutSec, 0);
+	m_server.set_write_timeout(m_config.WriteTimeoutSec, 0);
+	m_server.set_payload_max_length(m_config.PayloadMaxLength);
+	return m_server.listen(m_config.Host, m_config.Port);
+}
+
+
+void HttpRemoconCore::Stop()
+{
+	if (m_server.is_running()) {
+		m_server.stop();
+	}
+	m_assets.StopWatching();
+	m_signalHistory.Stop();
+}
+
+
+void HttpRemoconCore::AddCoreRoutes()
+{
+	Post("/play", [this](const httplib::Request& req, httplib::Response& res) {
+		std::wstring filePath = convertUtf8ToWstring(req.body);
+
+		// /tvtpipe はすでにあるものとみなす
+		if (!CallApi(API_SET_DRIVER_NAME, [&] { return m_app->SetDriverName(L"BonDriver_Pipe.dll"); })) {
+			res.status = 500;
+			res.set_content("Failed SetDriverName", "text/plain");
+			return;
+		}
+		// ServiceId が正常に 0 なのにエラー発生が返る。エラーチェックはしない
+		CallApi(API_SET_CHANNEL, [&] { return m_app->SetChannel(0, 0); });
+
+		// ドラッグアンドドロップとしてファイルを開く
+		if (!m_tvtPlay->OpenFile(filePath)) {
+			res.status = 500;
+			res.set_content("Failed FindWindow", "text/plain");
+			return;
+		}
+
+		int retry = 0;
+		while (!m_tvtPlay->IsOpen()) {
+			retry++;
+			if (retry > 5) {
+				res.status = 500;
+				res.set_content("Failed Open", "text/plain");
+				return;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(500));
+		}
+
+		res.status = 200;
+		});
+
+	Get("/play/pause", [this](const httplib::Request& req, httplib::Response& res) {
+		if (!m_tvtPlay->IsRunning()) {
+			res.status = 500;
+			res.set_content("Failed FindWindow: TvtPlay Frame", "text/plain");
+			return;
+		}
+
+		bool paused = m_tvtPlay->IsPaused();
+		res.status = 200;
+		res.set_content(std::to_string(paused), "text/plain");
+		});
+
+	Post("/play/pause", [this](const httplib::Request& req, httplib::Response& res) {
+		// トグルしかできないので body は見ない
+		if (!CallApi(API_DO_COMMAND, [&] { return m_app->DoCommand(L"tvtplay.tvtp:Pause"); })) {
+			res.status = 500;
+			res.set_content("Failed DoCommand: tvtplay.tvtp:Pause", "text/plain");
+			return;
+		}
+		res.status = 200;
+		});
+
+	Get("/play/pos", [this](const httplib::Request& req, httplib::Response& res) {
+		auto pos = m_tvtPlay->GetPosition();
+		if (pos < 0) {
+			res.status = 500;
+			res.set_content("Failed FindWindow: TvtPlay Frame", "text/plain");
+			return;
+		}
+		res.set_content(MsecToTime(pos), "text/plain");
+		res.status = 200;
+		});
+
+	Post("/play/pos", [this](const httplib::Request& req, httplib::Response& res) {
+		if (!m_tvtPlay->IsRunning()) {
+			res.status = 500;
+			res.set_content("Failed FindWindow: TvtPlay Frame", "text/plain");
+			return;
+		}
+
+		RequestParser::Seek seek;
+		if (const char* error = RequestParser::ParseSeek(req.body, seek)) {
+			res.status = 400;
+			res.set_content(error, "text/plain");
+			return;
+		}
+
+		m_tvtPlay->Seek(seek.Msec, seek.fRelative);
+
+		// 現在時刻への反映に時間がかかるので返すのはやめる
+		res.status = 200;
+		});
+
+	Get("/play/speed", [this](const httplib::Request& req, httplib::Response& res) {
+		auto stretch = m_tvtPlay->GetStretch();
+		if (stretch < 0) {
+			res.status = 500;
+			res.set_content("Failed FindWindow: TvtPlay Frame", "text/plain");
+			return;
+		}
+		res.set_content(std::to_string(stretch), "text/plain");
+		res.status = 200;
+		});
+
+	Post("/play/speed", [this](const httplib::Request& req, httplib::Response& res) {
+		// TvtPlay を見てもあんまり柔軟なことはできなそう
+		std::wstring command = L"tvtplay.tvtp:Stretch";
+		if (req.body.length() == 1 && 'A' <= req.body[0] && req.body[0] <= 'Z') {
+			command += req.body[0];
+		}
+
+		if (!CallApi(API_DO_COMMAND, [&] { return m_app->DoCommand(command.c_str()); })) {
+			res.status = 500;
+			std::string error_message = "Failed DoCommand: " + convertWstringToUtf8(command);
+			res.set_content(error_message, "text/plain");
+			return;
+		}
+
+		res.status = 200;
+		});
+
+	Get("/vol", [this](const httplib::Request& req, httplib::Response& res) {
+		int vol = CallApi(API_GET_VOLUME, [&] { return m_app->GetVolume(); });
+		res.set_content(std::to_string(vol), "text/plain");
+		res.status = 200;
+		});
+
+	Post("/vol", [this](const httplib::Request& req, httplib::Response& res) {
+		RequestParser::Volume volume;
+		if (const char* error = RequestParser::ParseVolume(req.body, volume)) {
+			res.status = 400;
+			res.set_content(error, "text/plain");
+			return;
+		}
+
+		int currentVolume = volume.Value;
+		if (volume.fRelative) {
+			// 相対値として設定
+			currentVolume += CallApi(API_GET_VOLUME, [&] { return m_app->GetVolume(); });
+		}
+
+		// 音量が範囲内に収まるように制限
+		if (currentVolume < 0) currentVolume = 0;
+		if (currentVolume > 100) currentVolume = 100;
+
+		if (!CallApi(API_SET_VOLUME, [&] { return m_app->SetVolume(currentVolume); })) {
+			res.status = 500;
+			res.set_content("Failed SetVolume", "text/plain");
+			return;
+		}
+		res.set_content(std::to_string(currentVolume), "text/plain");
+
+		res.status = 200;
+		});
+
+	Get("/ch", [this](const httplib::Request& req, httplib::Response& res) {
+		// Accept で JSON / MessagePack / CBOR を指定されたときだけ構造化して返す
+		const auto& accept = req.get_header_value("Accept");
+		if (StructuredWriter::IsRequested(accept)) {
+			auto writer = StructuredWriter::Create(accept);
+			WriteTunerList(*writer);
+			res.set_content(writer->Output(), writer->ContentType());
+		}
+		else {
+			res.set_content(GetTunerList(), "text/plain");
+		}
+		res.status = 200;
+		});
+
+	Post("/ch", [this](const httplib::Request& req, httplib::Response& res) {
+		m_zapTracer.Begin();
+		SetChannel(req.body, res);
+		});
+
+	Get("/metrics", [this](const httplib::Request& req, httplib::Response& res) {
+		res.set_content(Metrics::Scrape(), "text/plain; version=0.0.4; charset=utf-8");
+		res.status = 200;
+		});
+
+	// chrome://tracing や Perfetto で開ける
+	Get("/debug/trace", [this](const httplib::Request& req, httplib::Response& res) {
+		res.set_content(Tracer::DumpChromeTrace(), "application/json");
+		res.status = 200;
+		});
+
+	Get("/metrics/zap", [this](const httplib::Request& req, httplib::Response& res) {
+		auto writer = StructuredWriter::Create(req.get_header_value("Accept"));
+		WriteZapMetrics(*writer);
+		res.set_content(writer->Output(), writer->ContentType());
+		res.status = 200;
+		});
+
+	Get("/signal/history", [this](const httplib::Request& req, httplib::Response& res) {
+		WriteSignalHistory(req, res);
+		});
+
+	Get("/rec", [this](const httplib::Request& req, httplib::Response& res) {
+		TVTest::RecordStatusInfo status = {};
+		CallApi(API_GET_RECORD_STATUS, [&] { return m_app->GetRecordStatus(&status); });
+
+		res.status = 200;
+		switch (status.Status) {
+		case TVTest::RECORD_STATUS_NOTRECORDING:
+			res.set_content("Not recording", "text/plain");
+			return;
+
+		case TVTest::RECORD_STATUS_RECORDING:
+			res.set_content("Recording", "text/plain");
+			return;
+
+		case TVTest::RECORD_STATUS_PAUSED:
+			res.set_content("Paused", "text/plain");
+			return;
+
+		default:
+			res.status = 500;
+			res.set_content("Invalid status", "text/plain");
+			return;
+		}
+		});
+
+	Post("/rec", [this](const httplib::Request& req, httplib::Response& res) {
+		TVTest::RecordStatusInfo status = {};
+
+		if (req.body == "start") {
+			CallApi(API_GET_RECORD_STATUS, [&] { return m_app->GetRecordStatus(&status); });
+			if (status.Status == TVTest::RECORD_STATUS_RECORDING) {
+				res.status = 400;
+				res.set_content("Already start recording", "text/plain");
+				return;
+			}
+
+			if (!CallApi(API_DO_COMMAND, [&] { return m_app->DoCommand(L"TimeShiftRecording"); })) {
+				res.status = 500;
+				res.set_content("Failed DoCommand: TimeShiftRecording", "text/plain");
+				return;
+			}
+
+			if (!CallApi(API_DO_COMMAND, [&] { return m_app->DoCommand(L"RecordEvent"); })) {
+				res.status = 500;
+				res.set_content("Failed DoCommand: RecordEvent", "text/plain");
+				return;
+			}
+
+			// 録画ファイル名を取得
+			WCHAR fileName[MAX_PATH] = {};
+			status.pszFileName = fileName;
+			status.MaxFileName = MAX_PATH;
+			CallApi(API_GET_RECORD_STATUS, [&] { return m_app->GetRecordStatus(&status); });
+
+			res.set_content(WideCharToUTF8(fileName), "text/plain");
+			res.status = 200;
+		}
+		else if (req.body == "stop") {
+
+			// 録画ファイル名を取得
+			WCHAR fileName[MAX_PATH] = {};
+			status.pszFileName = fileName;
+			status.MaxFileName = MAX_PATH;
+			CallApi(API_GET_RECORD_STATUS, [&] { return m_app->GetRecordStatus(&status); });
+
+			if (status.Status != TVTest::RECORD_STATUS_RECORDING) {
+				res.status = 400;
+				res.set_content("Not yet started recording", "text/plain");
+				return;
+			}
+
+			if (!CallApi(API_STOP_RECORD, [&] { return m_app->StopRecord(); })) {
+				res.status = 500;
+				res.set_content("Failed StopRecord", "text/plain");
+				return;
+			}
+
+			res.set_content(WideCharToUTF8(fileName), "text/plain");
+			res.status = 200;
+		}
+		else {
+			res.status = 400;
+			res.set_content("Invalid operation value", "text/plain");
+		}
+		});
+
+	Post("/view/panel", [this](const httplib::Request& req, httplib::Response& res) {
+		// トグルしかできないので body は見ない
+		if (!CallApi(API_DO_COMMAND, [&] { return m_app->DoCommand(L"Panel"); })) {
+			res.status = 500;
+			res.set_content("Failed DoCommand: Panel", "text/plain");
+			return;
+		}
+
+		res.status = 200;
+		});
+
+	Post("/view/reset", [this](const httplib::Request& req, httplib::Response& res) {
+		RequestParser::Reset reset;
+		if (const char* error = RequestParser::ParseReset(req.body, reset)) {
+			res.status = 400;
+			res.set_content(error, "text/plain");
+			return;
+		}
+		if (!CallApi(API_RESET, [&] { return m_app->Reset(static_cast<TVTest::ResetFlag>(reset.Flags)); })) {
+			res.status = 500;
+			res.set_content("Failed Reset", "text/plain");
+			return;
+		}
+
+		res.status = 200;
+		});
+
+	Post("/view/rebuild", [this](const httplib::Request& req, httplib::Response& res) {
+		if (!CallApi(API_DO_COMMAND, [&] { return m_app->DoCommand(L"RebuildViewer"); })) {
+			res.status = 500;
+			res.set_content("Failed Rebuild", "text/plain");
+			return;
+		}
+
+		res.status = 200;
+		});
+
+	Get("/status", [this](const httplib::Request& req, httplib::Response& res) {
+		auto writer = StructuredWriter::Create(req.get_header_value("Accept"));
+		// 番組のテキストは /event/{service_id}/{event_id} で別に取れるので、バイナリ形式では既定で省く
+		bool fText = req.has_param("text") ? req.get_param_value("text") != "0" : writer->IsText();
+		// ジャンルの名前の言語 (ja / en)
+		AribGenre::Language lang = AribGenre::LANG_JA;
+		if (req.has_param("lang") && !AribGenre::FindLanguage(req.get_param_value("lang"), lang)) {
+			res.status = 400;
+			res.set_content("Invalid lang", "text/plain");
+			return;
+		}
+		WriteStatus(*writer, fText, lang);
+		res.set_content(writer->Output(), writer->ContentType());
+		res.status = 200;
+		});
+
+	// ジャンルの表。/epg などはジャンルを番号だけで返すので、クライアントはこれを一度取ってキャッシュしておく
+	// lang (ja / en) を付けるとその言語の名前だけを返す
+	Get("/genres", [](const httplib::Request& req, httplib::Response& res) {
+		int firstLang = 0;
+		int lastLang = AribGenre::LANG_COUNT;
+		if (req.has_param("lang")) {
+			AribGenre::Language lang;
+			if (!AribGenre::FindLanguage(req.get_param_value("lang"), lang)) {
+				res.status = 400;
+				res.set_content("Invalid lang", "text/plain");
+				return;
+			}
+			firstLang = lang;
+			lastLang = lang + 1;
+		}
+		auto writer = StructuredWriter::Create(req.get_header_value("Accept"));
+		auto names = [&](auto get) {
+			for (int lang = firstLang; lang < lastLang; lang++) {
+				writer->Field(AribGenre::LanguageNames[lang], get(static_cast<AribGenre::Language>(lang)));
+			}
+		};
+		writer->BeginObject();
+		writer->Key("genres");
+		writer->BeginArray();
+		for (uint8_t level1 = 0; level1 < AribGenre::DefinedLevel1Count; level1++) {
+			writer->BeginObject();
+			writer->Field("level1", level1);
+			names([&](AribGenre::Language lang) { return AribGenre::GetName(level1, lang); });
+			writer->Key("sub");
+			writer->BeginArray();
+			for (uint8_t level2 = 0; level2 < AribGenre::Level2Count; level2++) {
+				if (AribGenre::GetSubName(level1, level2).empty()) continue;
+				writer->BeginObject();
+				writer->Field("level2", level2);
+				names([&](AribGenre::Language lang) { return AribGenre::GetSubName(level1, level2, lang); });
+				writer->EndObject();
+			}
+			writer->EndArray();
+			writer->EndObject();
+		}
+		writer->EndArray();
+		// 表にないものの名前
+		writer->Key("other");
+		writer->BeginObject();
+		names([&](AribGenre::Language lang) { return AribGenre::Other[lang]; });
+		writer->EndObject();
+		writer->EndObject();
+
+		res.set_header("Cache-Control", "max-age=86400");
+		res.set_content(writer->Output(), writer->ContentType());
+		res.status = 200;
+		});
+
+	// 番組のテキストは変化が少ないので /status とは別にキャッシュできるようにする
+	Get("/event/{service_id}/{event_id}", [this](const httplib::Request& req, httplib::Response& res, const Router::Params& params) {
+		TVTest::EpgEventQueryInfo QueryInfo = {};
+		if (!RequestParser::ParseInt(params[0], QueryInfo.ServiceID) || !RequestParser::ParseInt(params[1], QueryInfo.EventID)) {
+			res.status = 404;
+			res.set_content("Event not found", "text/plain");
+			return;
+		}
+		TVTest::ChannelInfo ChInfo = {};
+		if (!CallApi(API_GET_CURRENT_CHANNEL_INFO, [&] { return m_app->GetCurrentChannelInfo(&ChInfo); })) {
+			res.status = 500;
+			res.set_content("Failed GetCurrentChannelInfo", "text/plain");
+			return;
+		}
+		QueryInfo.NetworkID = ChInfo.NetworkID;
+		QueryInfo.TransportStreamID = ChInfo.TransportStreamID;
+		QueryInfo.Type = TVTest::EPG_EVENT_QUERY_EVENTID;
+		QueryInfo.Flags = TVTest::EPG_EVENT_QUERY_FLAG_NONE;
+		TVTest::EpgEventInfo* pEvent = CallApi(API_GET_EPG_EVENT_INFO, [&] { return m_app->GetEpgEventInfo(&QueryInfo); });
+		if (pEvent == nullptr) {
+			res.status = 404;
+			res.set_content("Event not found", "text/plain");
+			return;
+		}
+
+		auto writer = StructuredWriter::Create(req.get_header_value("Accept"));
+		writer->BeginObject();
+		writer->Field("service_id", QueryInfo.ServiceID);
+		writer->Field("event_id", pEvent->EventID);
+		writer->Field("event_name", WideCharToUTF8(pEvent->pszEventName));
+		writer->Field("event_start_time", EpgTime::ToIsoString(pEvent->StartTime));
+		writer->Field("event_duration", pEvent->Duration);
+		writer->Field("event_text", WideCharToUTF8(pEvent->pszEventText));
+		writer->Field("event_ext_text", WideCharToUTF8(pEvent->pszEventExtendedText));
+		writer->EndObject();
+		m_app->FreeEpgEventInfo(pEvent);
+
+		res.set_header("Cache-Control", "max-age=60");
+		res.set_content(writer->Output(), writer->ContentType());
+		res.status = 200;
+		});
+
+	// 番組表。サービスごとに取得して 1 番組ずつ書き出すので、全体をメモリに持たない
+	Get("/epg", [this](const httplib::Request& req, httplib::Response& res) {
+		StreamEpg(req, res);
+		});
+
+	auto serveAsset = [this](const httplib::Request& req, httplib::Response& res) {
+		if (!m_assets.Serve(req, res)) {
+			res.status = 404;
+			res.set_content("HttpRemoconCli.html not found", "text/plain");
+		}
+		};
+	Get("/", serveAsset);
+	Get("/HttpRemoconCli.html", serveAsset);
+
+	// 登録したルートの一覧
+	Get("/routes", [this](const httplib::Request& req, httplib::Response& res) {
+		auto writer = StructuredWriter::Create(req.get_header_value("Accept"));
+		writer->BeginArray();
+		for (const auto& route : m_router.GetRoutes()) {
+			writer->BeginObject();
+			writer->Field("method", Router::MethodNames[route.Method]);
+			writer->Field("path", route.Pattern);
+			writer->EndObject();
+		}
+		writer->EndArray();
+		res.set_content(writer->Output(), writer->ContentType());
+		res.status = 200;
+		});
+}
+
+// パスに当たるルートのハンドラを呼ぶ。パスはあるがメソッドが違うときは 405
+void HttpRemoconCore::Dispatch(const httplib::Request& req, httplib::Response& res)
+{
+	Router::Method method;
+	if (!Router::ParseMethod(req.method, method)) {
+		res.status = 405;
+		return;
+	}
+	Router::Params params;
+	unsigned methods = 0;
+	const Router::Handler* handler = m_router.Find(method, req.path, params, methods);
+	if (handler) {
+		(*handler)(req, res, params);
+	}
+	else if (methods != 0) {
+		res.status = 405;
+		res.set_header("Allow", Router::FormatMethods(methods));
+	}
+	else {
+		res.status = 404;
+	}
+}
+
+// 同時実行数の上限を超えたリクエストは待たせずに 503 で返す
+Router::Handler HttpRemoconCore::Guard(const std::string& route, Router::Handler handler)
+{
+	auto slot = m_limiter.Find(route);
+	const int histogram = Metrics::RegisterHistogram("httpremocon_request_duration_seconds", "HTTP request latency by route", "route", route);
+	const char* traceName = Tracer::Intern(route);
+	return [this, slot, histogram, traceName, handler = std::move(handler)](const httplib::Request& req, httplib::Response& res, const Router::Params& params) {
+		Metrics::Timer timer(histogram);
+		HTTPREMOCON_TRACE_SCOPE(traceName);
+		if (!RouteLimiter::TryAcquire(slot)) {
+			res.status = 503;
+			res.set_header("Retry-After", "1");
+			res.set_content("Too many concurrent requests", "text/plain");
+			return;
+		}
+		RouteLimiter::Scope scope(std::make_shared<RouteLimiter::Permit>(slot));
+		handler(req, res, params);
+		CompressResponse(req, res);
+		Metrics::Add(Metrics::COUNTER_RESPONSE_BYTES, res.body.size());
+		};
+}
+
+// Accept-Encoding に応じてレスポンスを圧縮する
+// ハンドラが自分で Content-Encoding を付けたもの (圧縮済みの静的ファイル) はそのまま
+void HttpRemoconCore::CompressResponse(const httplib::Request& req, httplib::Response& res)
+{
+	if (m_config.CompressionMinSize < 0 || res.body.size() < static_cast<size_t>(m_config.CompressionMinSize)) return;
+	if (res.has_header("Content-Encoding")) return;
+	if (!Compression::IsCompressibleType(res.get_header_value("Content-Type"))) return;
+
+	res.set_header("Vary", "Accept-Encoding");
+	auto encoding = Compression::Negotiate(req.get_header_value("Accept-Encoding"));
+	if (encoding == ContentEncoding::Identity) return;
+
+	std::string compressed;
+	if (!Compression::Compress(encoding, res.body, compressed)) return;
+	res.body.swap(compressed);
+	res.set_header("Content-Encoding", Compression::Name(encoding));
+}
+
+void HttpRemoconCore::WriteStatus(StructuredWriter& w, bool fText, AribGenre::Language lang)
+{
+	w.BeginObject();
+
+	// 録画中
+	{
+		TVTest::RecordStatusInfo info = {};
+		if (CallApi(API_GET_RECORD_STATUS, [&] { return m_app->GetRecordStatus(&info); })) {
+			w.Field("record_status", info.Status);
+			w.Field("record_time", info.RecordTime);
+		}
+	}
+
+	// チャンネル
+	TVTest::ChannelInfo channel = {};
+	bool fChannel = CallApi(API_GET_CURRENT_CHANNEL_INFO, [&] { return m_app->GetCurrentChannelInfo(&channel); });
+	if (fChannel && channel.szChannelName && channel.szChannelName[0] != '\0') {
+		w.Field("channel_name", WideCharToUTF8(channel.szChannelName));
+	}
+
+	// 今の番組
+	WriteProgram(w, "current_", false, fText, lang, fChannel ? &channel : nullptr);
+
+	// 次の番組
+	WriteProgram(w, "next_", true, fText, lang, fChannel ? &channel : nullptr);
+
+	// 信号
+	{
+		TVTest::StatusInfo status = {};
+		if (CallApi(API_GET_STATUS, [&] { return m_app->GetStatus(&status); })) {
+			w.Field("signal_level", status.SignalLevel);
+			w.Field("drop", status.DropPacketCount);
+			w.Field("error", status.ErrorPacketCount);
+			w.Field("scramble", status.ScramblePacketCount);
+			w.Field("bit_rate", status.BitRate);
+		}
+	}
+
+	// TVTPlay
+	if (m_tvtPlay->IsRunning()) {
+		auto elapsed = m_tvtPlay->GetPosition();
+		if (elapsed >= 0) {
+			w.Field("elapsed_time", MsecToTime(elapsed));
+			w.Field("elapsed_ms", elapsed);
+		}
+		auto total = m_tvtPlay->GetDuration();
+		if (total >= 0) {
+			w.Field("total_time", MsecToTime(total));
+			w.Field("total_ms", total);
+		}
+		auto status = GetTvtpStatus(*m_tvtPlay, elapsed, total);
+		w.Field("play_status", convertWstringToUtf8(status));
+		auto speed = m_tvtPlay->GetStretch();
+		w.Field("speed", speed);
+	}
+
+	// TOT
+	{
+		auto tot = m_totSource ? m_totSource() : std::string();
+		if (!tot.empty()) {
+			w.Field("tot", tot);
+		}
+	}
+
+	w.Field("volume", CallApi(API_GET_VOLUME, [&] { return m_app->GetVolume(); }));
+	w.EndObject();
+}
+
+void HttpRemoconCore::WriteProgram(StructuredWriter& w, const char* prefix, bool fNext, bool fText, AribGenre::Language lang, const TVTest::ChannelInfo* pChannel)
+{
+	static constexpr int maxEventName = 1000;
+	static constexpr int maxEventText = 10000;
+	static constexpr int maxEventExtText = 10000;
+	WCHAR eventName[maxEventName] = {};
+	WCHAR eventText[maxEventText] = {};
+	WCHAR eventExtText[maxEventExtText] = {};
+	TVTest::ProgramInfo info = {};
+	info.MaxEventName = maxEventName;
+	info.pszEventName = eventName;
+	info.MaxEventText = maxEventText;
+	info.pszEventText = eventText;
+	info.MaxEventExtText = maxEventExtText;
+	info.pszEventExtText = eventExtText;
+	if (!CallApi(API_GET_CURRENT_PROGRAM_INFO, [&] { return m_app->GetCurrentProgramInfo(&info, fNext); }) || !info.pszEventName || info.pszEventName[0] == '\0') {
+		return;
+	}
+
+	auto key = [prefix](const char* name) { return std::string(prefix) + name; };
+	w.Field(key("event_id"), info.EventID);
+	w.Field(key("event_service_id"), info.ServiceID);
+	w.Field(key("event_name"), WideCharToUTF8(info.pszEventName));
+	w.Field(key("event_start_time"), EpgTime::ToIsoString(info.StartTime));
+	if (fText) {
+		w.Field(key("event_text"), WideCharToUTF8(info.pszEventText));
+		w.Field(key("event_ext_text"), WideCharToUTF8(info.pszEventExtText));
+	}
+	w.Field(key("event_duration"), info.Duration);
+
+	if (fNext || pChannel == nullptr) return;
+
+	EpgCache::Key cacheKey{ pChannel->NetworkID, pChannel->TransportStreamID, info.ServiceID, info.EventID };
+	auto summary = GetEventSummary(cacheKey);
+	if (summary && summary->HasContent) {
+		w.Field("current_content_nibble_level1", summary->ContentNibbleLevel1);
+		w.Field("current_content_nibble_level2", summary->ContentNibbleLevel2);
+		w.Field("current_content_nibble", AribGenre::GetLabel(summary->ContentNibbleLevel1, summary->ContentNibbleLevel2, lang));
+	}
+	else {
+		w.NullField("current_content_nibble_level1");
+		w.NullField("current_content_nibble_level2");
+		w.NullField("current_content_nibble");
+	}
+}
+
+// 番組のジャンルなどを取得する。キャッシュになければ EPG から取ってキャッシュする
+std::optional<EpgCache::Summary> HttpRemoconCore::GetEventSummary(const EpgCache::Key& key)
+{
+	if (auto cached = m_epgCache.Find(key)) {
+		return cached;
+	}
+
+	TVTest::EpgEventQueryInfo QueryInfo;
+	QueryInfo.NetworkID = key.NetworkID;
+	QueryInfo.TransportStreamID = key.TransportStreamID;
+	QueryInfo.ServiceID = key.ServiceID;
+	QueryInfo.EventID = key.EventID;
+	QueryInfo.Type = TVTest::EPG_EVENT_QUERY_EVENTID;
+	QueryInfo.Flags = TVTest::EPG_EVENT_QUERY_FLAG_NONE;
+	TVTest::EpgEventInfo* pEvent = CallApi(API_GET_EPG_EVENT_INFO, [&] { return m_app->GetEpgEventInfo(&QueryInfo); });
+	if (pEvent == nullptr) {
+		// まだ EPG が取れていないだけかもしれないのでキャッシュしない
+		return std::nullopt;
+	}
+
+	EpgCache::Summary summary;
+	if (pEvent->ContentListLength > 0 && pEvent->ContentList != nullptr) {
+		summary.HasContent = true;
+		summary.ContentNibbleLevel1 = pEvent->ContentList->ContentNibbleLevel1;
+		summary.ContentNibbleLevel2 = pEvent->ContentList->ContentNibbleLevel2;
+	}
+	m_app->FreeEpgEventInfo(pEvent);
+
+	m_epgCache.Insert(key, summary);
+	return summary;
+}
+
+// GET /epg?service=&from=&to=&fields=&format=
+// service: サービスIDのカンマ区切り (省略時は現在のチューナーの全サービス)
+// from, to: UNIX 時間 (秒)。この範囲にかかる番組だけ返す
+// fields: 返す項目のカンマ区切り (省略時はすべて)
+// format: json (既定) / ndjson
+void HttpRemoconCore::StreamEpg(const httplib::Request& req, httplib::Response& res)
+{
+	enum : unsigned {
+		FIELD_SERVICE_ID = 0x0001,
+		FIELD_EVENT_ID   = 0x0002,
+		FIELD_START_TIME = 0x0004,
+		FIELD_START      = 0x0008,
+		FIELD_DURATION   = 0x0010,
+		FIELD_NAME       = 0x0020,
+		FIELD_TEXT       = 0x0040,
+		FIELD_EXT_TEXT   = 0x0080,
+		FIELD_GENRE      = 0x0100,
+		FIELD_ALL        = 0x01FF,
+	};
+	static const std::pair<const char*, unsigned> fieldNames[] = {
+		{ "service_id", FIELD_SERVICE_ID },
+		{ "event_id", FIELD_EVENT_ID },
+		{ "start_time", FIELD_START_TIME },
+		{ "start", FIELD_START },
+		{ "duration", FIELD_DURATION },
+		{ "name", FIELD_NAME },
+		{ "text", FIELD_TEXT },
+		{ "ext_text", FIELD_EXT_TEXT },
+		{ "genre", FIELD_GENRE },
+	};
+
+	struct Service {
+		WORD NetworkID;
+		WORD TransportStreamID;
+		WORD ServiceID;
+	};
+	struct State {
+		std::vector<Service> Services;
+		size_t Next = 0;
+		long long From = std::numeric_limits<long long>::min();
+		long long To = std::numeric_limits<long long>::max();
+		unsigned Fields = FIELD_ALL;
+		bool fNdjson = false;
+		bool fStarted = false;
+		bool fFirst = true;
+		JsonWriter Writer;  // 1 番組ごとに使い回す
+		std::shared_ptr<RouteLimiter::Permit> Permit = RouteLimiter::Hold();  // 書き終わるまで [Concurrency] の /epg に数える
+	};
+	auto state = std::make_shared<State>();
+
+	auto split = [](const std::string& value, const std::function<bool(const std::string&)>& callback) {
+		std::istringstream iss(value);
+		std::string item;
+		while (std::getline(iss, item, delimiter)) {
+			if (!item.empty() && !callback(item)) return false;
+		}
+		return true;
+		};
+
+	std::vector<WORD> serviceIds;
+	const bool fServicesOK = split(req.get_param_value("service"), [&serviceIds](const std::string& item) {
+		WORD serviceID;
+		if (!RequestParser::ParseInt(item, serviceID)) return false;
+		serviceIds.push_back(serviceID);
+		return true;
+		});
+	if (!fServicesOK) {
+		res.status = 400;
+		res.set_content("Invalid service", "text/plain");
+		return;
+	}
+	if ((req.has_param("from") && !RequestParser::ParseInt(req.get_param_value("from"), state->From))
+		|| (req.has_param("to") && !RequestParser::ParseInt(req.get_param_value("to"), state->To))) {
+		res.status = 400;
+		res.set_content("Invalid from/to", "text/plain");
+		return;
+	}
+	if (req.has_param("fields")) {
+		state->Fields = 0;
+		std::string unknown;
+		split(req.get_param_value("fields"), [&state, &unknown](const std::string& item) {
+			for (const auto& [name, flag] : fieldNames) {
+				if (item == name) {
+					state->Fields |= flag;
+					return true;
+				}
+			}
+			unknown = item;
+			return false;
+			});
+		if (!unknown.empty()) {
+			res.status = 400;
+			res.set_content("Invalid field: " + unknown, "text/plain");
+			return;
+		}
+	}
+	state->fNdjson = req.get_param_value("format") == "ndjson"
+		|| req.get_header_value("Accept").find("application/x-ndjson") != std::string::npos;
+
+	std::wstring currentDriver;
+	EnumTunerChannels([&](const WCHAR* szDriver, const TVTest::ChannelInfo& ch, bool fCurrent) {
+		if (fCurrent) {
+			currentDriver = szDriver;
+			return;
+		}
+		if (serviceIds.empty()) {
+			if (currentDriver != szDriver) return;
+		}
+		else if (std::find(serviceIds.begin(), serviceIds.end(), ch.ServiceID) == serviceIds.end()) {
+			return;
+		}
+		for (const auto& service : state->Services) {
+			if (service.NetworkID == ch.NetworkID && service.TransportStreamID == ch.TransportStreamID && service.ServiceID == ch.ServiceID) {
+				return;
+			}
+		}
+		state->Services.push_back({ ch.NetworkID, ch.TransportStreamID, ch.ServiceID });
+		});
+
+	res.set_chunked_content_provider(state->fNdjson ? "application/x-ndjson" : "application/json",
+		[this, state](size_t offset, httplib::DataSink& sink) {
+			if (!state->fStarted) {
+				state->fStarted = true;
+				if (!state->fNdjson && !sink.write("[", 1)) return false;
+			}
+			if (state->Next >= state->Services.size()) {
+				if (!state->fNdjson && !sink.write("]", 1)) return false;
+				sink.done();
+				return true;
+			}
+
+			// 1 回の呼び出しで 1 サービス分を書き出す
+			const Service service = state->Services[state->Next++];
+			TVTest::EpgEventList list = {};
+			list.NetworkID = service.NetworkID;
+			list.TransportStreamID = service.TransportStreamID;
+			list.ServiceID = service.ServiceID;
+			if (!CallApi(API_GET_EPG_EVENT_LIST, [&] { return m_app->GetEpgEventList(&list); })) {
+				return true;
+			}
+
+			bool fOK = true;
+			const unsigned fields = state->Fields;
+			for (WORD i = 0; i < list.NumEvents && fOK; i++) {
+				const TVTest::EpgEventInfo& ev = *list.EventList[i];
+				const long long start = EpgTime::ToUnixTime(ev.StartTime);
+				if (start >= state->To || start + ev.Duration <= state->From) continue;
+
+				auto& w = state->Writer;
+				w.Output().clear();
+				if (!state->fNdjson && !state->fFirst) w.Output() += ',';
+				state->fFirst = false;
+
+				w.BeginObject();
+				if (fields & FIELD_SERVICE_ID) w.Field("service_id", service.ServiceID);
+				if (fields & FIELD_EVENT_ID) w.Field("event_id", ev.EventID);
+				if (fields & FIELD_START_TIME) w.Field("start_time", EpgTime::ToIsoString(ev.StartTime));
+				if (fields & FIELD_START) w.Field("start", start);
+				if (fields & FIELD_DURATION) w.Field("duration", ev.Duration);
+				if (fields & FIELD_NAME) w.Field("name", WideCharToUTF8(ev.pszEventName));
+				if (fields & FIELD_TEXT) w.Field("text", WideCharToUTF8(ev.pszEventText));
+				if (fields & FIELD_EXT_TEXT) w.Field("ext_text", WideCharToUTF8(ev.pszEventExtendedText));
+				if (fields & FIELD_GENRE) {
+					if (ev.ContentListLength > 0 && ev.ContentList != nullptr) {
+						w.Field("content_nibble_level1", ev.ContentList->ContentNibbleLevel1);
+						w.Field("content_nibble_level2", ev.ContentList->ContentNibbleLevel2);
+					}
+					else {
+						w.NullField("content_nibble_level1");
+						w.NullField("content_nibble_level2");
+					}
+				}
+				w.EndObject();
+				if (state->fNdjson) w.Output() += '\n';
+
+				fOK = sink.write(w.Output().data(), w.Output().size());
+			}
+			m_app->FreeEpgEventList(&list);
+			return fOK;
+		});
+	res.status = 200;
+}
+
+// チューナー/チャンネルを列挙する。最初は現在のチャンネル
+void HttpRemoconCore::EnumTunerChannels(const std::function<void(const WCHAR* szDriver, const TVTest::ChannelInfo& ch, bool fCurrent)>& callback)
+{
+	WCHAR szDriver[MAX_PATH];
+
+	{
+		TVTest::ChannelInfo ch;
+		CallApi(API_GET_CURRENT_CHANNEL_INFO, [&] { return m_app->GetCurrentChannelInfo(&ch); });
+		CallApi(API_GET_DRIVER_NAME, [&] { return m_app->GetDriverName(szDriver, _countof(szDriver)); });
+		callback(szDriver, ch, true);
+	}
+	{
+		for (int i = 0; CallApi(API_ENUM_DRIVER, [&] { return m_app->EnumDriver(i, szDriver, _countof(szDriver)); }) > 0; i++) {
+			TVTest::DriverTuningSpaceList spaces;
+			if (CallApi(API_GET_DRIVER_TUNING_SPACE_LIST, [&] { return m_app->GetDriverTuningSpaceList(szDriver, &spaces); })) {
+				for (DWORD j = 0; j < spaces.NumSpaces; j++) {
+					const TVTest::DriverTuningSpaceInfo& chs = *spaces.SpaceList[j];
+					for (DWORD k = 0; k < chs.NumChannels; k++) {
+						const TVTest::ChannelInfo& ch = *chs.ChannelList[k];
+						if (!(ch.Flags & TVTest::CHANNEL_FLAG_DISABLED)) {
+							callback(szDriver, ch, false);
+						}
+					}
+				}
+
+				m_app->FreeDriverTuningSpaceList(&spaces);
+			}
+		}
+	}
+}
+
+// チューナー/チャンネルのリストを取得する
+std::string HttpRemoconCore::GetTunerList()
+{
+	std::ostringstream tunerList;
+	EnumTunerChannels([&tunerList](const WCHAR* szDriver, const TVTest::ChannelInfo& ch, bool fCurrent) {
+		PrintChannel(tunerList, szDriver, ch);
+		if (fCurrent) tunerList << "\n";
+		});
+	return tunerList.str();
+}
+
+void HttpRemoconCore::WriteTunerList(StructuredWriter& w)
+{
+	auto writeChannel = [&w](const WCHAR* szDriver, const TVTest::ChannelInfo& ch) {
+		w.BeginObject();
+		w.Field("driver", WideCharToUTF8(szDriver));
+		w.Field("space", ch.Space);
+		w.Field("channel", ch.Channel);
+		w.Field("service_id", ch.ServiceID);
+		w.Field("name", WideCharToUTF8(ch.szChannelName));
+		w.EndObject();
+		};
+
+	w.BeginObject();
+	EnumTunerChannels([&w, &writeChannel](const WCHAR* szDriver, const TVTest::ChannelInfo& ch, bool fCurrent) {
+		if (fCurrent) {
+			w.Key("current");
+			writeChannel(szDriver, ch);
+			w.Key("channels");
+			w.BeginArray();
+		}
+		else {
+			writeChannel(szDriver, ch);
+		}
+		});
+	w.EndArray();
+	w.EndObject();
+}
+
+
+void HttpRemoconCore::SetChannel(const std::string& body, httplib::Response& res) {
+	RequestParser::ChannelSelect channel;
+	if (const char* error = RequestParser::ParseChannel(body, channel)) {
+		res.status = 400;
+		res.set_content(error, "text/plain");
+		return;
+	}
+
+	TVTest::ChannelSelectInfo info = {};
+	info.Size = sizeof(info);
+	info.pszTuner = nullptr;
+	info.Space = channel.Space;
+	info.Channel = channel.Channel;
+	info.ServiceID = static_cast<WORD>(channel.ServiceID);
+
+	std::wstring wTuner;
+	if (channel.TunerLength > 0) {
+		wTuner = convertUtf8ToWstring(std::string(channel.GetTuner()));
+		info.pszTuner = wTuner.c_str();
+	}
+
+	// チャンネル選択
+	const bool fSelected = CallApi(API_SELECT_CHANNEL, [&] { return m_app->SelectChannel(&info); });
+	m_zapTracer.Mark(ZapTracer::STAGE_SELECT_CHANNEL);
+	if (!fSelected) {
+		res.status = 500;
+		res.set_content("Failed SelectChannel", "text/plain");
+		return;
+	}
+
+	res.status = 200;
+}
+
+
+// 直近のザッピングについて、POST /ch (リモコンなどからのときは EVENT_CHANNELCHANGE) から各段階までの時間
+void HttpRemoconCore::WriteZapMetrics(StructuredWriter& w)
+{
+	auto traces = m_zapTracer.GetTraces();
+
+	w.BeginObject();
+	w.Field("count", traces.size());
+	w.Key("stages");
+	w.BeginObject();
+	for (int i = ZapTracer::STAGE_SELECT_CHANNEL; i < ZapTracer::STAGE_COUNT; i++) {
+		auto p = ZapTracer::Calculate(traces, static_cast<ZapTracer::Stage>(i));
+		w.Key(ZapTracer::StageNames[i]);
+		w.BeginObject();
+		w.Field("count", p.Count);
+		w.Field("p50_ms", p.P50Ms);
+		w.Field("p90_ms", p.P90Ms);
+		w.Field("p99_ms", p.P99Ms);
+		w.Field("max_ms", p.MaxMs);
+		w.EndObject();
+	}
+	w.EndObject();
+
+	w.Key("recent");
+	w.BeginArray();
+	for (const auto& trace : traces) {
+		w.BeginObject();
+		w.Field("id", trace.ID);
+		for (int i = 0; i < ZapTracer::STAGE_COUNT; i++) {
+			if (trace.ElapsedUs[i] == ZapTracer::NotReached) w.NullField(ZapTracer::StageNames[i]);
+			else w.Field(ZapTracer::StageNames[i], trace.ElapsedUs[i] / 1000.0);
+		}
+		w.EndObject();
+	}
+	w.EndArray();
+	w.EndObject();
+}
+
+
+// 信号の履歴。?resolution=1s|1m|10m (既定は 1s)、?from=&to= は UNIX 時間の秒
+void HttpRemoconCore::WriteSignalHistory(const httplib::Request& req, httplib::Response& res)
+{
+	int resolution = SignalHistory::FindResolution(req.has_param("resolution") ? req.get_param_value("resolution") : "1s");
+	if (resolution < 0) {
+		res.status = 400;
+		res.set_content("Invalid resolution", "text/plain");
+		return;
+	}
+	long long from = 0;
+	long long to = std::numeric_limits<long long>::max() / 1000;
+	if ((req.has_param("from") && !RequestParser::ParseSeconds(req.get_param_value("from"), from))
+		|| (req.has_param("to") && !RequestParser::ParseSeconds(req.get_param_value("to"), to))) {
+		res.status = 400;
+		res.set_content("Invalid parameter", "text/plain");
+		return;
+	}
+
+	auto buckets = m_signalHistory.Get(resolution, from * 1000, to * 1000);
+	auto writer = StructuredWriter::Create(req.get_header_value("Accept"));
+	auto& w = *writer;
+	w.BeginObject();
+	w.Field("resolution", SignalHistory::Resolutions[resolution].Name);
+	w.Field("interval_ms", SignalHistory::Resolutions[resolution].IntervalMs);
+	w.Key("samples");
+	w.BeginArray();
+	for (const auto& bucket : buckets) {
+		w.BeginObject();
+		w.Field("time_ms", bucket.TimeMs);
+		w.Field("count", bucket.Count);
+		for (int m = 0; m < SignalHistory::METRIC_COUNT; m++) {
+			w.Key(SignalHistory::MetricNames[m]);
+			w.BeginObject();
+			w.Field("min", bucket.Stats[m].Min);
+			w.Field("max", bucket.Stats[m].Max);
+			w.Field("avg", bucket.Average(static_cast<SignalHistory::Metric>(m)));
+			w.EndObject();
+		}
+		w.EndObject();
+	}
+	w.EndArray();
+	w.EndObject();
+
+	res.set_content(writer->Output(), writer->ContentType());
+	res.status = 200;
+}
@@ -0,0 +1,148 @@
+﻿#pragma once
+
+#include <cassert>
+#include <cstdio>
+#include <string>
+#include <memory>
+#include <functional>
+#include <optional>
+#include <filesystem>
+#include "httplib.h"
+#include "TVTestApp.cpp"
+#include "Config.cpp"
+#include "Router.cpp"
+#include "StaticAssets.cpp"
+#include "StructuredWriter.cpp"
+#include "EpgCache.cpp"
+#include "AribGenre.cpp"
+#include "Metrics.cpp"
+#include "Tracer.cpp"
+#include "SignalHistory.cpp"
+#include "ZapTrace.cpp"
+
+// HTTP サーバと、TVTest の API (ITVTestApp / ITvtPlay) だけを使うハンドラ
+// Win32 や LibISDB に依存しないので、プラグイン (dllmain.cpp) からも、FakeTVTestApp を使う tools/FakeServer.cpp からも動かせる。
+// 字幕やライブ配信など TS を受け取るルートはプラグインが Listen の addRoutes で足す
+class HttpRemoconCore {
+public:
+	// 所要時間を記録する TVTest API
+	enum TVTestApi {
+		API_SET_DRIVER_NAME,
+		API_SET_CHANNEL,
+		API_SELECT_CHANNEL,
+		API_DO_COMMAND,
+		API_GET_VOLUME,
+		API_SET_VOLUME,
+		API_GET_RECORD_STATUS,
+		API_STOP_RECORD,
+		API_SAVE_IMAGE,
+		API_GET_SETTING,
+		API_RESET,
+		API_GET_CURRENT_CHANNEL_INFO,
+		API_GET_STATUS,
+		API_GET_CURRENT_PROGRAM_INFO,
+		API_GET_EPG_EVENT_INFO,
+		API_GET_EPG_EVENT_LIST,
+		API_GET_DRIVER_NAME,
+		API_ENUM_DRIVER,
+		API_GET_DRIVER_TUNING_SPACE_LIST,
+		API_COUNT
+	};
+	static constexpr const char* ApiNames[API_COUNT] = {
+		"SetDriverName",
+		"SetChannel",
+		"SelectChannel",
+		"DoCommand",
+		"GetVolume",
+		"SetVolume",
+		"GetRecordStatus",
+		"StopRecord",
+		"SaveImage",
+		"GetSetting",
+		"Reset",
+		"GetCurrentChannelInfo",
+		"GetStatus",
+		"GetCurrentProgramInfo",
+		"GetEpgEventInfo",
+		"GetEpgEventList",
+		"GetDriverName",
+		"EnumDriver",
+		"GetDriverTuningSpaceList",
+	};
+
+	HttpRemoconCore(std::unique_ptr<ITVTestApp> app, std::unique_ptr<ITvtPlay> tvtPlay, const ServerConfig& config);
+	HttpRemoconCore(const HttpRemoconCore&) = delete;
+	HttpRemoconCore& operator=(const HttpRemoconCore&) = delete;
+
+	ITVTestApp& GetApp() { return *m_app; }
+	ZapTracer& GetZapTracer() { return m_zapTracer; }
+	EpgCache& GetEpgCache() { return m_epgCache; }
+	const ServerConfig& GetConfig() const { return m_config; }
+	bool IsRunning() const { return m_server.is_running(); }
+	// /status の tot を返すもの。TOT は TS から取るのでプラグインが設定する
+	void SetTotSource(std::function<std::string()> source) { m_totSource = std::move(source); }
+
+	template<class F>
+	auto CallApi(TVTestApi api, F&& call) {
+		Metrics::Timer timer(m_apiHistograms[api]);
+		HTTPREMOCON_TRACE_SCOPE(ApiNames[api]);
+		return call();
+	}
+
+	// クライアントの HTML を読み込んで圧縮しておき、信号の記録を始める
+	void Start(const std::filesystem::path& assetDirectory);
+	// ルートを登録して待ち受ける。Stop を呼ぶまで戻らない
+	// 止めてからもう一度呼んだときは登録し直す。addRoutes の中で Get / Post / Delete を呼んでルートを足す
+	bool Listen(const std::function<void()>& addRoutes);
+	// Listen から戻らせ、Start で始めたものを止める
+	void Stop();
+
+	void AddRoute(Router::Method method, const std::string& pattern, Router::Handler handler) {
+		// パターンの書き間違い ({} の閉じ忘れやパラメータの多すぎ) は登録されずに 404 になるだけなので、ここで気付けるようにする
+		if (!m_router.Add(method, pattern, Guard(pattern, std::move(handler)))) {
+#ifdef _WIN32
+			OutputDebugStringA(("HttpRemocon: invalid route pattern: " + pattern + "\n").c_str());
+#else
+			std::fprintf(stderr, "HttpRemocon: invalid route pattern: %s\n", pattern.c_str());
+#endif
+			assert(!"invalid route pattern");
+		}
+	}
+	void AddRoute(Router::Method method, const std::string& pattern, httplib::Server::Handler handler) {
+		AddRoute(method, pattern, [handler = std::move(handler)](const httplib::Request& req, httplib::Response& res, const Router::Params&) { handler(req, res); });
+	}
+	// パスの {name} を使うルートはハンドラで Router::Params を受け取る
+	template<class H> void Get(const std::string& pattern, H handler) { AddRoute(Router::METHOD_GET, pattern, std::move(handler)); }
+	template<class H> void Post(const std::string& pattern, H handler) { AddRoute(Router::METHOD_POST, pattern, std::move(handler)); }
+	template<class H> void Delete(const std::string& pattern, H handler) { AddRoute(Router::METHOD_DELETE, pattern, std::move(handler)); }
+
+private:
+	// ハンドラはこの 2 つを通して TVTest と TvtPlay を操作する ([Fake] Enabled で偽物に替わる)
+	std::unique_ptr<ITVTestApp> m_app;
+	std::unique_ptr<ITvtPlay> m_tvtPlay;
+	ServerConfig m_config;
+	httplib::Server m_server;
+	RouteLimiter m_limiter;
+	Router m_router;
+	StaticAssets m_assets;
+	EpgCache m_epgCache;
+	ZapTracer m_zapTracer;
+	SignalHistory m_signalHistory;
+	std::function<std::string()> m_totSource;
+	int m_apiHistograms[API_COUNT] = {};
+
+	void AddCoreRoutes();
+	Router::Handler Guard(const std::string& route, Router::Handler handler);
+	void CompressResponse(const httplib::Request& req, httplib::Response& res);
+	void Dispatch(const httplib::Request& req, httplib::Response& res);
+	void EnumTunerChannels(const std::function<void(const WCHAR* szDriver, const TVTest::ChannelInfo& ch, bool fCurrent)>& callback);
+	std::string GetTunerList();
+	void WriteTunerList(StructuredWriter& w);
+	void WriteStatus(StructuredWriter& w, bool fText, AribGenre::Language lang);
+	void WriteProgram(StructuredWriter& w, const char* prefix, bool fNext, bool fText, AribGenre::Language lang, const TVTest::ChannelInfo* pChannel);
+	std::optional<EpgCache::Summary> GetEventSummary(const EpgCache::Key& key);
+	void StreamEpg(const httplib::Request& req, httplib::Response& res);
+	void SetChannel(const std::string& body, httplib::Response& res);
+	void WriteZapMetrics(StructuredWriter& w);
+	void WriteSignalHistory(const httplib::Request& req, httplib::Response& res);
+};
@@ -0,0 +1,124 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include "Metrics.cpp"
+#include "ServiceRemux.cpp"
+
+// StreamCallback の TS パケットを HTTP のクライアントに配る
+// パケットはチャンク単位で 1 回だけ書き込み、共有のリングに置く。クライアントは自分のカーソルで
+// 同じチャンクを参照するだけなのでクライアントごとのコピーはない。
+// 遅れたクライアントは最新まで飛ばすので、リングは大きくならない
+class LiveStream {
+public:
+	static constexpr size_t PacketSize = 188;
+	static constexpr size_t PacketsPerChunk = 348;  // 64KB 弱
+	static constexpr size_t Capacity = 256;         // 20Mbps で 6 秒ほど
+	// ビットレートが低くてもこれ以上はためない
+	static constexpr std::chrono::milliseconds FlushInterval = std::chrono::milliseconds(100);
+
+	using Chunk = std::vector<uint8_t>;
+
+	// クライアントごとの読み出し位置。生きている間だけ StreamCallback がチャンクを作る
+	class Subscriber {
+		LiveStream& m_stream;
+		uint64_t m_cursor;
+		std::vector<std::shared_ptr<const Chunk>> m_chunks;
+
+	public:
+		explicit Subscriber(LiveStream& stream) : m_stream(stream) {
+			std::lock_guard<std::mutex> lock(m_stream.m_mutex);
+			// 最新のチャンクから始めて、最初の表示を早くする
+			m_cursor = m_stream.m_head > 0 ? m_stream.m_head - 1 : 0;
+			m_stream.m_subscribers++;
+		}
+		~Subscriber() { m_stream.m_subscribers--; }
+		Subscriber(const Subscriber&) = delete;
+		Subscriber& operator=(const Subscriber&) = delete;
+
+		// 新しいチャンクを待って返す。timeout までに来なければ空、閉じられたら nullptr
+		const std::vector<std::shared_ptr<const Chunk>>* Read(std::chrono::milliseconds timeout) {
+			m_chunks.clear();
+			std::unique_lock<std::mutex> lock(m_stream.m_mutex);
+			m_stream.m_cv.wait_for(lock, timeout, [this] { return !m_stream.m_fOpen || m_stream.m_head > m_cursor; });
+			if (!m_stream.m_fOpen) return nullptr;
+			if (m_stream.m_head - m_cursor > Capacity) {
+				Metrics::Add(Metrics::COUNTER_LIVE_SKIPPED_CHUNKS, m_stream.m_head - 1 - m_cursor);
+				m_cursor = m_stream.m_head - 1;
+			}
+			for (; m_cursor < m_stream.m_head; m_cursor++) {
+				m_chunks.push_back(m_stream.m_ring[m_cursor % Capacity]);
+			}
+			return &m_chunks;
+		}
+	};
+
+private:
+	std::shared_ptr<const Chunk> m_ring[Capacity];
+	uint64_t m_head = 0;  // これまでに置いたチャンクの数
+	bool m_fOpen = false;
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	std::atomic<int> m_subscribers = 0;
+	std::atomic<std::shared_ptr<const ServiceMap>> m_services;
+
+	// 書き込み中のチャンク。触るのは StreamCallback のスレッドだけ
+	std::shared_ptr<Chunk> m_current;
+	std::chrono::steady_clock::time_point m_currentStart;
+
+public:
+	void Open() {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_fOpen = true;
+	}
+
+	// 待っているクライアントをすべて終わらせる
+	void Close() {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_fOpen = false;
+		}
+		m_cv.notify_all();
+	}
+
+	// ?sid= で 1 つのサービスに絞るときに使う。チャンネル変更後は PMT を取得するまで nullptr
+	void SetServiceMap(std::shared_ptr<const ServiceMap> services) { m_services.store(std::move(services)); }
+	std::shared_ptr<const ServiceMap> GetServiceMap() const { return m_services.load(); }
+
+	// StreamCallback から 1 パケットずつ呼ぶ
+	void Write(const uint8_t* pPacket) {
+		if (m_subscribers.load(std::memory_order_relaxed) == 0) {
+			m_current.reset();
+			return;
+		}
+		if (!m_current) {
+			m_current = std::make_shared<Chunk>();
+			m_current->reserve(PacketSize * PacketsPerChunk);
+			m_currentStart = std::chrono::steady_clock::now();
+		}
+		m_current->insert(m_current->end(), pPacket, pPacket + PacketSize);
+
+		// 時刻を見るのは 16 パケットごと
+		const size_t packets = m_current->size() / PacketSize;
+		if (packets >= PacketsPerChunk
+				|| (packets % 16 == 0 && std::chrono::steady_clock::now() - m_currentStart >= FlushInterval)) {
+			Publish();
+		}
+	}
+
+private:
+	void Publish() {
+		std::shared_ptr<const Chunk> chunk = std::move(m_current);
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_ring[m_head % Capacity] = std::move(chunk);
+			m_head++;
+		}
+		m_cv.notify_all();
+	}
+};
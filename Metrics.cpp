@@ -0,0 +1,200 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <iterator>
+#include <algorithm>
+#include <numeric>
+
+// Prometheus 形式で出すカウンタとヒストグラム
+// スレッドごとにキャッシュライン境界にそろえた領域 (Shard) を持ち、書き込むのはそのスレッドだけにする。
+// 加算はロックも RMW 命令も使わず、合計はスクレイプ時にだけ取る
+class Metrics {
+public:
+	enum Counter {
+		COUNTER_STREAM_PACKETS,        // StreamCallback に来たパケット
+		COUNTER_STREAM_BYTES,          // ByteStream に書いたバイト数
+		COUNTER_STREAM_DROPPED_BYTES,  // ByteStream があふれて捨てたバイト数
+		COUNTER_CAPTIONS,              // 確定した字幕
+		COUNTER_RESPONSE_BYTES,        // レスポンスの本文 (ストリーミングのものは含まない)
+		COUNTER_LIVE_BYTES,            // /live.ts で送ったバイト数
+		COUNTER_LIVE_SKIPPED_CHUNKS,   // /live.ts で遅れたクライアントが飛ばしたチャンク
+		COUNTER_COUNT
+	};
+
+	static constexpr size_t MaxHistograms = 128;
+	// 秒
+	static constexpr double BucketBounds[] = { 0.0005, 0.001, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10 };
+	static constexpr size_t BucketCount = std::size(BucketBounds) + 1;  // 最後は +Inf
+
+	// スコープを抜けるまでの時間をヒストグラムに記録する
+	class Timer {
+		int m_id;
+		std::chrono::steady_clock::time_point m_start;
+	public:
+		explicit Timer(int id) : m_id(id), m_start(std::chrono::steady_clock::now()) {}
+		Timer(const Timer&) = delete;
+		Timer& operator=(const Timer&) = delete;
+		~Timer() { Observe(m_id, std::chrono::steady_clock::now() - m_start); }
+	};
+
+private:
+	struct CounterInfo {
+		const char* Name;
+		const char* Help;
+	};
+	static constexpr CounterInfo Counters[COUNTER_COUNT] = {
+		{ "httpremocon_stream_packets_total", "TS packets received by the stream callback" },
+		{ "httpremocon_stream_bytes_total", "Bytes written to the caption ByteStream" },
+		{ "httpremocon_stream_dropped_bytes_total", "Bytes dropped because the caption ByteStream was full" },
+		{ "httpremocon_captions_total", "Captions emitted" },
+		{ "httpremocon_response_bytes_total", "HTTP response body bytes (excluding streamed responses)" },
+		{ "httpremocon_live_bytes_total", "Bytes sent to /live.ts clients" },
+		{ "httpremocon_live_skipped_chunks_total", "Chunks skipped by /live.ts clients that fell behind" },
+	};
+
+	struct Histogram {
+		std::atomic<uint64_t> Buckets[BucketCount] = {};
+		std::atomic<uint64_t> Count = 0;
+		std::atomic<uint64_t> SumNs = 0;
+	};
+
+	struct alignas(64) Shard {
+		std::atomic<uint64_t> Counters[COUNTER_COUNT] = {};
+		Histogram Histograms[MaxHistograms];
+	};
+
+	struct HistogramInfo {
+		std::string Name;
+		std::string Help;
+		std::string Label;  // name="value"
+	};
+
+	struct Registry {
+		std::mutex Mutex;
+		std::vector<std::unique_ptr<Shard>> Shards;  // スレッドが終わっても値を残すため解放しない
+		std::vector<HistogramInfo> Histograms;
+	};
+
+	static Registry& GetRegistry() {
+		static Registry registry;
+		return registry;
+	}
+
+	// スレッドごとに一度だけロックを取って登録する
+	static Shard& LocalShard() {
+		thread_local Shard* pShard = nullptr;
+		if (!pShard) {
+			auto& registry = GetRegistry();
+			std::lock_guard<std::mutex> lock(registry.Mutex);
+			registry.Shards.push_back(std::make_unique<Shard>());
+			pShard = registry.Shards.back().get();
+		}
+		return *pShard;
+	}
+
+	// 書き込むのは持ち主のスレッドだけなので、load + store で足りる
+	static void Increment(std::atomic<uint64_t>& cell, uint64_t n) {
+		cell.store(cell.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+	}
+
+public:
+	static void Add(Counter counter, uint64_t n = 1) {
+		Increment(LocalShard().Counters[counter], n);
+	}
+
+	// 起動時に登録しておく。登録できなければ -1 (Observe は何もしない)
+	static int RegisterHistogram(const std::string& name, const std::string& help, const std::string& labelName, const std::string& labelValue) {
+		auto& registry = GetRegistry();
+		std::lock_guard<std::mutex> lock(registry.Mutex);
+		std::string label = labelName + "=\"" + EscapeLabel(labelValue) + "\"";
+		for (size_t i = 0; i < registry.Histograms.size(); i++) {
+			if (registry.Histograms[i].Name == name && registry.Histograms[i].Label == label) return static_cast<int>(i);
+		}
+		if (registry.Histograms.size() >= MaxHistograms) return -1;
+		registry.Histograms.push_back({ name, help, std::move(label) });
+		return static_cast<int>(registry.Histograms.size() - 1);
+	}
+
+	static void Observe(int id, std::chrono::nanoseconds duration) {
+		if (id < 0) return;
+		auto& histogram = LocalShard().Histograms[id];
+		const double seconds = std::chrono::duration<double>(duration).count();
+		size_t bucket = 0;
+		while (bucket < std::size(BucketBounds) && seconds > BucketBounds[bucket]) bucket++;
+		Increment(histogram.Buckets[bucket], 1);
+		Increment(histogram.Count, 1);
+		Increment(histogram.SumNs, static_cast<uint64_t>(duration.count()));
+	}
+
+	// 全スレッドの値を合計して Prometheus のテキスト形式にする
+	static std::string Scrape() {
+		auto& registry = GetRegistry();
+		std::lock_guard<std::mutex> lock(registry.Mutex);
+		std::string out;
+		char buffer[64];
+
+		for (size_t c = 0; c < COUNTER_COUNT; c++) {
+			uint64_t total = 0;
+			for (const auto& shard : registry.Shards) total += shard->Counters[c].load(std::memory_order_relaxed);
+			out += std::string("# HELP ") + Counters[c].Name + " " + Counters[c].Help + "\n";
+			out += std::string("# TYPE ") + Counters[c].Name + " counter\n";
+			out += std::string(Counters[c].Name) + " " + std::to_string(total) + "\n";
+		}
+
+		// 同じ名前のものはまとめて出す
+		std::vector<size_t> order(registry.Histograms.size());
+		std::iota(order.begin(), order.end(), 0);
+		std::stable_sort(order.begin(), order.end(), [&registry](size_t a, size_t b) {
+			return registry.Histograms[a].Name < registry.Histograms[b].Name;
+			});
+		std::string lastName;
+		for (size_t h : order) {
+			const auto& info = registry.Histograms[h];
+			if (info.Name != lastName) {
+				out += "# HELP " + info.Name + " " + info.Help + "\n";
+				out += "# TYPE " + info.Name + " histogram\n";
+				lastName = info.Name;
+			}
+			uint64_t buckets[BucketCount] = {};
+			uint64_t count = 0, sumNs = 0;
+			for (const auto& shard : registry.Shards) {
+				const auto& histogram = shard->Histograms[h];
+				for (size_t b = 0; b < BucketCount; b++) buckets[b] += histogram.Buckets[b].load(std::memory_order_relaxed);
+				count += histogram.Count.load(std::memory_order_relaxed);
+				sumNs += histogram.SumNs.load(std::memory_order_relaxed);
+			}
+			uint64_t cumulative = 0;
+			for (size_t b = 0; b < BucketCount; b++) {
+				cumulative += buckets[b];
+				if (b < std::size(BucketBounds)) snprintf(buffer, sizeof(buffer), "%g", BucketBounds[b]);
+				else snprintf(buffer, sizeof(buffer), "+Inf");
+				out += info.Name + "_bucket{" + info.Label + ",le=\"" + buffer + "\"} " + std::to_string(cumulative) + "\n";
+			}
+			snprintf(buffer, sizeof(buffer), "%.9f", sumNs / 1e9);
+			out += info.Name + "_sum{" + info.Label + "} " + buffer + "\n";
+			out += info.Name + "_count{" + info.Label + "} " + std::to_string(count) + "\n";
+		}
+		return out;
+	}
+
+private:
+	static std::string EscapeLabel(const std::string& value) {
+		std::string out;
+		for (char c : value) {
+			if (c == '\\' || c == '"') out += '\\';
+			if (c == '\n') {
+				out += "\\n";
+				continue;
+			}
+			out += c;
+		}
+		return out;
+	}
+};
@@ -0,0 +1,390 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <charconv>
+#include <system_error>
+#include <algorithm>
+#include <limits>
+
+// POST の本文を読む
+// 本文はこれまでのテキストのほか、JSON のオブジェクト ({"volume": 50}) と
+// フォームの形 (volume=50) でも受け付ける。curl -d は Content-Type をいつもフォームにするので、形は中身で見分ける。
+// フォームの値の + はブラウザ (URLSearchParams) と同じく空白にする。符号の + は %2B と書く
+// 失敗しても例外は投げず、レスポンスにそのまま使える静的なメッセージを返す (成功したときは nullptr)
+class RequestParser {
+public:
+	enum Format {
+		FORMAT_TEXT,
+		FORMAT_JSON,
+		FORMAT_FORM
+	};
+
+	// POST /vol
+	struct Volume {
+		int Value = 0;
+		bool fRelative = false;  // +/- が付いていれば今の音量からの差
+	};
+
+	// POST /play/pos
+	struct Seek {
+		int Msec = 0;
+		bool fRelative = false;  // +/- が付いているか、: のない秒数
+	};
+
+	// POST /ch
+	struct ChannelSelect {
+		static constexpr size_t MaxTunerLength = 260;
+		char Tuner[MaxTunerLength] = {};  // UTF-8。空なら今のチューナー
+		size_t TunerLength = 0;
+		int Space = -1;
+		int Channel = -1;
+		int ServiceID = 0;
+
+		std::string_view GetTuner() const { return std::string_view(Tuner, TunerLength); }
+	};
+
+	// POST /view/reset
+	struct Reset {
+		uint32_t Flags = 0;  // TVTest::ResetFlag
+	};
+
+	static Format DetectFormat(std::string_view body) {
+		body = Trim(body);
+		if (!body.empty() && body.front() == '{') return FORMAT_JSON;
+		if (body.find('=') != std::string_view::npos) return FORMAT_FORM;
+		return FORMAT_TEXT;
+	}
+
+	// "50" (絶対値)、"+5" / "-5" (相対値)
+	// {"volume": 50} / {"delta": -5}、volume=50 / delta=-5
+	static const char* ParseVolume(std::string_view body, Volume& volume) {
+		const Format format = DetectFormat(body);
+		char buffer[32];  // エスケープを戻したものを置く
+		if (format != FORMAT_TEXT) {
+			Value value;
+			if (const char* error = Find(format, body, "delta", value)) return error;
+			if (value.Type != VALUE_NONE) {
+				volume.fRelative = true;
+				return value.ToInt(volume.Value) ? nullptr : "Invalid delta value";
+			}
+			if (const char* error = Find(format, body, "volume", value)) return error;
+			if (value.Type == VALUE_NONE) return "Missing volume";
+			if (!value.GetText(buffer, sizeof(buffer), body)) return "Invalid volume value";
+		}
+		body = Trim(body);
+		if (body.empty()) return "Missing volume";
+		volume.fRelative = body.front() == '+' || body.front() == '-';
+		return ParseInt(body, volume.Value) ? nullptr : "Invalid volume value";
+	}
+
+	// "[+-]秒"、"[+-]分:秒"、"[+-]時:分:秒"。秒には小数も書ける
+	// 符号がなくて : を含むものは先頭からの位置、それ以外は今の位置からの差
+	// {"pos": "1:00:00"}、pos=-10
+	static const char* ParseSeek(std::string_view body, Seek& seek) {
+		const Format format = DetectFormat(body);
+		char buffer[32];  // エスケープを戻したものを置く
+		if (format != FORMAT_TEXT) {
+			Value value;
+			if (const char* error = Find(format, body, "pos", value)) return error;
+			if (value.Type == VALUE_NONE) return "Missing pos";
+			if (!value.GetText(buffer, sizeof(buffer), body)) return "Invalid time format";
+		}
+		body = Trim(body);
+		if (body.empty()) return "Missing position";
+		const bool fSign = body.front() == '+' || body.front() == '-';
+		const bool fNegative = body.front() == '-';
+		if (fSign) body.remove_prefix(1);
+		seek.fRelative = fSign || body.find(':') == std::string_view::npos;
+
+		// 最後の : より前は整数、最後だけ小数を許す
+		int64_t msec = 0;
+		size_t fields = 0;
+		while (true) {
+			const size_t colon = body.find(':');
+			if (colon == std::string_view::npos) break;
+			int value = 0;
+			if (++fields > 2 || !ParseDigits(body.substr(0, colon), value)) return "Invalid time format";
+			msec = (msec + value) * 60;
+			body.remove_prefix(colon + 1);
+		}
+		int seconds = 0, fraction = 0;
+		const size_t dot = body.find('.');
+		if (!ParseDigits(body.substr(0, dot), seconds)) return "Invalid time format";
+		if (dot != std::string_view::npos) {
+			// ミリ秒までを見る
+			auto digits = body.substr(dot + 1);
+			if (digits.empty() || !std::all_of(digits.begin(), digits.end(), IsDigit)) return "Invalid time format";
+			for (size_t i = 0; i < 3; i++) fraction = fraction * 10 + (i < digits.size() ? digits[i] - '0' : 0);
+		}
+		msec = (msec + seconds) * 1000 + fraction;
+		if (msec > INT32_MAX) return "Time out of range";
+		seek.Msec = static_cast<int>(fNegative ? -msec : msec);
+		return nullptr;
+	}
+
+	// "チューナー,空間,チャンネル,サービスID"。空のところは指定しない
+	// {"tuner": "BonDriver_xxx.dll", "space": 0, "channel": 13, "service_id": 1024}、tuner=...&channel=13
+	static const char* ParseChannel(std::string_view body, ChannelSelect& channel) {
+		const Format format = DetectFormat(body);
+		if (format == FORMAT_TEXT) {
+			std::string_view fields[4];
+			for (size_t i = 0; i < 3; i++) {
+				const size_t comma = body.find(',');
+				if (comma == std::string_view::npos) return "Invalid request format";
+				fields[i] = body.substr(0, comma);
+				body.remove_prefix(comma + 1);
+			}
+			fields[3] = body.substr(0, body.find('\n'));
+			if (fields[0].size() >= ChannelSelect::MaxTunerLength) return "Tuner name too long";
+			std::memcpy(channel.Tuner, fields[0].data(), fields[0].size());
+			channel.TunerLength = fields[0].size();
+			if (!fields[1].empty() && !ParseInt(Trim(fields[1]), channel.Space)) return "Invalid Space value";
+			if (!fields[2].empty() && !ParseInt(Trim(fields[2]), channel.Channel)) return "Invalid Channel value";
+			if (!fields[3].empty() && !ParseInt(Trim(fields[3]), channel.ServiceID)) return "Invalid ServiceID value";
+			return nullptr;
+		}
+
+		Value value;
+		if (const char* error = Find(format, body, "tuner", value)) return error;
+		if (value.Type != VALUE_NONE && value.Type != VALUE_NULL) {
+			if (!value.Decode(channel.Tuner, ChannelSelect::MaxTunerLength - 1, channel.TunerLength)) return "Invalid tuner value";
+		}
+		const struct {
+			std::string_view Key;
+			int& Target;
+			const char* Error;
+		} numbers[] = {
+			{ "space", channel.Space, "Invalid Space value" },
+			{ "channel", channel.Channel, "Invalid Channel value" },
+			{ "service_id", channel.ServiceID, "Invalid ServiceID value" },
+		};
+		for (const auto& number : numbers) {
+			if (const char* error = Find(format, body, number.Key, value)) return error;
+			if (value.Type != VALUE_NONE && value.Type != VALUE_NULL && !value.ToInt(number.Target)) return number.Error;
+		}
+		return nullptr;
+	}
+
+	// "1" / "viewer"、{"flags": 0}、flags=all
+	static const char* ParseReset(std::string_view body, Reset& reset) {
+		const Format format = DetectFormat(body);
+		char buffer[32];  // エスケープを戻したものを置く
+		if (format != FORMAT_TEXT) {
+			Value value;
+			if (const char* error = Find(format, body, "flags", value)) return error;
+			if (value.Type == VALUE_NONE) return "Missing flags";
+			if (!value.GetText(buffer, sizeof(buffer), body)) return "Invalid reset flags";
+		}
+		body = Trim(body);
+		if (body == "all") reset.Flags = 0;
+		else if (body == "viewer") reset.Flags = 1;
+		else if (!ParseInt(body, reset.Flags)) return "Invalid reset flags";
+		return nullptr;
+	}
+
+	// 整数を全部読めたときだけ成功する。先頭の + も許す
+	template<class T>
+	static bool ParseInt(std::string_view s, T& value) {
+		if (!s.empty() && s.front() == '+') s.remove_prefix(1);
+		if (s.empty() || s.front() == '+') return false;
+		T parsed;
+		auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), parsed);
+		if (ec != std::errc() || ptr != s.data() + s.size()) return false;
+		value = parsed;
+		return true;
+	}
+
+	// 秒の整数。ミリ秒にしてもあふれない範囲だけ受け付ける
+	static bool ParseSeconds(std::string_view s, long long& seconds) {
+		constexpr long long limit = std::numeric_limits<long long>::max() / 1000;
+		long long parsed;
+		if (!ParseInt(s, parsed) || parsed < -limit || parsed > limit) return false;
+		seconds = parsed;
+		return true;
+	}
+
+	// GET /live.ts の ?at=。負の値は最新からの秒数で、後ろに s を付けてもよい ("-300s")。正の値は UNIX 時間
+	static bool ParseTimeShiftAt(std::string_view s, long long& seconds) {
+		if (s.size() > 1 && s.front() == '-' && s.back() == 's') s.remove_suffix(1);
+		return ParseSeconds(s, seconds);
+	}
+
+	static std::string_view Trim(std::string_view s) {
+		while (!s.empty() && IsSpace(s.front())) s.remove_prefix(1);
+		while (!s.empty() && IsSpace(s.back())) s.remove_suffix(1);
+		return s;
+	}
+
+private:
+	enum ValueType {
+		VALUE_NONE,    // キーがない
+		VALUE_NULL,
+		VALUE_NUMBER,  // true/false もここに入れる
+		VALUE_STRING,
+		VALUE_FORM     // フォームの値 (%XX と + のまま)
+	};
+
+	// 本文の中を指す。文字列はエスケープを残したまま持ち、必要なときだけ Decode する
+	struct Value {
+		ValueType Type = VALUE_NONE;
+		std::string_view Text;
+		bool fEscaped = false;
+
+		// 数値 (JSON の文字列に入っているものも) を整数にする
+		bool ToInt(int& value) const {
+			char buffer[32];
+			std::string_view text;
+			return GetText(buffer, sizeof(buffer), text) && ParseInt(Trim(text), value);
+		}
+
+		// エスケープがなければ本文の中をそのまま、あれば buffer に戻したものを指す
+		bool GetText(char* buffer, size_t capacity, std::string_view& text) const {
+			if (Type == VALUE_FORM ? Text.find_first_of("%+") == std::string_view::npos : !fEscaped) {
+				text = Text;
+				return true;
+			}
+			size_t length;
+			if (!Decode(buffer, capacity, length)) return false;
+			text = std::string_view(buffer, length);
+			return true;
+		}
+
+		// エスケープを戻して buffer に書く
+		bool Decode(char* buffer, size_t capacity, size_t& length) const {
+			length = 0;
+			for (size_t i = 0; i < Text.size(); i++) {
+				char c = Text[i];
+				if (Type == VALUE_FORM && c == '%') {
+					int high, low;
+					if (i + 2 >= Text.size()) return false;
+					if ((high = HexValue(Text[i + 1])) < 0 || (low = HexValue(Text[i + 2])) < 0) return false;
+					c = static_cast<char>(high << 4 | low);
+					i += 2;
+				}
+				else if (Type == VALUE_FORM && c == '+') {
+					c = ' ';
+				}
+				else if (Type == VALUE_STRING && c == '\\') {
+					if (++i >= Text.size()) return false;
+					switch (Text[i]) {
+					case '"': case '\\': case '/': c = Text[i]; break;
+					case 'b': c = '\b'; break;
+					case 'f': c = '\f'; break;
+					case 'n': c = '\n'; break;
+					case 'r': c = '\r'; break;
+					case 't': c = '\t'; break;
+					default: return false;  // \u はチューナー名などには出てこないので扱わない
+					}
+				}
+				if (length >= capacity) return false;
+				buffer[length++] = c;
+			}
+			return true;
+		}
+	};
+
+	static bool IsSpace(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+	static bool IsDigit(char c) { return '0' <= c && c <= '9'; }
+	static int HexValue(char c) {
+		if ('0' <= c && c <= '9') return c - '0';
+		if ('a' <= c && c <= 'f') return c - 'a' + 10;
+		if ('A' <= c && c <= 'F') return c - 'A' + 10;
+		return -1;
+	}
+
+	// 符号なしの 10 進数
+	static bool ParseDigits(std::string_view s, int& value) {
+		return !s.empty() && IsDigit(s.front()) && ParseInt(s, value);
+	}
+
+	static const char* Find(Format format, std::string_view body, std::string_view key, Value& value) {
+		value = Value();
+		return format == FORMAT_JSON ? FindJson(body, key, value) : FindForm(body, key, value);
+	}
+
+	// a=1&b=2 の形。同じキーがあれば最初のもの
+	static const char* FindForm(std::string_view body, std::string_view key, Value& value) {
+		body = Trim(body);
+		while (!body.empty()) {
+			const size_t amp = body.find('&');
+			const auto pair = body.substr(0, amp);
+			const size_t eq = pair.find('=');
+			if (pair.substr(0, eq) == key) {
+				value.Type = VALUE_FORM;
+				value.Text = eq == std::string_view::npos ? std::string_view() : pair.substr(eq + 1);
+				return nullptr;
+			}
+			if (amp == std::string_view::npos) break;
+			body.remove_prefix(amp + 1);
+		}
+		return nullptr;
+	}
+
+	// 入れ子のない JSON のオブジェクト。値が入れ子になっているキーは読み飛ばせないのでエラーにする
+	static const char* FindJson(std::string_view body, std::string_view key, Value& value) {
+		size_t pos = 0;
+		auto skipSpace = [&] {
+			while (pos < body.size() && IsSpace(body[pos])) pos++;
+		};
+		// " の次から閉じる " の前までを読む
+		auto readString = [&](std::string_view& s, bool& fEscaped) {
+			const size_t start = ++pos;
+			fEscaped = false;
+			for (; pos < body.size(); pos++) {
+				if (body[pos] == '\\') {
+					fEscaped = true;
+					pos++;
+				}
+				else if (body[pos] == '"') {
+					s = body.substr(start, pos - start);
+					pos++;
+					return true;
+				}
+			}
+			return false;
+		};
+
+		skipSpace();
+		if (pos >= body.size() || body[pos] != '{') return "Invalid JSON";
+		pos++;
+		skipSpace();
+		if (pos < body.size() && body[pos] == '}') return nullptr;
+		while (pos < body.size()) {
+			std::string_view name;
+			bool fNameEscaped;
+			if (body[pos] != '"' || !readString(name, fNameEscaped)) return "Invalid JSON";
+			skipSpace();
+			if (pos >= body.size() || body[pos] != ':') return "Invalid JSON";
+			pos++;
+			skipSpace();
+			if (pos >= body.size()) return "Invalid JSON";
+
+			Value v;
+			if (body[pos] == '"') {
+				v.Type = VALUE_STRING;
+				if (!readString(v.Text, v.fEscaped)) return "Invalid JSON";
+			}
+			else if (body[pos] == '{' || body[pos] == '[') {
+				return "Nested JSON is not supported";
+			}
+			else {
+				const size_t start = pos;
+				while (pos < body.size() && body[pos] != ',' && body[pos] != '}' && !IsSpace(body[pos])) pos++;
+				v.Text = body.substr(start, pos - start);
+				if (v.Text.empty()) return "Invalid JSON";
+				v.Type = v.Text == "null" ? VALUE_NULL : VALUE_NUMBER;
+			}
+			if (value.Type == VALUE_NONE && !fNameEscaped && name == key) value = v;
+
+			skipSpace();
+			if (pos >= body.size()) return "Invalid JSON";
+			if (body[pos] == '}') return nullptr;
+			if (body[pos] != ',') return "Invalid JSON";
+			pos++;
+			skipSpace();
+		}
+		return "Invalid JSON";
+	}
+};
@@ -0,0 +1,176 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <memory>
+#include <functional>
+#include <algorithm>
+#include "httplib.h"
+
+// (メソッド, パス) からハンドラを引く
+// httplib はルートごとの正規表現を登録順に全部試すので、ルートが増えるほど後ろのものが遅くなる。
+// ここではパスを / で区切った木にしておき、区切りごとに 1 回引くだけで決める。
+// パスの {name} はそこの 1 区切りに当たり、後ろに固定の文字を続けられる (/live/{seq}.ts)
+// 木を作るのはサーバを起動する前だけで、起動してからはロックなしで読む
+class Router {
+public:
+	enum Method {
+		METHOD_GET,
+		METHOD_POST,
+		METHOD_DELETE,
+		METHOD_COUNT
+	};
+	static constexpr std::string_view MethodNames[METHOD_COUNT] = { "GET", "POST", "DELETE" };
+
+	static constexpr size_t MaxParams = 4;
+
+	// {name} に当たった部分。req.path の中を指すので、ハンドラの中でだけ使う
+	struct Params {
+		std::string_view Values[MaxParams];
+		size_t Count = 0;
+
+		std::string_view operator[](size_t i) const { return i < Count ? Values[i] : std::string_view(); }
+	};
+
+	using Handler = std::function<void(const httplib::Request&, httplib::Response&, const Params&)>;
+
+	struct Route {
+		Router::Method Method;
+		std::string Pattern;
+	};
+
+private:
+	struct Node {
+		struct ParamChild {
+			std::string Suffix;  // {name} の後ろの固定の文字
+			std::unique_ptr<Node> Child;
+		};
+
+		std::map<std::string, std::unique_ptr<Node>, std::less<>> Literals;
+		std::vector<ParamChild> ParamChildren;
+		Handler Handlers[METHOD_COUNT];
+
+		unsigned GetMethods() const {
+			unsigned methods = 0;
+			for (int i = 0; i < METHOD_COUNT; i++) {
+				if (Handlers[i]) methods |= 1u << i;
+			}
+			return methods;
+		}
+	};
+
+	Node m_root;
+	std::vector<Route> m_routes;  // 登録順
+
+public:
+	static bool ParseMethod(std::string_view name, Method& method) {
+		// HEAD は GET のハンドラで返す (本文は httplib が落とす)
+		if (name == "HEAD") name = "GET";
+		for (int i = 0; i < METHOD_COUNT; i++) {
+			if (MethodNames[i] == name) {
+				method = static_cast<Method>(i);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// "GET, POST" の形
+	static std::string FormatMethods(unsigned methods) {
+		std::string s;
+		for (int i = 0; i < METHOD_COUNT; i++) {
+			if (!(methods & (1u << i))) continue;
+			if (!s.empty()) s += ", ";
+			s += MethodNames[i];
+		}
+		return s;
+	}
+
+	// 同じメソッドとパスをもう一度登録すると置き換える。pattern が正しくなければ false
+	bool Add(Method method, const std::string& pattern, Handler handler) {
+		if (pattern.empty() || pattern.front() != '/') return false;
+		Node* node = &m_root;
+		size_t params = 0;
+		std::string_view rest = std::string_view(pattern).substr(1);
+		while (true) {
+			const size_t slash = rest.find('/');
+			const std::string_view segment = rest.substr(0, slash);
+			if (!segment.empty() && segment.front() == '{') {
+				const size_t close = segment.find('}');
+				if (close == std::string_view::npos || close == 1 || ++params > MaxParams) return false;
+				const std::string_view suffix = segment.substr(close + 1);
+				auto it = std::find_if(node->ParamChildren.begin(), node->ParamChildren.end(),
+					[&](const Node::ParamChild& param) { return param.Suffix == suffix; });
+				if (it == node->ParamChildren.end()) {
+					node->ParamChildren.push_back({ std::string(suffix), std::make_unique<Node>() });
+					it = node->ParamChildren.end() - 1;
+				}
+				node = it->Child.get();
+			}
+			else {
+				auto it = node->Literals.find(segment);
+				if (it == node->Literals.end()) {
+					it = node->Literals.emplace(std::string(segment), std::make_unique<Node>()).first;
+				}
+				node = it->second.get();
+			}
+			if (slash == std::string_view::npos) break;
+			rest.remove_prefix(slash + 1);
+		}
+
+		if (!node->Handlers[method]) m_routes.push_back({ method, pattern });
+		node->Handlers[method] = std::move(handler);
+		return true;
+	}
+
+	// パスに当たるハンドラ。パスはあるがメソッドがないときは nullptr を返し、methods に使えるメソッドを入れる
+	const Handler* Find(Method method, std::string_view path, Params& params, unsigned& methods) const {
+		params.Count = 0;
+		methods = 0;
+		if (path.empty() || path.front() != '/') return nullptr;
+		const Node* node = Match(m_root, path.substr(1), params);
+		if (!node) return nullptr;
+		methods = node->GetMethods();
+		return node->Handlers[method] ? &node->Handlers[method] : nullptr;
+	}
+
+	// パスで使えるメソッド。パスがなければ 0
+	unsigned GetMethods(std::string_view path) const {
+		Params params;
+		const Node* node = path.empty() || path.front() != '/' ? nullptr : Match(m_root, path.substr(1), params);
+		return node ? node->GetMethods() : 0;
+	}
+
+	const std::vector<Route>& GetRoutes() const { return m_routes; }
+
+	void Clear() {
+		m_root = Node();
+		m_routes.clear();
+	}
+
+private:
+	// path は / の次から。固定の区切りを先に試し、だめなら {name} を試す
+	static const Node* Match(const Node& node, std::string_view path, Params& params) {
+		const size_t slash = path.find('/');
+		const std::string_view segment = path.substr(0, slash);
+		auto next = [&](const Node& child) -> const Node* {
+			if (slash == std::string_view::npos) return child.GetMethods() ? &child : nullptr;
+			return Match(child, path.substr(slash + 1), params);
+		};
+
+		auto it = node.Literals.find(segment);
+		if (it != node.Literals.end()) {
+			if (const Node* found = next(*it->second)) return found;
+		}
+		for (const auto& param : node.ParamChildren) {
+			if (segment.size() <= param.Suffix.size() || !segment.ends_with(param.Suffix)) continue;
+			params.Values[params.Count++] = segment.substr(0, segment.size() - param.Suffix.size());
+			if (const Node* found = next(*param.Child)) return found;
+			params.Count--;
+		}
+		return nullptr;
+	}
+};
@@ -0,0 +1,118 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <array>
+#include <bitset>
+#include <map>
+#include <memory>
+#include <vector>
+
+// ストリームに含まれるサービスごとの PID。AnalyzerFilter が PAT/PMT を取得するたびに作り直す
+struct ServiceMap {
+	struct Service {
+		uint16_t PMTPID = 0;
+		uint16_t VideoPID = 0x1FFF;  // 最初の映像。なければ 0x1FFF
+		uint8_t VideoStreamType = 0;
+		std::bitset<8192> PIDs;  // PMT、PCR、ES
+	};
+
+	uint16_t TransportStreamID = 0;
+	std::map<uint16_t, Service> Services;
+};
+
+// 1 つのサービスのパケットだけを通し、PAT をそのサービスだけのものに書き換える
+// パケットを 1 つずつ見て PID で振り分けるだけで、セクションはためない
+class ServiceRemux {
+public:
+	static constexpr size_t PacketSize = 188;
+	static constexpr uint16_t PID_PAT = 0x0000;
+	static constexpr uint16_t PID_TOT = 0x0014;  // TDT/TOT
+
+private:
+	uint16_t m_serviceID;
+	uint8_t m_pat[PacketSize];
+	bool m_fHasPat = false;
+	uint16_t m_patPMTPID = 0;
+	uint16_t m_patTransportStreamID = 0;
+	uint8_t m_patVersion = 0;
+	uint8_t m_patCounter = 0;
+
+public:
+	explicit ServiceRemux(uint16_t serviceID) : m_serviceID(serviceID) {}
+
+	// data のうち対象のサービスのパケットを out に足す。サービスの PMT をまだ取得していなければ何も足さない
+	void Process(const ServiceMap& map, const uint8_t* data, size_t size, std::vector<uint8_t>& out) {
+		auto it = map.Services.find(m_serviceID);
+		if (it == map.Services.end()) return;
+		const auto& service = it->second;
+		UpdatePat(map.TransportStreamID, service.PMTPID);
+
+		for (size_t pos = 0; pos + PacketSize <= size; pos += PacketSize) {
+			const uint8_t* p = data + pos;
+			const uint16_t pid = static_cast<uint16_t>(((p[1] & 0x1F) << 8) | p[2]);
+			if (pid == PID_PAT) {
+				// 元の PAT が始まるところで、代わりに書き換えたものを入れる
+				if (p[1] & 0x40) {
+					m_pat[3] = static_cast<uint8_t>(0x10 | (m_patCounter++ & 0x0F));
+					out.insert(out.end(), m_pat, m_pat + PacketSize);
+				}
+			}
+			else if (pid == PID_TOT || service.PIDs[pid]) {
+				out.insert(out.end(), p, p + PacketSize);
+			}
+		}
+	}
+
+	// MPEG-2 の CRC32 (多項式 0x04C11DB7、初期値 0xFFFFFFFF、反転なし)
+	static uint32_t Crc32(const uint8_t* data, size_t size) {
+		static const auto table = [] {
+			std::array<uint32_t, 256> t = {};
+			for (uint32_t i = 0; i < 256; i++) {
+				uint32_t crc = i << 24;
+				for (int bit = 0; bit < 8; bit++) crc = (crc << 1) ^ (crc & 0x80000000 ? 0x04C11DB7 : 0);
+				t[i] = crc;
+			}
+			return t;
+			}();
+		uint32_t crc = 0xFFFFFFFF;
+		for (size_t i = 0; i < size; i++) crc = (crc << 8) ^ table[(crc >> 24) ^ data[i]];
+		return crc;
+	}
+
+private:
+	// PMT の PID か TSID が変わったときだけ作り直し、バージョンを上げる
+	void UpdatePat(uint16_t transportStreamID, uint16_t pmtPID) {
+		if (m_fHasPat && m_patTransportStreamID == transportStreamID && m_patPMTPID == pmtPID) return;
+		if (m_fHasPat) m_patVersion = (m_patVersion + 1) & 0x1F;
+		m_fHasPat = true;
+		m_patTransportStreamID = transportStreamID;
+		m_patPMTPID = pmtPID;
+
+		std::memset(m_pat, 0xFF, sizeof(m_pat));
+		uint8_t* p = m_pat;
+		p[0] = 0x47;
+		p[1] = 0x40;  // payload_unit_start_indicator, PID 0
+		p[2] = 0x00;
+		p[3] = 0x10;  // ペイロードのみ。巡回カウンタは出すときに入れる
+		p[4] = 0x00;  // pointer_field
+		uint8_t* section = p + 5;
+		section[0] = 0x00;  // table_id
+		section[1] = 0xB0;  // section_syntax_indicator, section_length (上位)
+		section[2] = 13;    // 5 + プログラム 1 つ (4) + CRC (4)
+		section[3] = static_cast<uint8_t>(transportStreamID >> 8);
+		section[4] = static_cast<uint8_t>(transportStreamID);
+		section[5] = static_cast<uint8_t>(0xC1 | (m_patVersion << 1));  // current_next_indicator
+		section[6] = 0x00;  // section_number
+		section[7] = 0x00;  // last_section_number
+		section[8] = static_cast<uint8_t>(m_serviceID >> 8);
+		section[9] = static_cast<uint8_t>(m_serviceID);
+		section[10] = static_cast<uint8_t>(0xE0 | (pmtPID >> 8));
+		section[11] = static_cast<uint8_t>(pmtPID);
+		const uint32_t crc = Crc32(section, 12);
+		section[12] = static_cast<uint8_t>(crc >> 24);
+		section[13] = static_cast<uint8_t>(crc >> 16);
+		section[14] = static_cast<uint8_t>(crc >> 8);
+		section[15] = static_cast<uint8_t>(crc);
+	}
+};
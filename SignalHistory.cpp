@@ -0,0 +1,195 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <iterator>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+// 信号レベルやエラー数を定期的に取得して、解像度の違うリングに min/max/avg を残す
+// 1 秒 × 1 時間、1 分 × 1 日、10 分 × 30 日。メモリは最初に確保した分から増えない
+class SignalHistory {
+public:
+	enum Metric {
+		METRIC_SIGNAL_LEVEL,  // dB
+		METRIC_DROP,          // 前回の取得からの増加数 (以下 2 つも同じ)
+		METRIC_ERROR,
+		METRIC_SCRAMBLE,
+		METRIC_BIT_RATE,      // bps
+		METRIC_COUNT
+	};
+	static constexpr const char* MetricNames[METRIC_COUNT] = {
+		"signal_level",
+		"drop",
+		"error",
+		"scramble",
+		"bit_rate",
+	};
+
+	struct ResolutionInfo {
+		const char* Name;
+		int64_t IntervalMs;
+		size_t Capacity;
+	};
+	static constexpr ResolutionInfo Resolutions[] = {
+		{ "1s", 1000, 60 * 60 },
+		{ "1m", 60 * 1000, 24 * 60 },
+		{ "10m", 10 * 60 * 1000, 30 * 24 * 6 },
+	};
+	static constexpr size_t ResolutionCount = std::size(Resolutions);
+
+	// GetStatus の値。エラー数は累積のまま渡す
+	struct Sample {
+		float SignalLevel = 0;
+		uint32_t BitRate = 0;
+		uint64_t Drop = 0;
+		uint64_t Error = 0;
+		uint64_t Scramble = 0;
+	};
+
+	struct Stat {
+		double Min = 0;
+		double Max = 0;
+		double Sum = 0;
+
+		void Add(double value, bool fFirst) {
+			if (fFirst || value < Min) Min = value;
+			if (fFirst || value > Max) Max = value;
+			Sum += value;
+		}
+	};
+
+	struct Bucket {
+		int64_t TimeMs = 0;  // 区間の始まり (UNIX 時間のミリ秒)
+		uint32_t Count = 0;  // まとめたサンプルの数
+		Stat Stats[METRIC_COUNT];
+
+		double Average(Metric metric) const { return Count ? Stats[metric].Sum / Count : 0; }
+	};
+
+	// 取得できなければ false を返す
+	using Sampler = std::function<bool(Sample& sample)>;
+
+private:
+	struct Ring {
+		std::vector<Bucket> Buckets;
+		uint64_t Count = 0;  // これまでに使った区間の数。最新は Buckets[(Count - 1) % Capacity]
+	};
+
+	Ring m_rings[ResolutionCount];
+	Sample m_last;
+	bool m_fHasLast = false;
+	mutable std::mutex m_mutex;
+
+	std::thread m_thread;
+	std::mutex m_threadMutex;
+	std::condition_variable m_threadCv;
+	bool m_fRunning = false;
+
+public:
+	SignalHistory() {
+		for (size_t r = 0; r < ResolutionCount; r++) {
+			m_rings[r].Buckets.resize(Resolutions[r].Capacity);
+		}
+	}
+	~SignalHistory() { Stop(); }
+
+	static int FindResolution(std::string_view name) {
+		for (size_t r = 0; r < ResolutionCount; r++) {
+			if (name == Resolutions[r].Name) return static_cast<int>(r);
+		}
+		return -1;
+	}
+
+	void Add(int64_t timeMs, const Sample& sample) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		double values[METRIC_COUNT];
+		values[METRIC_SIGNAL_LEVEL] = sample.SignalLevel;
+		values[METRIC_DROP] = static_cast<double>(Increase(m_last.Drop, sample.Drop));
+		values[METRIC_ERROR] = static_cast<double>(Increase(m_last.Error, sample.Error));
+		values[METRIC_SCRAMBLE] = static_cast<double>(Increase(m_last.Scramble, sample.Scramble));
+		values[METRIC_BIT_RATE] = sample.BitRate;
+		m_last = sample;
+		m_fHasLast = true;
+
+		for (size_t r = 0; r < ResolutionCount; r++) {
+			auto& ring = m_rings[r];
+			const size_t capacity = Resolutions[r].Capacity;
+			const int64_t bucketMs = timeMs - timeMs % Resolutions[r].IntervalMs;
+			Bucket* bucket = ring.Count ? &ring.Buckets[(ring.Count - 1) % capacity] : nullptr;
+			// 時計が戻ったときも新しい区間にする
+			if (!bucket || bucket->TimeMs != bucketMs) {
+				bucket = &ring.Buckets[ring.Count++ % capacity];
+				*bucket = Bucket();
+				bucket->TimeMs = bucketMs;
+			}
+			for (int m = 0; m < METRIC_COUNT; m++) {
+				bucket->Stats[m].Add(values[m], bucket->Count == 0);
+			}
+			bucket->Count++;
+		}
+	}
+
+	// [fromMs, toMs) に始まる区間を古いものから返す
+	std::vector<Bucket> Get(size_t resolution, int64_t fromMs, int64_t toMs) const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		const auto& ring = m_rings[resolution];
+		const size_t capacity = Resolutions[resolution].Capacity;
+		const uint64_t first = ring.Count > capacity ? ring.Count - capacity : 0;
+		std::vector<Bucket> buckets;
+		for (uint64_t i = first; i < ring.Count; i++) {
+			const auto& bucket = ring.Buckets[i % capacity];
+			if (bucket.TimeMs >= fromMs && bucket.TimeMs < toMs) buckets.push_back(bucket);
+		}
+		return buckets;
+	}
+
+	// interval ごとに sampler を呼んで記録する
+	void Start(Sampler sampler, std::chrono::milliseconds interval = std::chrono::milliseconds(1000)) {
+		if (m_thread.joinable()) return;
+		m_fRunning = true;
+		m_thread = std::thread([this, sampler = std::move(sampler), interval]() {
+			std::unique_lock<std::mutex> lock(m_threadMutex);
+			// 取得にかかった時間で間隔がずれないように、次の時刻を足していく
+			auto next = std::chrono::steady_clock::now();
+			while (!m_threadCv.wait_until(lock, next, [this] { return !m_fRunning; })) {
+				next += interval;
+				// 取得中に Stop を待たせないようにロックを外す
+				lock.unlock();
+				Sample sample;
+				const bool fSampled = sampler(sample);
+				lock.lock();
+				if (fSampled) {
+					auto now = std::chrono::system_clock::now();
+					Add(std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count(), sample);
+				}
+				else {
+					// 取得できない間のエラー数の増加は数えない
+					std::lock_guard<std::mutex> dataLock(m_mutex);
+					m_fHasLast = false;
+				}
+			}
+			});
+	}
+
+	void Stop() {
+		{
+			std::lock_guard<std::mutex> lock(m_threadMutex);
+			m_fRunning = false;
+		}
+		m_threadCv.notify_all();
+		if (m_thread.joinable()) m_thread.join();
+	}
+
+private:
+	// チャンネル変更などで累積値が 0 に戻ったときは、戻った後の値をそのまま増加分とする
+	uint64_t Increase(uint64_t last, uint64_t current) const {
+		if (!m_fHasLast) return 0;
+		return current >= last ? current - last : current;
+	}
+};
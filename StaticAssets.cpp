@@ -0,0 +1,238 @@
+﻿#pragma once
+
+#include <string>
+#include <map>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <ctime>
+#include "httplib.h"
+#include "Compression.cpp"
+
+// Web クライアントの静的ファイルを起動時に読み込んで保持するテーブル
+// 読み込んだ後は変更しない。リロード時はテーブルごと差し替える
+class StaticAssets {
+public:
+	struct Asset {
+		std::string ContentType;
+		PrecompressedContent Content;
+		std::string ETag;          // 無圧縮の ETag。圧縮したものは末尾に -gz / -br を付ける
+		std::string LastModified;  // HTTP-date
+		std::filesystem::file_time_type WriteTime;
+	};
+
+private:
+	struct Entry {
+		const char* Path;
+		const char* FileName;
+		const char* ContentType;
+	};
+	static constexpr Entry Entries[] = {
+		{ "/", "HttpRemoconCli.html", "text/html; charset=utf-8" },
+		{ "/HttpRemoconCli.html", "HttpRemoconCli.html", "text/html; charset=utf-8" },
+	};
+
+	using Table = std::map<std::string, std::shared_ptr<const Asset>>;
+
+	std::filesystem::path m_directory;
+	std::atomic<std::shared_ptr<const Table>> m_table;
+
+	std::thread m_watchThread;
+	std::mutex m_watchMutex;
+	std::condition_variable m_watchCv;
+	bool m_fWatching = false;
+
+public:
+	~StaticAssets() { StopWatching(); }
+
+	void Load(const std::filesystem::path& directory) {
+		m_directory = directory;
+		m_table.store(BuildTable(nullptr));
+	}
+
+	std::shared_ptr<const Asset> Find(const std::string& path) const {
+		auto table = m_table.load();
+		if (!table) return nullptr;
+		auto it = table->find(path);
+		return it == table->end() ? nullptr : it->second;
+	}
+
+	// 開発用: ファイルの更新日時を定期的に見て、変わっていたら読み直す
+	void StartWatching(std::chrono::milliseconds interval = std::chrono::milliseconds(1000)) {
+		if (m_watchThread.joinable()) return;
+		m_fWatching = true;
+		m_watchThread = std::thread([this, interval]() {
+			std::unique_lock<std::mutex> lock(m_watchMutex);
+			while (!m_watchCv.wait_for(lock, interval, [this] { return !m_fWatching; })) {
+				auto current = m_table.load();
+				if (IsModified(current)) {
+					m_table.store(BuildTable(current));
+				}
+			}
+			});
+	}
+
+	void StopWatching() {
+		{
+			std::lock_guard<std::mutex> lock(m_watchMutex);
+			m_fWatching = false;
+		}
+		m_watchCv.notify_all();
+		if (m_watchThread.joinable()) m_watchThread.join();
+	}
+
+	// 条件付きリクエスト (If-None-Match / If-Modified-Since) にも対応して返す
+	bool Serve(const httplib::Request& req, httplib::Response& res) const {
+		auto asset = Find(req.path);
+		if (!asset) return false;
+
+		auto encoding = asset->Content.Select(Compression::Negotiate(req.get_header_value("Accept-Encoding")));
+		std::string etag = "\"" + asset->ETag + EncodingSuffix(encoding) + "\"";
+
+		res.set_header("ETag", etag);
+		res.set_header("Last-Modified", asset->LastModified);
+		res.set_header("Cache-Control", "no-cache");
+		res.set_header("Vary", "Accept-Encoding");
+
+		if (IsNotModified(req, etag, asset->LastModified)) {
+			res.status = 304;
+			return true;
+		}
+
+		if (encoding != ContentEncoding::Identity) {
+			res.set_header("Content-Encoding", Compression::Name(encoding));
+		}
+		// テーブルが差し替えられても返し終わるまで asset を保持する
+		const std::string& body = asset->Content.Get(encoding);
+		res.set_content_provider(body.size(), asset->ContentType,
+			[asset, &body](size_t offset, size_t length, httplib::DataSink& sink) {
+				return sink.write(body.data() + offset, length);
+			});
+		res.status = 200;
+		return true;
+	}
+
+private:
+	std::shared_ptr<const Table> BuildTable(const std::shared_ptr<const Table>& previous) const {
+		auto table = std::make_shared<Table>();
+		// 同じファイルを複数のパスで返す場合は一度だけ読み込む
+		std::map<std::string, std::shared_ptr<const Asset>> loaded;
+		for (const auto& entry : Entries) {
+			auto& asset = loaded[entry.FileName];
+			if (!asset) {
+				auto path = m_directory / entry.FileName;
+				std::error_code ec;
+				auto writeTime = std::filesystem::last_write_time(path, ec);
+				if (ec) continue;
+
+				// 更新されていなければ前のテーブルのものを使い回す
+				if (previous) {
+					auto it = previous->find(entry.Path);
+					if (it != previous->end() && it->second->WriteTime == writeTime) asset = it->second;
+				}
+				if (!asset) asset = LoadAsset(path, entry.ContentType, writeTime);
+			}
+			if (asset) table->emplace(entry.Path, asset);
+		}
+		return table;
+	}
+
+	static std::shared_ptr<const Asset> LoadAsset(const std::filesystem::path& path, const char* contentType, std::filesystem::file_time_type writeTime) {
+		std::ifstream file(path, std::ios::binary);
+		if (!file) return nullptr;
+		std::ostringstream oss;
+		oss << file.rdbuf();
+
+		auto asset = std::make_shared<Asset>();
+		asset->ContentType = contentType;
+		asset->Content = PrecompressedContent::Create(oss.str());
+		asset->ETag = HashToETag(asset->Content.Identity);
+		asset->LastModified = ToHttpDate(writeTime);
+		asset->WriteTime = writeTime;
+		return asset;
+	}
+
+	bool IsModified(const std::shared_ptr<const Table>& table) const {
+		for (const auto& entry : Entries) {
+			std::error_code ec;
+			auto writeTime = std::filesystem::last_write_time(m_directory / entry.FileName, ec);
+			std::shared_ptr<const Asset> asset;
+			if (table) {
+				auto it = table->find(entry.Path);
+				if (it != table->end()) asset = it->second;
+			}
+			if (ec) {
+				if (asset) return true;  // 削除された
+				continue;
+			}
+			if (!asset || asset->WriteTime != writeTime) return true;
+		}
+		return false;
+	}
+
+	static bool IsNotModified(const httplib::Request& req, const std::string& etag, const std::string& lastModified) {
+		// If-None-Match があれば If-Modified-Since は見ない (RFC 9110 13.2.2)
+		if (req.has_header("If-None-Match")) {
+			const auto& value = req.get_header_value("If-None-Match");
+			if (value == "*") return true;
+			size_t pos = 0;
+			while (pos < value.size()) {
+				size_t end = value.find(',', pos);
+				if (end == std::string::npos) end = value.size();
+				auto tag = value.substr(pos, end - pos);
+				tag.erase(0, tag.find_first_not_of(" \t"));
+				tag.erase(tag.find_last_not_of(" \t") + 1);
+				if (tag.starts_with("W/")) tag.erase(0, 2);
+				if (tag == etag) return true;
+				pos = end + 1;
+			}
+			return false;
+		}
+		// ブラウザは Last-Modified をそのまま送り返してくるので文字列で比べる
+		return req.has_header("If-Modified-Since") && req.get_header_value("If-Modified-Since") == lastModified;
+	}
+
+	static const char* EncodingSuffix(ContentEncoding encoding) {
+		switch (encoding) {
+		case ContentEncoding::Gzip: return "-gz";
+		case ContentEncoding::Brotli: return "-br";
+		default: return "";
+		}
+	}
+
+	// FNV-1a
+	static std::string HashToETag(const std::string& content) {
+		uint64_t hash = 14695981039346656037ULL;
+		for (unsigned char c : content) {
+			hash ^= c;
+			hash *= 1099511628211ULL;
+		}
+		char buffer[17] = {};
+		snprintf(buffer, sizeof(buffer), "%016llx", static_cast<unsigned long long>(hash));
+		return buffer;
+	}
+
+	static std::string ToHttpDate(std::filesystem::file_time_type writeTime) {
+		static constexpr const char* days[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+		static constexpr const char* months[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+		auto sysTime = std::chrono::file_clock::to_sys(writeTime);
+		std::time_t t = std::chrono::system_clock::to_time_t(sysTime);
+		std::tm tm = {};
+#ifdef _WIN32
+		gmtime_s(&tm, &t);
+#else
+		gmtime_r(&t, &tm);
+#endif
+		char buffer[std::size("Sun, 06 Nov 1994 08:49:37 GMT")] = {};
+		snprintf(std::data(buffer), std::size(buffer), "%s, %02d %s %04d %02d:%02d:%02d GMT",
+			days[tm.tm_wday], tm.tm_mday, months[tm.tm_mon], tm.tm_year + 1900, tm.tm_hour, tm.tm_min, tm.tm_sec);
+		return buffer;
+	}
+};
@@ -0,0 +1,148 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <cwchar>
+#include <string>
+#include <string_view>
+
+// UTF-8 と wchar_t の文字列 (Windows では UTF-16、それ以外では UTF-32) の変換
+// Win32 の API を使わないので、ハンドラを Windows 以外でも動かせる。
+// MultiByteToWideChar / WideCharToMultiByte と同じく、正しくない並びは U+FFFD にし、途中の NUL で終わりにする
+class StringConvert {
+public:
+	static std::wstring Utf8ToWide(std::string_view utf8) {
+		utf8 = utf8.substr(0, utf8.find('\0'));
+		std::wstring out;
+		out.reserve(utf8.size());
+		size_t i = 0;
+		while (i < utf8.size()) {
+			AppendWide(out, DecodeUtf8(utf8, i));
+		}
+		return out;
+	}
+
+	static std::string WideToUtf8(std::wstring_view wide) {
+		wide = wide.substr(0, wide.find(L'\0'));
+		std::string out;
+		out.reserve(wide.size());
+		for (size_t i = 0; i < wide.size(); i++) {
+			char32_t c = static_cast<char32_t>(wide[i]);
+			if constexpr (sizeof(wchar_t) == 2) {
+				if (c >= 0xD800 && c <= 0xDBFF && i + 1 < wide.size()) {
+					const char32_t low = static_cast<char32_t>(wide[i + 1]);
+					if (low >= 0xDC00 && low <= 0xDFFF) {
+						c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+						i++;
+					}
+				}
+			}
+			AppendUtf8(out, c);
+		}
+		return out;
+	}
+
+private:
+	static constexpr char32_t Replacement = 0xFFFD;
+
+	static bool IsScalar(char32_t c) {
+		return c <= 0x10FFFF && (c < 0xD800 || c > 0xDFFF);
+	}
+
+	// pos の 1 文字を読んで進める。正しくない並びは 1 バイトだけ進めて U+FFFD を返す
+	static char32_t DecodeUtf8(std::string_view s, size_t& pos) {
+		const unsigned char lead = static_cast<unsigned char>(s[pos]);
+		size_t length;
+		char32_t c;
+		char32_t min;
+		if (lead < 0x80) {
+			pos++;
+			return lead;
+		}
+		else if ((lead & 0xE0) == 0xC0) {
+			length = 2;
+			c = lead & 0x1F;
+			min = 0x80;
+		}
+		else if ((lead & 0xF0) == 0xE0) {
+			length = 3;
+			c = lead & 0x0F;
+			min = 0x800;
+		}
+		else if ((lead & 0xF8) == 0xF0) {
+			length = 4;
+			c = lead & 0x07;
+			min = 0x10000;
+		}
+		else {
+			pos++;
+			return Replacement;
+		}
+		if (s.size() - pos < length) {
+			pos++;
+			return Replacement;
+		}
+		for (size_t i = 1; i < length; i++) {
+			const unsigned char trail = static_cast<unsigned char>(s[pos + i]);
+			if ((trail & 0xC0) != 0x80) {
+				pos++;
+				return Replacement;
+			}
+			c = (c << 6) | (trail & 0x3F);
+		}
+		if (c < min || !IsScalar(c)) {
+			pos++;
+			return Replacement;
+		}
+		pos += length;
+		return c;
+	}
+
+	static void AppendWide(std::wstring& out, char32_t c) {
+		if constexpr (sizeof(wchar_t) == 2) {
+			if (c >= 0x10000) {
+				c -= 0x10000;
+				out += static_cast<wchar_t>(0xD800 + (c >> 10));
+				out += static_cast<wchar_t>(0xDC00 + (c & 0x3FF));
+				return;
+			}
+		}
+		out += static_cast<wchar_t>(c);
+	}
+
+	static void AppendUtf8(std::string& out, char32_t c) {
+		if (!IsScalar(c)) c = Replacement;
+		if (c < 0x80) {
+			out += static_cast<char>(c);
+		}
+		else if (c < 0x800) {
+			out += static_cast<char>(0xC0 | (c >> 6));
+			out += static_cast<char>(0x80 | (c & 0x3F));
+		}
+		else if (c < 0x10000) {
+			out += static_cast<char>(0xE0 | (c >> 12));
+			out += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+			out += static_cast<char>(0x80 | (c & 0x3F));
+		}
+		else {
+			out += static_cast<char>(0xF0 | (c >> 18));
+			out += static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+			out += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+			out += static_cast<char>(0x80 | (c & 0x3F));
+		}
+	}
+};
+
+// UTF-8 から wchar_t への変換
+inline std::wstring convertUtf8ToWstring(const std::string& utf8) {
+	return StringConvert::Utf8ToWide(utf8);
+}
+
+// wchar_t から UTF-8 への変換
+inline std::string convertWstringToUtf8(const std::wstring& wstr) {
+	return StringConvert::WideToUtf8(wstr);
+}
+
+// TVTest の構造体の文字列。nullptr は空にする
+inline std::string WideCharToUTF8(const wchar_t* pWideChar) {
+	return pWideChar ? StringConvert::WideToUtf8(pWideChar) : std::string();
+}
@@ -0,0 +1,253 @@
+﻿#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <charconv>
+#include <type_traits>
+
+// JSON / MessagePack / CBOR で同じ組み立てコードを使うための書き出しインターフェース
+// 文字列は UTF-8 で渡す
+class StructuredWriter {
+protected:
+	std::string m_output;
+
+public:
+	virtual ~StructuredWriter() = default;
+
+	virtual const char* ContentType() const = 0;
+	virtual void BeginObject() = 0;
+	virtual void EndObject() = 0;
+	virtual void BeginArray() = 0;
+	virtual void EndArray() = 0;
+	virtual void Key(std::string_view key) = 0;
+	virtual void String(std::string_view value) = 0;
+	virtual void Int(int64_t value) = 0;
+	virtual void Double(double value) = 0;
+	virtual void Bool(bool value) = 0;
+	virtual void Null() = 0;
+
+	// テキスト形式か (バイナリ形式のときは長いテキストを省く)
+	virtual bool IsText() const { return false; }
+
+	template<class T>
+	void Field(std::string_view key, T value) {
+		Key(key);
+		if constexpr (std::is_same_v<T, bool>) Bool(value);
+		else if constexpr (std::is_integral_v<T> || std::is_enum_v<T>) Int(static_cast<int64_t>(value));
+		else if constexpr (std::is_floating_point_v<T>) Double(static_cast<double>(value));
+		else String(value);
+	}
+	void NullField(std::string_view key) {
+		Key(key);
+		Null();
+	}
+
+	std::string& Output() { return m_output; }
+
+	// Accept ヘッダから書き出し形式を選ぶ。指定がなければ JSON
+	static std::unique_ptr<StructuredWriter> Create(std::string_view accept);
+	// Accept で構造化した形式が明示されているか
+	static bool IsRequested(std::string_view accept) {
+		return accept.find("application/json") != std::string_view::npos
+			|| accept.find("msgpack") != std::string_view::npos
+			|| accept.find("application/cbor") != std::string_view::npos;
+	}
+};
+
+class JsonWriter : public StructuredWriter {
+	// ネストごとに最初の要素かどうか
+	std::vector<bool> m_first;
+	bool m_afterKey = false;
+
+	void Separator() {
+		if (m_afterKey) {
+			m_afterKey = false;
+			return;
+		}
+		if (!m_first.empty()) {
+			if (!m_first.back()) m_output += ',';
+			m_first.back() = false;
+		}
+	}
+
+	void Quoted(std::string_view s) {
+		static const char hex[] = "0123456789abcdef";
+		m_output += '"';
+		for (char c : s) {
+			switch (c) {
+			case '"':  m_output += "\\\""; break;
+			case '\\': m_output += "\\\\"; break;
+			case '/':  m_output += "\\/";  break;
+			case '\b': m_output += "\\b";  break;
+			case '\f': m_output += "\\f";  break;
+			case '\n': m_output += "\\n";  break;
+			case '\r': m_output += "\\r";  break;
+			case '\t': m_output += "\\t";  break;
+			default:
+				if (static_cast<unsigned char>(c) < 0x20) {
+					m_output += "\\u00";
+					m_output += hex[(c >> 4) & 0xF];
+					m_output += hex[c & 0xF];
+				}
+				else {
+					m_output += c;
+				}
+				break;
+			}
+		}
+		m_output += '"';
+	}
+
+public:
+	const char* ContentType() const override { return "application/json"; }
+	bool IsText() const override { return true; }
+
+	void BeginObject() override { Separator(); m_output += '{'; m_first.push_back(true); }
+	void EndObject() override { m_output += '}'; m_first.pop_back(); }
+	void BeginArray() override { Separator(); m_output += '['; m_first.push_back(true); }
+	void EndArray() override { m_output += ']'; m_first.pop_back(); }
+	void Key(std::string_view key) override {
+		Separator();
+		Quoted(key);
+		m_output += ':';
+		m_afterKey = true;
+	}
+	void String(std::string_view value) override { Separator(); Quoted(value); }
+	void Int(int64_t value) override { Separator(); m_output += std::to_string(value); }
+	// 読み戻すと同じ値になる最短の桁数で書く。JSON にない NaN / Inf は null
+	void Double(double value) override {
+		Separator();
+		if (!std::isfinite(value)) {
+			m_output += "null";
+			return;
+		}
+		char buffer[32];
+		auto [ptr, ec] = std::to_chars(buffer, buffer + sizeof(buffer), value);
+		m_output.append(buffer, ec == std::errc() ? ptr : buffer);
+	}
+	void Bool(bool value) override { Separator(); m_output += value ? "true" : "false"; }
+	void Null() override { Separator(); m_output += "null"; }
+};
+
+// MessagePack
+// map/array は要素数が後から決まるので 32 ビット長で書いておき、閉じるときに埋める
+class MessagePackWriter : public StructuredWriter {
+	struct Container {
+		size_t HeaderPos;
+		uint32_t Count;
+		bool IsMap;
+	};
+	std::vector<Container> m_stack;
+
+	void Put8(uint8_t v) { m_output += static_cast<char>(v); }
+	void PutBE(uint64_t v, int bytes) {
+		for (int i = bytes - 1; i >= 0; i--) Put8(static_cast<uint8_t>(v >> (i * 8)));
+	}
+	void Element() {
+		if (!m_stack.empty() && !m_stack.back().IsMap) m_stack.back().Count++;
+	}
+	void Begin(uint8_t marker, bool isMap) {
+		Element();
+		Put8(marker);
+		m_stack.push_back({ m_output.size(), 0, isMap });
+		PutBE(0, 4);
+	}
+	void End() {
+		auto c = m_stack.back();
+		m_stack.pop_back();
+		for (int i = 0; i < 4; i++) m_output[c.HeaderPos + i] = static_cast<char>(c.Count >> ((3 - i) * 8));
+	}
+	void Str(std::string_view s) {
+		if (s.size() < 32) Put8(static_cast<uint8_t>(0xa0 | s.size()));
+		else if (s.size() <= 0xff) { Put8(0xd9); PutBE(s.size(), 1); }
+		else if (s.size() <= 0xffff) { Put8(0xda); PutBE(s.size(), 2); }
+		else { Put8(0xdb); PutBE(s.size(), 4); }
+		m_output.append(s);
+	}
+
+public:
+	const char* ContentType() const override { return "application/msgpack"; }
+
+	void BeginObject() override { Begin(0xdf, true); }
+	void EndObject() override { End(); }
+	void BeginArray() override { Begin(0xdd, false); }
+	void EndArray() override { End(); }
+	void Key(std::string_view key) override {
+		if (!m_stack.empty()) m_stack.back().Count++;
+		Str(key);
+	}
+	void String(std::string_view value) override { Element(); Str(value); }
+	void Int(int64_t value) override {
+		Element();
+		if (value >= 0 && value < 0x80) Put8(static_cast<uint8_t>(value));
+		else if (value < 0 && value >= -32) Put8(static_cast<uint8_t>(value));
+		else if (value >= INT32_MIN && value <= INT32_MAX) { Put8(0xd2); PutBE(static_cast<uint32_t>(value), 4); }
+		else { Put8(0xd3); PutBE(static_cast<uint64_t>(value), 8); }
+	}
+	void Double(double value) override {
+		Element();
+		uint64_t bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+		Put8(0xcb);
+		PutBE(bits, 8);
+	}
+	void Bool(bool value) override { Element(); Put8(value ? 0xc3 : 0xc2); }
+	void Null() override { Element(); Put8(0xc0); }
+};
+
+// CBOR (RFC 8949)
+// map/array は不定長で書いて 0xff で閉じる
+class CborWriter : public StructuredWriter {
+	void Put8(uint8_t v) { m_output += static_cast<char>(v); }
+	void Head(uint8_t major, uint64_t value) {
+		major <<= 5;
+		if (value < 24) Put8(static_cast<uint8_t>(major | value));
+		else if (value <= 0xff) { Put8(major | 24); Put8(static_cast<uint8_t>(value)); }
+		else if (value <= 0xffff) { Put8(major | 25); for (int i = 1; i >= 0; i--) Put8(static_cast<uint8_t>(value >> (i * 8))); }
+		else if (value <= 0xffffffff) { Put8(major | 26); for (int i = 3; i >= 0; i--) Put8(static_cast<uint8_t>(value >> (i * 8))); }
+		else { Put8(major | 27); for (int i = 7; i >= 0; i--) Put8(static_cast<uint8_t>(value >> (i * 8))); }
+	}
+	void Text(std::string_view s) {
+		Head(3, s.size());
+		m_output.append(s);
+	}
+
+public:
+	const char* ContentType() const override { return "application/cbor"; }
+
+	void BeginObject() override { Put8(0xbf); }
+	void EndObject() override { Put8(0xff); }
+	void BeginArray() override { Put8(0x9f); }
+	void EndArray() override { Put8(0xff); }
+	void Key(std::string_view key) override { Text(key); }
+	void String(std::string_view value) override { Text(value); }
+	void Int(int64_t value) override {
+		if (value >= 0) Head(0, static_cast<uint64_t>(value));
+		else Head(1, static_cast<uint64_t>(-(value + 1)));
+	}
+	void Double(double value) override {
+		uint64_t bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+		Put8(0xfb);
+		for (int i = 7; i >= 0; i--) Put8(static_cast<uint8_t>(bits >> (i * 8)));
+	}
+	void Bool(bool value) override { Put8(value ? 0xf5 : 0xf4); }
+	void Null() override { Put8(0xf6); }
+};
+
+inline std::unique_ptr<StructuredWriter> StructuredWriter::Create(std::string_view accept) {
+	if (accept.find("application/msgpack") != std::string_view::npos
+			|| accept.find("application/x-msgpack") != std::string_view::npos) {
+		return std::make_unique<MessagePackWriter>();
+	}
+	if (accept.find("application/cbor") != std::string_view::npos) {
+		return std::make_unique<CborWriter>();
+	}
+	return std::make_unique<JsonWriter>();
+}
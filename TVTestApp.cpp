@@ -0,0 +1,196 @@
+﻿#pragma once
+
+#include <cstring>
+#include <string>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <shellapi.h>
+#else
+#include "compat/Win32Types.h"
+#endif
+#include "TVTestPlugin.h"
+
+// ハンドラから呼ぶ TVTest の API
+// TVTest::CTVTestApp の同じ名前のメソッドと引数も戻り値も同じにしてあるので、そのまま差し替えられる。
+// プラグインの登録やコールバックの設定 (SetEventCallback / SetStreamCallback) はここに含めない
+class ITVTestApp {
+public:
+	virtual ~ITVTestApp() = default;
+
+	virtual bool SetDriverName(LPCWSTR pszName) = 0;
+	virtual int GetDriverName(LPWSTR pszName, int MaxLength) = 0;
+	virtual int EnumDriver(int Index, LPWSTR pszFileName, int MaxLength) = 0;
+	virtual bool GetDriverTuningSpaceList(LPCWSTR pszDriverName, TVTest::DriverTuningSpaceList* pList) = 0;
+	virtual void FreeDriverTuningSpaceList(TVTest::DriverTuningSpaceList* pList) = 0;
+	virtual bool SetChannel(int Space, int Channel) = 0;
+	virtual bool SelectChannel(const TVTest::ChannelSelectInfo* pInfo) = 0;
+	virtual bool GetCurrentChannelInfo(TVTest::ChannelInfo* pInfo) = 0;
+	virtual bool GetCurrentProgramInfo(TVTest::ProgramInfo* pInfo, bool fNext) = 0;
+	virtual TVTest::EpgEventInfo* GetEpgEventInfo(const TVTest::EpgEventQueryInfo* pInfo) = 0;
+	virtual void FreeEpgEventInfo(TVTest::EpgEventInfo* pEventInfo) = 0;
+	virtual bool GetEpgEventList(TVTest::EpgEventList* pList) = 0;
+	virtual void FreeEpgEventList(TVTest::EpgEventList* pList) = 0;
+	virtual bool GetStatus(TVTest::StatusInfo* pInfo) = 0;
+	virtual bool GetRecordStatus(TVTest::RecordStatusInfo* pInfo) = 0;
+	virtual bool StopRecord() = 0;
+	virtual int GetVolume() = 0;
+	virtual bool SetVolume(int Volume) = 0;
+	virtual bool DoCommand(LPCWSTR pszCommand) = 0;
+	virtual bool SaveImage() = 0;
+	virtual DWORD GetSetting(LPCWSTR pszName, LPWSTR pszString, DWORD MaxLength) = 0;
+	virtual bool Reset(TVTest::ResetFlag Flags) = 0;
+};
+
+#ifdef _WIN32
+// 本物の TVTest
+class TVTestAppAdapter : public ITVTestApp {
+	TVTest::CTVTestApp* m_pApp;
+
+public:
+	explicit TVTestAppAdapter(TVTest::CTVTestApp* pApp) : m_pApp(pApp) {}
+
+	bool SetDriverName(LPCWSTR pszName) override { return m_pApp->SetDriverName(pszName); }
+	int GetDriverName(LPWSTR pszName, int MaxLength) override { return m_pApp->GetDriverName(pszName, MaxLength); }
+	int EnumDriver(int Index, LPWSTR pszFileName, int MaxLength) override { return m_pApp->EnumDriver(Index, pszFileName, MaxLength); }
+	bool GetDriverTuningSpaceList(LPCWSTR pszDriverName, TVTest::DriverTuningSpaceList* pList) override { return m_pApp->GetDriverTuningSpaceList(pszDriverName, pList); }
+	void FreeDriverTuningSpaceList(TVTest::DriverTuningSpaceList* pList) override { m_pApp->FreeDriverTuningSpaceList(pList); }
+	bool SetChannel(int Space, int Channel) override { return m_pApp->SetChannel(Space, Channel); }
+	bool SelectChannel(const TVTest::ChannelSelectInfo* pInfo) override { return m_pApp->SelectChannel(pInfo); }
+	bool GetCurrentChannelInfo(TVTest::ChannelInfo* pInfo) override { return m_pApp->GetCurrentChannelInfo(pInfo); }
+	bool GetCurrentProgramInfo(TVTest::ProgramInfo* pInfo, bool fNext) override { return m_pApp->GetCurrentProgramInfo(pInfo, fNext); }
+	TVTest::EpgEventInfo* GetEpgEventInfo(const TVTest::EpgEventQueryInfo* pInfo) override { return m_pApp->GetEpgEventInfo(pInfo); }
+	void FreeEpgEventInfo(TVTest::EpgEventInfo* pEventInfo) override { m_pApp->FreeEpgEventInfo(pEventInfo); }
+	bool GetEpgEventList(TVTest::EpgEventList* pList) override { return m_pApp->GetEpgEventList(pList); }
+	void FreeEpgEventList(TVTest::EpgEventList* pList) override { m_pApp->FreeEpgEventList(pList); }
+	bool GetStatus(TVTest::StatusInfo* pInfo) override { return m_pApp->GetStatus(pInfo); }
+	bool GetRecordStatus(TVTest::RecordStatusInfo* pInfo) override { return m_pApp->GetRecordStatus(pInfo); }
+	bool StopRecord() override { return m_pApp->StopRecord(); }
+	int GetVolume() override { return m_pApp->GetVolume(); }
+	bool SetVolume(int Volume) override { return m_pApp->SetVolume(Volume); }
+	bool DoCommand(LPCWSTR pszCommand) override { return m_pApp->DoCommand(pszCommand); }
+	bool SaveImage() override { return m_pApp->SaveImage(); }
+	DWORD GetSetting(LPCWSTR pszName, LPWSTR pszString, DWORD MaxLength) override { return m_pApp->GetSetting(pszName, pszString, MaxLength); }
+	bool Reset(TVTest::ResetFlag Flags) override { return m_pApp->Reset(Flags); }
+};
+#endif
+
+// TvtPlay (ファイル再生) の操作
+class ITvtPlay {
+public:
+	virtual ~ITvtPlay() = default;
+
+	// TvtPlay が動いているか
+	virtual bool IsRunning() = 0;
+	virtual bool IsOpen() = 0;
+	// ミリ秒。TvtPlay がなければ -1
+	virtual long GetPosition() = 0;
+	virtual long GetDuration() = 0;
+	virtual bool IsPaused() = 0;
+	// 再生速度。TvtPlay がなければ -1
+	virtual int GetStretch() = 0;
+	// TvtPlay がなければ false
+	virtual bool Seek(int msec, bool fRelative) = 0;
+	// TVTest のウィンドウにファイルをドロップして開かせる。ウィンドウがなければ false
+	virtual bool OpenFile(const std::wstring& path) = 0;
+};
+
+#ifdef _WIN32
+// TvtPlay のウィンドウにメッセージを送る
+class TvtPlayWindow : public ITvtPlay {
+	static constexpr UINT WM_TVTP_APP = 0x8000;
+	static constexpr UINT WM_TVTP_IS_OPEN = WM_TVTP_APP + 51;
+	static constexpr UINT WM_TVTP_GET_POSITION = WM_TVTP_APP + 52;
+	static constexpr UINT WM_TVTP_GET_DURATION = WM_TVTP_APP + 53;
+	static constexpr UINT WM_TVTP_IS_PAUSED = WM_TVTP_APP + 56;
+	static constexpr UINT WM_TVTP_GET_STRETCH = WM_TVTP_APP + 58;
+	static constexpr UINT WM_TVTP_SEEK = WM_TVTP_APP + 60;
+	static constexpr UINT WM_TVTP_SEEK_ABSOLUTE = WM_TVTP_APP + 61;
+
+	static HWND FindFrame() { return FindWindowW(L"TvtPlay Frame", NULL); }
+
+public:
+	bool IsRunning() override { return FindFrame() != NULL; }
+
+	bool IsOpen() override {
+		HWND hwnd = FindFrame();
+		return hwnd != NULL && SendMessage(hwnd, WM_TVTP_IS_OPEN, 0, 0) != 0;
+	}
+
+	long GetPosition() override {
+		HWND hwnd = FindFrame();
+		return hwnd == NULL ? -1 : static_cast<long>(SendMessage(hwnd, WM_TVTP_GET_POSITION, 0, 0));
+	}
+
+	long GetDuration() override {
+		HWND hwnd = FindFrame();
+		return hwnd == NULL ? -1 : static_cast<long>(SendMessage(hwnd, WM_TVTP_GET_DURATION, 0, 0));
+	}
+
+	bool IsPaused() override {
+		HWND hwnd = FindFrame();
+		return hwnd != NULL && SendMessage(hwnd, WM_TVTP_IS_PAUSED, 0, 0) == 1;
+	}
+
+	int GetStretch() override {
+		HWND hwnd = FindFrame();
+		return hwnd == NULL ? -1 : HIWORD(SendMessage(hwnd, WM_TVTP_GET_STRETCH, 0, 0));
+	}
+
+	bool Seek(int msec, bool fRelative) override {
+		HWND hwnd = FindFrame();
+		if (hwnd == NULL) return false;
+		SendMessage(hwnd, fRelative ? WM_TVTP_SEEK : WM_TVTP_SEEK_ABSOLUTE, 0, (LPARAM)msec);
+		return true;
+	}
+
+	bool OpenFile(const std::wstring& path) override {
+		HWND hwnd = FindWindowW(L"TVTest Window", NULL);
+		if (hwnd == NULL) return false;
+		SimulateDropFiles(hwnd, path);
+		return true;
+	}
+
+private:
+	// ファイルのドラッグアンドドロップをシミュレートする
+	static void SimulateDropFiles(HWND hwndTarget, const std::wstring& filePath)
+	{
+		// ドロップするファイルのリストを準備
+		DROPFILES dropFiles = { 0 };
+		dropFiles.pFiles = sizeof(DROPFILES);  // ファイルリストのオフセット
+		dropFiles.fNC = TRUE;                  // 非クライアントエリアのフラグ
+		dropFiles.pt.x = 0;                    // ドロップ位置（相対座標）
+		dropFiles.pt.y = 0;
+		dropFiles.fWide = TRUE;
+
+		// ファイルパスを二重終端で準備（必要な形式）
+		size_t filePathSize = (filePath.length() + 1) * sizeof(wchar_t);
+		size_t totalSize = sizeof(DROPFILES) + filePathSize;
+
+		// メモリを確保
+		HGLOBAL hGlobal = GlobalAlloc(GHND, totalSize);
+		if (hGlobal) {
+			// メモリをロックしてアクセス可能にする
+			BYTE* pData = (BYTE*)GlobalLock(hGlobal);
+			if (pData) {
+				// DROPFILES構造体をコピー
+				memcpy(pData, &dropFiles, sizeof(DROPFILES));
+
+				// ファイルパスをコピー（DROPFILES構造体の直後に）
+				memcpy(pData + sizeof(DROPFILES), filePath.c_str(), filePathSize);
+
+				// メモリをアンロック
+				GlobalUnlock(hGlobal);
+
+				// ターゲットウィンドウにWM_DROPFILESメッセージを送信
+				PostMessage(hwndTarget, WM_DROPFILES, (WPARAM)hGlobal, 0);
+			}
+			else {
+				// メモリのロックに失敗した場合
+				GlobalFree(hGlobal);
+			}
+		}
+	}
+};
+#endif
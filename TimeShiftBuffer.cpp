@@ -0,0 +1,230 @@
+﻿#pragma once
+
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+
+#include <windows.h>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+
+// ライブの TS を直近の一定時間だけファイルのリングに残して、過去の位置から流せるようにする
+// ファイルはマップして StreamCallback からそのまま書き込む。
+// (TOT, PCR) → 位置 の索引を 1 秒ごとに付けるので、?at= の位置は二分探索 1 回で決まる
+class TimeShiftBuffer {
+public:
+	static constexpr size_t PacketSize = 188;
+	static constexpr size_t ReadSize = PacketSize * 348;  // 1 回に渡す最大の大きさ
+	static constexpr int64_t IndexInterval = 90000;       // PCR (90kHz) で 1 秒
+	static constexpr uint64_t NotifyInterval = PacketSize * 87;  // 待っている Reader を起こす間隔 (16KB 強)
+	// 書き込み位置にこれより近いところは上書きされる途中かもしれないので読まない
+	static constexpr uint64_t OverrunMargin = PacketSize * 348 * 64;
+	// 1 つのビューにマップできる大きさ。32 ビットではアドレス空間に収まるように抑える
+	static constexpr uint64_t MaxCapacity = sizeof(SIZE_T) < 8 ? 512ULL * 1024 * 1024 : 1ULL << 40;
+
+	struct IndexEntry {
+		int64_t TotMs;    // UNIX 時間のミリ秒
+		int64_t Pcr;      // PCR の 90kHz の部分
+		uint64_t Offset;  // 書き込み始めからのバイト位置
+	};
+
+	// 時刻を指定して読み始める。書き込みに追い越されたら読める一番古いところまで進む
+	class Reader {
+		TimeShiftBuffer& m_buffer;
+		uint64_t m_pos;
+
+	public:
+		Reader(TimeShiftBuffer& buffer, uint64_t pos) : m_buffer(buffer), m_pos(pos) {}
+
+		// 続きを out にコピーする。追いついていれば空
+		// 送っている間 (WriteTimeout まで) に上書きされないようにリングから直接は渡さない。
+		// コピーしている間に書き込みに追い越されたら、その分は捨てて読める一番古いところから読み直す
+		void Read(std::vector<uint8_t>& out) {
+			for (;;) {
+				const uint64_t written = m_buffer.m_written.load(std::memory_order_acquire);
+				const uint64_t oldest = m_buffer.GetOldest(written);
+				if (m_pos < oldest) m_pos = oldest;
+				const uint64_t offset = m_pos % m_buffer.m_capacity;
+				const size_t size = static_cast<size_t>(std::min<uint64_t>({ written - m_pos, m_buffer.m_capacity - offset, ReadSize }));
+				out.assign(m_buffer.m_pView + offset, m_buffer.m_pView + offset + size);
+				// コピーを読み終えてから書き込み位置を見直す
+				std::atomic_thread_fence(std::memory_order_acquire);
+				if (m_buffer.GetOldest(m_buffer.m_written.load(std::memory_order_relaxed)) <= m_pos) {
+					m_pos += size;
+					return;
+				}
+			}
+		}
+
+		// 追いついたときに、書き込みが進むか timeout まで待つ
+		void Wait(std::chrono::milliseconds timeout) {
+			std::unique_lock<std::mutex> lock(m_buffer.m_waitMutex);
+			m_buffer.m_waiters.fetch_add(1);
+			m_buffer.m_waitCv.wait_for(lock, timeout, [this] { return m_buffer.m_written.load() > m_pos; });
+			m_buffer.m_waiters.fetch_sub(1);
+		}
+	};
+
+private:
+	HANDLE m_hFile = INVALID_HANDLE_VALUE;
+	HANDLE m_hMapping = nullptr;
+	uint8_t* m_pView = nullptr;
+	uint64_t m_capacity = 0;
+	std::atomic<uint64_t> m_written = 0;  // これまでに書き込んだバイト数
+
+	std::vector<IndexEntry> m_index;  // リング
+	uint64_t m_indexCount = 0;
+	mutable std::mutex m_indexMutex;
+
+	// 追いついた Reader を書き込みで起こす。LiveStream::Subscriber と違って毎回は起こさない
+	std::mutex m_waitMutex;
+	std::condition_variable m_waitCv;
+	std::atomic<int> m_waiters = 0;
+
+	// ここからは StreamCallback のスレッドだけが触る
+	std::function<int64_t()> m_clock;
+	uint16_t m_pcrPID = 0x1FFF;
+	uint64_t m_lastPcrPos = 0;
+	int64_t m_lastIndexPcr = -1;
+
+public:
+	~TimeShiftBuffer() { Close(); }
+
+	// capacity バイトのファイルを作ってマップする。ファイルは閉じると消える
+	// MaxCapacity より大きければ MaxCapacity にする (残る時間はその分短くなる)
+	bool Open(const std::wstring& path, uint64_t capacity) {
+		Close();
+		capacity = std::min(capacity, MaxCapacity);
+		capacity -= capacity % PacketSize;
+		if (capacity <= OverrunMargin * 2) return false;
+		m_hFile = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+			FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+		if (m_hFile == INVALID_HANDLE_VALUE) return false;
+		m_hMapping = CreateFileMappingW(m_hFile, nullptr, PAGE_READWRITE,
+			static_cast<DWORD>(capacity >> 32), static_cast<DWORD>(capacity), nullptr);
+		if (m_hMapping) m_pView = static_cast<uint8_t*>(MapViewOfFile(m_hMapping, FILE_MAP_WRITE, 0, 0, static_cast<SIZE_T>(capacity)));
+		if (!m_pView) {
+			Close();
+			return false;
+		}
+		m_capacity = capacity;
+		m_written = 0;
+		{
+			std::lock_guard<std::mutex> lock(m_indexMutex);
+			// 1 秒ごとの索引が 1Mbps でも足りる数
+			m_index.assign(static_cast<size_t>(capacity / (1000 * 1000 / 8)) + 1024, IndexEntry());
+			m_indexCount = 0;
+		}
+		m_pcrPID = 0x1FFF;
+		m_lastPcrPos = 0;
+		m_lastIndexPcr = -1;
+		return true;
+	}
+
+	// StreamCallback を外してから呼ぶ
+	void Close() {
+		if (m_pView) UnmapViewOfFile(m_pView);
+		if (m_hMapping) CloseHandle(m_hMapping);
+		if (m_hFile != INVALID_HANDLE_VALUE) CloseHandle(m_hFile);
+		m_pView = nullptr;
+		m_hMapping = nullptr;
+		m_hFile = INVALID_HANDLE_VALUE;
+		m_capacity = 0;
+	}
+
+	bool IsOpen() const { return m_pView != nullptr; }
+
+	// 索引に付ける時刻 (TOT) を返すもの。StreamCallback を登録する前に設定する
+	void SetClock(std::function<int64_t()> clock) { m_clock = std::move(clock); }
+
+	// StreamCallback から 1 パケットずつ呼ぶ
+	void Write(const uint8_t* pPacket) {
+		const uint64_t pos = m_written.load(std::memory_order_relaxed);
+		if (pPacket[3] & 0x20) UpdateIndex(pPacket, pos);
+		std::memcpy(m_pView + pos % m_capacity, pPacket, PacketSize);
+		m_written.store(pos + PacketSize);
+		if ((pos + PacketSize) % NotifyInterval == 0 && m_waiters.load() > 0) {
+			// Wait が条件を確かめてから眠るまでの間に起こさないように、ロックを取ってから起こす
+			{ std::lock_guard<std::mutex> lock(m_waitMutex); }
+			m_waitCv.notify_all();
+		}
+	}
+
+	// timeMs 以前で一番新しい索引の位置から読む。relative なら最新の索引の時刻からのミリ秒
+	// 索引がまだなければ書き込み位置から
+	Reader Seek(int64_t timeMs, bool fRelative) {
+		const uint64_t oldest = GetOldest(m_written.load(std::memory_order_acquire));
+		std::lock_guard<std::mutex> lock(m_indexMutex);
+		const size_t capacity = m_index.size();
+		uint64_t first = m_indexCount > capacity ? m_indexCount - capacity : 0;
+		// 上書きされた範囲を指すものは除く
+		while (first < m_indexCount && m_index[first % capacity].Offset < oldest) first++;
+		if (first == m_indexCount) return Reader(*this, m_written.load(std::memory_order_acquire));
+
+		const int64_t target = fRelative ? m_index[(m_indexCount - 1) % capacity].TotMs + timeMs : timeMs;
+		// TotMs は増えていくので、リングの番号で二分探索する
+		uint64_t lo = first, hi = m_indexCount;
+		while (lo < hi) {
+			const uint64_t mid = lo + (hi - lo) / 2;
+			if (m_index[mid % capacity].TotMs <= target) lo = mid + 1;
+			else hi = mid;
+		}
+		const uint64_t found = lo > first ? lo - 1 : first;
+		return Reader(*this, m_index[found % capacity].Offset);
+	}
+
+	// 残っている範囲 (最古, 最新) の TOT
+	bool GetRange(int64_t& oldestMs, int64_t& newestMs) const {
+		const uint64_t oldest = GetOldest(m_written.load(std::memory_order_acquire));
+		std::lock_guard<std::mutex> lock(m_indexMutex);
+		const size_t capacity = m_index.size();
+		uint64_t first = m_indexCount > capacity ? m_indexCount - capacity : 0;
+		while (first < m_indexCount && m_index[first % capacity].Offset < oldest) first++;
+		if (first == m_indexCount) return false;
+		oldestMs = m_index[first % capacity].TotMs;
+		newestMs = m_index[(m_indexCount - 1) % capacity].TotMs;
+		return true;
+	}
+
+private:
+	uint64_t GetOldest(uint64_t written) const {
+		return written > m_capacity - OverrunMargin ? written - (m_capacity - OverrunMargin) : 0;
+	}
+
+	// 最初に見つけた PCR の PID で 1 秒ごとに索引を付ける
+	void UpdateIndex(const uint8_t* p, uint64_t pos) {
+		// adaptation_field_length >= 7 で PCR_flag
+		if (p[4] < 7 || !(p[5] & 0x10)) return;
+		const uint16_t pid = static_cast<uint16_t>(((p[1] & 0x1F) << 8) | p[2]);
+		// チャンネル変更などでその PID の PCR が来なくなったら選び直す
+		if (m_pcrPID == 0x1FFF || (pid != m_pcrPID && pos - m_lastPcrPos > OverrunMargin)) {
+			m_pcrPID = pid;
+			m_lastIndexPcr = -1;
+		}
+		if (pid != m_pcrPID) return;
+		m_lastPcrPos = pos;
+		const int64_t pcr =
+			(static_cast<int64_t>(p[6]) << 25) |
+			(static_cast<int64_t>(p[7]) << 17) |
+			(static_cast<int64_t>(p[8]) << 9) |
+			(static_cast<int64_t>(p[9]) << 1) |
+			(static_cast<int64_t>(p[10]) >> 7);
+		// 戻ったり大きく飛んだり (チャンネル変更) したときもそこで付ける
+		const int64_t elapsed = pcr - m_lastIndexPcr;
+		if (m_lastIndexPcr >= 0 && elapsed >= 0 && elapsed < IndexInterval) return;
+		m_lastIndexPcr = pcr;
+
+		IndexEntry entry = { m_clock ? m_clock() : 0, pcr, pos };
+		std::lock_guard<std::mutex> lock(m_indexMutex);
+		// TOT が戻ったときは二分探索が崩れないように前のものにそろえる
+		if (m_indexCount > 0) entry.TotMs = std::max(entry.TotMs, m_index[(m_indexCount - 1) % m_index.size()].TotMs);
+		m_index[m_indexCount++ % m_index.size()] = entry;
+	}
+};
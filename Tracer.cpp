@@ -0,0 +1,151 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <string>
+#include <set>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#if defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "StructuredWriter.cpp"
+
+// HTTPREMOCON_TRACE を 0 にするとスパンの記録をすべてコンパイル時に取り除く
+#ifndef HTTPREMOCON_TRACE
+#define HTTPREMOCON_TRACE 1
+#endif
+
+// ルートや TVTest API の呼び出しの区間 (スパン) をスレッドごとのリングに記録し、
+// Chrome のトレースイベント形式 (chrome://tracing, Perfetto) で書き出す
+class Tracer {
+public:
+	static constexpr size_t RingSize = 4096;
+
+	// スコープの間をスパンとして記録する
+	class Span {
+#if HTTPREMOCON_TRACE
+		const char* m_name;
+		uint64_t m_begin;
+	public:
+		explicit Span(const char* name) : m_name(name), m_begin(Now()) {}
+		~Span() { Record(m_name, m_begin, Now()); }
+#else
+	public:
+		explicit Span(const char*) {}
+#endif
+		Span(const Span&) = delete;
+		Span& operator=(const Span&) = delete;
+	};
+
+private:
+	struct Event {
+		const char* Name;
+		uint64_t Begin;
+		uint64_t End;
+	};
+
+	// 書き込むのは持ち主のスレッドだけ。読み出しは上書き中のものを含むことがあるが、デバッグ用なので許容する
+	struct Ring {
+		uint32_t ThreadID;
+		std::atomic<uint64_t> Head = 0;
+		Event Events[RingSize];
+	};
+
+	struct Registry {
+		std::mutex Mutex;
+		std::vector<std::unique_ptr<Ring>> Rings;
+		std::set<std::string> Names;
+		// TSC を時刻に換算するための起点
+		uint64_t OriginTicks = Now();
+		std::chrono::steady_clock::time_point OriginTime = std::chrono::steady_clock::now();
+	};
+
+	static Registry& GetRegistry() {
+		static Registry registry;
+		return registry;
+	}
+
+	static Ring& LocalRing() {
+		thread_local Ring* pRing = nullptr;
+		if (!pRing) {
+			auto& registry = GetRegistry();
+			std::lock_guard<std::mutex> lock(registry.Mutex);
+			registry.Rings.push_back(std::make_unique<Ring>());
+			pRing = registry.Rings.back().get();
+			pRing->ThreadID = static_cast<uint32_t>(registry.Rings.size());
+		}
+		return *pRing;
+	}
+
+public:
+	static uint64_t Now() {
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+		return __rdtsc();
+#else
+		return static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+	}
+
+	static void Record(const char* name, uint64_t begin, uint64_t end) {
+		auto& ring = LocalRing();
+		const uint64_t head = ring.Head.load(std::memory_order_relaxed);
+		ring.Events[head % RingSize] = { name, begin, end };
+		ring.Head.store(head + 1, std::memory_order_release);
+	}
+
+	// 実行時に作る名前 (ルートなど) は登録して、スパンより長く生きる文字列にする
+	static const char* Intern(const std::string& name) {
+		auto& registry = GetRegistry();
+		std::lock_guard<std::mutex> lock(registry.Mutex);
+		return registry.Names.insert(name).first->c_str();
+	}
+
+	// {"traceEvents":[{"name","ph":"X","ts","dur","pid","tid"}...]}
+	static std::string DumpChromeTrace() {
+		auto& registry = GetRegistry();
+		std::lock_guard<std::mutex> lock(registry.Mutex);
+
+		// 起点からの TSC と経過時間の比で換算する
+		const uint64_t ticks = Now() - registry.OriginTicks;
+		const double elapsedUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - registry.OriginTime).count();
+		const double usPerTick = ticks > 0 ? elapsedUs / ticks : 0.0;
+
+		JsonWriter w;
+		w.BeginObject();
+		w.Key("traceEvents");
+		w.BeginArray();
+		for (const auto& ring : registry.Rings) {
+			const uint64_t head = ring->Head.load(std::memory_order_acquire);
+			const uint64_t first = head > RingSize ? head - RingSize : 0;
+			for (uint64_t i = first; i < head; i++) {
+				const Event event = ring->Events[i % RingSize];
+				if (!event.Name || event.Begin < registry.OriginTicks) continue;
+				w.BeginObject();
+				w.Field("name", event.Name);
+				w.Field("ph", "X");
+				w.Field("ts", (event.Begin - registry.OriginTicks) * usPerTick);
+				w.Field("dur", (event.End - event.Begin) * usPerTick);
+				w.Field("pid", 1);
+				w.Field("tid", ring->ThreadID);
+				w.EndObject();
+			}
+		}
+		w.EndArray();
+		w.Field("displayTimeUnit", "ms");
+		w.EndObject();
+		return std::move(w.Output());
+	}
+};
+
+#if HTTPREMOCON_TRACE
+#define HTTPREMOCON_TRACE_CONCAT2(a, b) a##b
+#define HTTPREMOCON_TRACE_CONCAT(a, b) HTTPREMOCON_TRACE_CONCAT2(a, b)
+#define HTTPREMOCON_TRACE_SCOPE(name) Tracer::Span HTTPREMOCON_TRACE_CONCAT(traceSpan, __LINE__)(name)
+#else
+#define HTTPREMOCON_TRACE_SCOPE(name) ((void)0)
+#endif
@@ -0,0 +1,242 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <iterator>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+
+// StreamCallback のパケットを PID ごとに数える
+// 8192 個の PID の表を最初に確保し、パケットごとの処理は表の 1 項目を更新するだけにする。
+// 書き込むのは StreamCallback のスレッドだけで、読み出し側はロックなしで途中の値を読む
+class TsAnalyzer {
+public:
+	static constexpr size_t PidCount = 8192;
+	static constexpr uint16_t PID_NULL = 0x1FFF;
+	// ビットレートを出す窓 (秒)
+	static constexpr int Windows[] = { 1, 10, 60 };
+	static constexpr int64_t PcrClock = 27000000;
+
+	struct PcrStats {
+		uint64_t Count;
+		uint64_t Discontinuities;
+		double IntervalMaxMs;
+		double IntervalAvgMs;
+		double JitterMaxUs;  // パケット位置から見込んだ PCR とのずれ
+		double JitterAvgUs;
+	};
+
+	struct PidSnapshot {
+		uint16_t PID;
+		uint64_t Packets;
+		uint64_t CcErrors;
+		uint64_t TransportErrors;
+		uint64_t Scrambled;
+		double BitRates[std::size(Windows)];  // bps
+		PcrStats Pcr;
+	};
+
+private:
+	static constexpr int SecondSlots = 64;  // Windows の最大 + 今の秒 より大きい 2 の累乗
+
+	struct Entry {
+		std::atomic<uint64_t> Packets = 0;
+		std::atomic<uint64_t> CcErrors = 0;
+		std::atomic<uint64_t> TransportErrors = 0;
+		std::atomic<uint64_t> Scrambled = 0;
+		uint8_t LastCc = 0xFF;  // 0xFF はまだ来ていない
+
+		// 1 秒ごとのパケット数。LastSecond より古い枠は進めるときに 0 にする
+		std::atomic<int64_t> LastSecond = 0;
+		std::atomic<uint32_t> SecondCounts[SecondSlots] = {};
+
+		// PCR (27MHz)
+		int64_t LastPcr = -1;
+		uint64_t LastPcrPacket = 0;
+		double TicksPerPacket = 0;  // PCR の進みとパケット数の比の移動平均
+		std::atomic<uint64_t> PcrCount = 0;
+		std::atomic<uint64_t> PcrDiscontinuities = 0;
+		std::atomic<int64_t> PcrIntervalMax = 0;
+		std::atomic<int64_t> PcrIntervalSum = 0;
+		std::atomic<uint64_t> PcrIntervalCount = 0;
+		std::atomic<int64_t> PcrJitterMax = 0;
+		std::atomic<int64_t> PcrJitterSum = 0;
+		std::atomic<uint64_t> PcrJitterCount = 0;
+
+		// 読み出し側が参照していてもよいように、解放せずにその場で 0 にする
+		void Clear() {
+			Packets = 0;
+			CcErrors = 0;
+			TransportErrors = 0;
+			Scrambled = 0;
+			LastCc = 0xFF;
+			LastSecond = 0;
+			for (auto& count : SecondCounts) count = 0;
+			LastPcr = -1;
+			LastPcrPacket = 0;
+			TicksPerPacket = 0;
+			PcrCount = 0;
+			PcrDiscontinuities = 0;
+			PcrIntervalMax = 0;
+			PcrIntervalSum = 0;
+			PcrIntervalCount = 0;
+			PcrJitterMax = 0;
+			PcrJitterSum = 0;
+			PcrJitterCount = 0;
+		}
+	};
+
+	std::unique_ptr<Entry[]> m_entries = std::make_unique<Entry[]>(PidCount);
+	uint64_t m_packets = 0;
+	std::atomic<int64_t> m_second = 0;  // 開始からの秒
+	std::chrono::steady_clock::time_point m_start = std::chrono::steady_clock::now();
+	std::atomic<bool> m_fResetRequested = false;
+
+	// 書き込むのは 1 スレッドだけなので、load + store で足りる
+	template<class T>
+	static void Add(std::atomic<T>& cell, T n) {
+		cell.store(cell.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+	}
+	template<class T>
+	static void Max(std::atomic<T>& cell, T value) {
+		if (value > cell.load(std::memory_order_relaxed)) cell.store(value, std::memory_order_relaxed);
+	}
+
+public:
+	// StreamCallback から 1 パケットずつ呼ぶ
+	void Write(const uint8_t* p) {
+		if (m_fResetRequested.load(std::memory_order_relaxed)) ResetLocal();
+		// 時計を見るのは 1024 パケットごと
+		if ((++m_packets & 1023) == 0) {
+			m_second.store(std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - m_start).count(), std::memory_order_relaxed);
+		}
+
+		const uint16_t pid = static_cast<uint16_t>(((p[1] & 0x1F) << 8) | p[2]);
+		Entry& e = m_entries[pid];
+		Add<uint64_t>(e.Packets, 1);
+
+		const int64_t second = m_second.load(std::memory_order_relaxed);
+		const int64_t lastSecond = e.LastSecond.load(std::memory_order_relaxed);
+		if (lastSecond != second) {
+			for (int64_t s = std::max(lastSecond + 1, second - SecondSlots + 1); s <= second; s++) {
+				e.SecondCounts[s & (SecondSlots - 1)].store(0, std::memory_order_relaxed);
+			}
+			e.LastSecond.store(second, std::memory_order_relaxed);
+		}
+		Add<uint32_t>(e.SecondCounts[second & (SecondSlots - 1)], 1);
+
+		if (p[1] & 0x80) {
+			Add<uint64_t>(e.TransportErrors, 1);
+			return;
+		}
+		if (p[3] & 0xC0) Add<uint64_t>(e.Scrambled, 1);
+		if (pid == PID_NULL) return;
+
+		const bool fAdaptation = (p[3] & 0x20) && p[4] > 0;
+		// discontinuity_indicator があれば巡回カウンタも PCR も続いていない
+		if (fAdaptation && (p[5] & 0x80)) {
+			e.LastCc = 0xFF;
+			e.LastPcr = -1;
+		}
+		if (p[3] & 0x10) {
+			const uint8_t cc = p[3] & 0x0F;
+			// 同じ値は重複パケットとして許す
+			if (e.LastCc != 0xFF && cc != ((e.LastCc + 1) & 0x0F) && cc != e.LastCc) Add<uint64_t>(e.CcErrors, 1);
+			e.LastCc = cc;
+		}
+		if (fAdaptation && p[4] >= 7 && (p[5] & 0x10)) UpdatePcr(e, p);
+	}
+
+	// 次のパケットで数え直す
+	void Reset() { m_fResetRequested = true; }
+
+	// パケットが来たことのある PID だけ
+	template<class Callback>
+	void ForEach(Callback callback) const {
+		const int64_t second = m_second.load(std::memory_order_relaxed);
+		for (size_t pid = 0; pid < PidCount; pid++) {
+			const Entry& e = m_entries[pid];
+			const uint64_t packets = e.Packets.load(std::memory_order_relaxed);
+			if (packets == 0) continue;
+
+			PidSnapshot s = {};
+			s.PID = static_cast<uint16_t>(pid);
+			s.Packets = packets;
+			s.CcErrors = e.CcErrors.load(std::memory_order_relaxed);
+			s.TransportErrors = e.TransportErrors.load(std::memory_order_relaxed);
+			s.Scrambled = e.Scrambled.load(std::memory_order_relaxed);
+
+			// 今の秒は途中なので、その前の window 秒分
+			const int64_t lastSecond = e.LastSecond.load(std::memory_order_relaxed);
+			for (size_t w = 0; w < std::size(Windows); w++) {
+				uint64_t count = 0;
+				for (int64_t sec = second - Windows[w]; sec < second; sec++) {
+					if (sec < 0 || sec > lastSecond || lastSecond - sec >= SecondSlots) continue;
+					count += e.SecondCounts[sec & (SecondSlots - 1)].load(std::memory_order_relaxed);
+				}
+				const int64_t seconds = std::min<int64_t>(Windows[w], second);
+				s.BitRates[w] = seconds > 0 ? count * 188.0 * 8 / seconds : 0;
+			}
+
+			const uint64_t intervalCount = e.PcrIntervalCount.load(std::memory_order_relaxed);
+			const uint64_t jitterCount = e.PcrJitterCount.load(std::memory_order_relaxed);
+			s.Pcr.Count = e.PcrCount.load(std::memory_order_relaxed);
+			s.Pcr.Discontinuities = e.PcrDiscontinuities.load(std::memory_order_relaxed);
+			s.Pcr.IntervalMaxMs = e.PcrIntervalMax.load(std::memory_order_relaxed) * 1000.0 / PcrClock;
+			s.Pcr.IntervalAvgMs = intervalCount ? e.PcrIntervalSum.load(std::memory_order_relaxed) * 1000.0 / PcrClock / intervalCount : 0;
+			s.Pcr.JitterMaxUs = e.PcrJitterMax.load(std::memory_order_relaxed) * 1000000.0 / PcrClock;
+			s.Pcr.JitterAvgUs = jitterCount ? e.PcrJitterSum.load(std::memory_order_relaxed) * 1000000.0 / PcrClock / jitterCount : 0;
+			callback(s);
+		}
+	}
+
+	int64_t GetElapsedSeconds() const { return m_second.load(std::memory_order_relaxed); }
+
+private:
+	void UpdatePcr(Entry& e, const uint8_t* p) {
+		const int64_t base =
+			(static_cast<int64_t>(p[6]) << 25) |
+			(static_cast<int64_t>(p[7]) << 17) |
+			(static_cast<int64_t>(p[8]) << 9) |
+			(static_cast<int64_t>(p[9]) << 1) |
+			(static_cast<int64_t>(p[10]) >> 7);
+		const int64_t pcr = base * 300 + (((p[10] & 0x01) << 8) | p[11]);
+		Add<uint64_t>(e.PcrCount, 1);
+
+		const int64_t interval = pcr - e.LastPcr;
+		const uint64_t packets = m_packets - e.LastPcrPacket;
+		if (e.LastPcr >= 0 && (interval <= 0 || interval > PcrClock)) {
+			// 戻った (一周を含む) か 1 秒以上飛んだ
+			Add<uint64_t>(e.PcrDiscontinuities, 1);
+			e.TicksPerPacket = 0;
+		}
+		else if (e.LastPcr >= 0) {
+			Max(e.PcrIntervalMax, interval);
+			Add(e.PcrIntervalSum, interval);
+			Add<uint64_t>(e.PcrIntervalCount, 1);
+			const double ticksPerPacket = static_cast<double>(interval) / packets;
+			if (e.TicksPerPacket > 0) {
+				const int64_t jitter = static_cast<int64_t>(std::abs(interval - e.TicksPerPacket * packets));
+				Max(e.PcrJitterMax, jitter);
+				Add(e.PcrJitterSum, jitter);
+				Add<uint64_t>(e.PcrJitterCount, 1);
+				e.TicksPerPacket += (ticksPerPacket - e.TicksPerPacket) / 16;
+			}
+			else {
+				e.TicksPerPacket = ticksPerPacket;
+			}
+		}
+		e.LastPcr = pcr;
+		e.LastPcrPacket = m_packets;
+	}
+
+	void ResetLocal() {
+		for (size_t pid = 0; pid < PidCount; pid++) m_entries[pid].Clear();
+		m_packets = 0;
+		m_second = 0;
+		m_start = std::chrono::steady_clock::now();
+		m_fResetRequested = false;
+	}
+};
@@ -0,0 +1,137 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <array>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+
+// チャンネル変更 (ザッピング) の各段階の時刻を記録する
+// 直近のトレースをリングに残し、段階ごとのパーセンタイルを出せるようにする
+class ZapTracer {
+public:
+	enum Stage {
+		STAGE_REQUEST,         // POST /ch を受け取った
+		STAGE_SELECT_CHANNEL,  // SelectChannel から戻った
+		STAGE_CHANNEL_CHANGE,  // EVENT_CHANNELCHANGE
+		STAGE_FIRST_PACKET,    // StreamCallback に最初のパケット
+		STAGE_FIRST_PAT,       // AnalyzerFilter が最初の PAT を取得
+		STAGE_FIRST_PMT,       // AnalyzerFilter が最初の PMT を取得
+		STAGE_FIRST_TOT,
+		STAGE_FIRST_CAPTION,
+		STAGE_COUNT
+	};
+	static constexpr const char* StageNames[STAGE_COUNT] = {
+		"request",
+		"select_channel",
+		"channel_change",
+		"first_packet",
+		"first_pat",
+		"first_pmt",
+		"first_tot",
+		"first_caption",
+	};
+	static constexpr size_t Capacity = 64;
+	// これより前に始まったトレースには EVENT_CHANNELCHANGE を付けない (SelectChannel が失敗したときなど)
+	static constexpr std::chrono::seconds StaleTimeout = std::chrono::seconds(10);
+	static constexpr int64_t NotReached = -1;
+
+	struct Trace {
+		uint64_t ID = 0;
+		std::chrono::steady_clock::time_point Start;
+		std::array<int64_t, STAGE_COUNT> ElapsedUs;  // Start からの経過時間
+	};
+
+	struct Percentiles {
+		size_t Count = 0;
+		double P50Ms = 0;
+		double P90Ms = 0;
+		double P99Ms = 0;
+		double MaxMs = 0;
+	};
+
+private:
+	// 前のチャンネルのパケットで記録しないように、ストリーム側の段階は EVENT_CHANNELCHANGE の後から待つ
+	static constexpr uint32_t StreamStages =
+		(1u << STAGE_FIRST_PACKET) | (1u << STAGE_FIRST_PAT) | (1u << STAGE_FIRST_PMT) |
+		(1u << STAGE_FIRST_TOT) | (1u << STAGE_FIRST_CAPTION);
+
+	std::array<Trace, Capacity> m_ring;
+	uint64_t m_count = 0;  // これまでのトレースの数。最新は m_ring[(m_count - 1) % Capacity]
+	// まだ記録していない段階のビット。パケットごとに呼ばれる Mark はこれを見るだけで戻る
+	std::atomic<uint32_t> m_pending = 0;
+	mutable std::mutex m_mutex;
+
+	void BeginLocked(std::chrono::steady_clock::time_point now) {
+		auto& trace = m_ring[m_count % Capacity];
+		trace.ID = ++m_count;
+		trace.Start = now;
+		trace.ElapsedUs.fill(NotReached);
+	}
+
+public:
+	// POST /ch を受け取ったときに呼ぶ
+	void Begin() {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		BeginLocked(std::chrono::steady_clock::now());
+		m_ring[(m_count - 1) % Capacity].ElapsedUs[STAGE_REQUEST] = 0;
+		m_pending = (1u << STAGE_SELECT_CHANNEL) | (1u << STAGE_CHANNEL_CHANGE);
+	}
+
+	void Mark(Stage stage) {
+		const uint32_t bit = 1u << stage;
+		if (stage != STAGE_CHANNEL_CHANGE && !(m_pending.load(std::memory_order_relaxed) & bit)) return;
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		const auto now = std::chrono::steady_clock::now();
+		if (stage == STAGE_CHANNEL_CHANGE) {
+			// リモコンなど HTTP 以外からのチャンネル変更はここから始める
+			if (!(m_pending.load(std::memory_order_relaxed) & bit)
+					|| now - m_ring[(m_count - 1) % Capacity].Start > StaleTimeout) {
+				BeginLocked(now);
+				m_pending = 0;
+			}
+			m_pending |= StreamStages;
+		}
+		if (m_count == 0) return;
+		auto& trace = m_ring[(m_count - 1) % Capacity];
+		if (trace.ElapsedUs[stage] == NotReached) {
+			trace.ElapsedUs[stage] = std::chrono::duration_cast<std::chrono::microseconds>(now - trace.Start).count();
+		}
+		m_pending &= ~bit;
+	}
+
+	// 新しいものから
+	std::vector<Trace> GetTraces() const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		std::vector<Trace> traces;
+		const size_t size = static_cast<size_t>(std::min<uint64_t>(m_count, Capacity));
+		for (size_t i = 0; i < size; i++) {
+			traces.push_back(m_ring[(m_count - 1 - i) % Capacity]);
+		}
+		return traces;
+	}
+
+	// 段階ごとの、トレース開始からの時間のパーセンタイル
+	static Percentiles Calculate(const std::vector<Trace>& traces, Stage stage) {
+		std::vector<int64_t> values;
+		for (const auto& trace : traces) {
+			if (trace.ElapsedUs[stage] != NotReached) values.push_back(trace.ElapsedUs[stage]);
+		}
+		Percentiles result;
+		result.Count = values.size();
+		if (values.empty()) return result;
+		std::sort(values.begin(), values.end());
+		auto at = [&values](double p) {
+			size_t index = static_cast<size_t>(p * (values.size() - 1) + 0.5);
+			return values[index] / 1000.0;
+		};
+		result.P50Ms = at(0.50);
+		result.P90Ms = at(0.90);
+		result.P99Ms = at(0.99);
+		result.MaxMs = values.back() / 1000.0;
+		return result;
+	}
+};
@@ -0,0 +1,129 @@
+﻿#pragma once
+
+// Windows 以外で TVTestPlugin.h とハンドラをコンパイルするための Win32 の型とマクロ
+// TVTest を呼ぶ先はないので、中身のある関数は TVTestPlugin.h のインライン関数が参照するものだけ用意する
+#ifdef _WIN32
+#error "Windows では <windows.h> を使う"
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <cwchar>
+#include <string.h>
+
+typedef int BOOL;
+typedef uint8_t BYTE;
+typedef uint16_t WORD;
+typedef uint32_t DWORD;
+typedef int16_t SHORT;
+typedef int32_t LONG;
+typedef uint32_t UINT;
+typedef int64_t LONGLONG;
+typedef uint64_t ULONGLONG;
+typedef intptr_t INT_PTR;
+typedef uintptr_t UINT_PTR;
+typedef size_t SIZE_T;
+typedef intptr_t LPARAM;
+typedef uintptr_t WPARAM;
+typedef intptr_t LRESULT;
+typedef DWORD COLORREF;
+// L"" のリテラルと std::wstring をそのまま使うので wchar_t にする (Windows と違って 32 ビット)
+typedef wchar_t WCHAR;
+typedef WCHAR* LPWSTR;
+typedef const WCHAR* LPCWSTR;
+typedef LPCWSTR LPCTSTR;
+
+// ハンドルは中身を見ないので、型を区別するだけにする
+#define HTTPREMOCON_DECLARE_HANDLE(name) struct name##__ { int unused; }; typedef struct name##__* name
+HTTPREMOCON_DECLARE_HANDLE(HWND);
+HTTPREMOCON_DECLARE_HANDLE(HDC);
+HTTPREMOCON_DECLARE_HANDLE(HBITMAP);
+HTTPREMOCON_DECLARE_HANDLE(HICON);
+HTTPREMOCON_DECLARE_HANDLE(HMENU);
+HTTPREMOCON_DECLARE_HANDLE(HMONITOR);
+HTTPREMOCON_DECLARE_HANDLE(HINSTANCE);
+#undef HTTPREMOCON_DECLARE_HANDLE
+typedef void* HANDLE;
+typedef void* HGDIOBJ;
+
+#define CALLBACK
+#define __declspec(x)
+#define WINAPI
+#define TRUE 1
+#define FALSE 0
+#define MAX_PATH 260
+#define CLR_INVALID 0xFFFFFFFF
+
+#define LOWORD(l) (static_cast<WORD>(static_cast<DWORD>(l) & 0xFFFF))
+#define HIWORD(l) (static_cast<WORD>((static_cast<DWORD>(l) >> 16) & 0xFFFF))
+#define MAKELONG(a, b) (static_cast<LONG>(static_cast<WORD>(a) | (static_cast<DWORD>(static_cast<WORD>(b)) << 16)))
+#define MAKELPARAM(l, h) (static_cast<LPARAM>(static_cast<DWORD>(MAKELONG(l, h))))
+
+template<class T, size_t N> constexpr size_t _countof(T (&)[N]) { return N; }
+
+struct FILETIME {
+	DWORD dwLowDateTime;
+	DWORD dwHighDateTime;
+};
+
+struct SYSTEMTIME {
+	WORD wYear;
+	WORD wMonth;
+	WORD wDayOfWeek;
+	WORD wDay;
+	WORD wHour;
+	WORD wMinute;
+	WORD wSecond;
+	WORD wMilliseconds;
+};
+
+struct POINT {
+	LONG x;
+	LONG y;
+};
+
+struct SIZE {
+	LONG cx;
+	LONG cy;
+};
+
+struct RECT {
+	LONG left;
+	LONG top;
+	LONG right;
+	LONG bottom;
+};
+
+struct MSG {
+	HWND hwnd;
+	UINT message;
+	WPARAM wParam;
+	LPARAM lParam;
+	DWORD time;
+	POINT pt;
+};
+
+struct LOGFONTW {
+	LONG lfHeight;
+	LONG lfWidth;
+	LONG lfEscapement;
+	LONG lfOrientation;
+	LONG lfWeight;
+	BYTE lfItalic;
+	BYTE lfUnderline;
+	BYTE lfStrikeOut;
+	BYTE lfCharSet;
+	BYTE lfOutPrecision;
+	BYTE lfClipPrecision;
+	BYTE lfQuality;
+	BYTE lfPitchAndFamily;
+	WCHAR lfFaceName[32];
+};
+
+// TVTestPlugin.h のインライン関数が参照するもの
+#define CopyMemory memcpy
+inline int lstrlenW(LPCWSTR s) { return s ? static_cast<int>(wcslen(s)) : 0; }
+#define IMAGE_BITMAP 0
+#define LR_CREATEDIBSECTION 0x2000
+inline HANDLE LoadImage(HINSTANCE, LPCTSTR, UINT, int, int, UINT) { return nullptr; }
+inline BOOL DeleteObject(HGDIOBJ) { return FALSE; }
@@ -14,42 +14,38 @@
 #include <sstream>
 #include <iomanip>
 #include <algorithm>
+#include <functional>
+#include <optional>
 #include "httplib.h"
-#include "Captions.cpp"
 
+// TVTestPlugin.h を読み込むもの (TVTestApp.cpp や HttpRemoconCore.h) より先に置く
 #define TVTEST_PLUGIN_CLASS_IMPLEMENT
 #include "TVTestPlugin.h"
+#include "TVTestApp.cpp"
+#include "HttpRemoconCore.h"
+
+#include "Captions.cpp"
+#include "StringConvert.cpp"
+#include "StructuredWriter.cpp"
+#include "RequestParser.cpp"
+#include "Router.cpp"
+#include "CaptionJournal.cpp"
+#include "CaptionSearch.cpp"
+#include "CaptionExport.cpp"
+#include "Metrics.cpp"
+#include "HlsSegmenter.cpp"
+
+// [Fake] Enabled で TVTest の代わりに FakeTVTestApp を使えるようにするか
+// 負荷試験用なので、既定ではリリースのプラグインに入れない (CMake の HTTPREMOCON_FAKE_BACKEND、vcxproj は Debug だけ 1)
+#ifndef HTTPREMOCON_FAKE_BACKEND
+#define HTTPREMOCON_FAKE_BACKEND 0
+#endif
+#if HTTPREMOCON_FAKE_BACKEND
+#include "FakeTVTestApp.cpp"
+#endif
 
-static const char* defaultHost = "0.0.0.0";
-static const char* allowOrigin = "*";
-static const int defaultPort = 8080;
-static const char delimiter = ',';
-static const UINT WM_TVTP_APP = 0x8000;
-static const UINT WM_TVTP_IS_OPEN = WM_TVTP_APP + 51;
-static const UINT WM_TVTP_GET_POSITION = WM_TVTP_APP + 52;
-static const UINT WM_TVTP_GET_DURATION = WM_TVTP_APP + 53;
-static const UINT WM_TVTP_IS_PAUSED = WM_TVTP_APP + 56;
-static const UINT WM_TVTP_GET_STRETCH = WM_TVTP_APP + 58;
-static const UINT WM_TVTP_SEEK = WM_TVTP_APP + 60;
-static const UINT WM_TVTP_SEEK_ABSOLUTE = WM_TVTP_APP + 61;
-
-static void PrintChannel(std::ostringstream& output, const WCHAR* szDriver, const TVTest::ChannelInfo& ch);
-std::string MsecToTime(int msec);
-std::wstring SystemTimeToIsoString(const SYSTEMTIME& st);
-long GetTvtpPosition();
-long GetTvtpDuration();
-std::wstring GetTvtpStatus(long position, long duration);
-WORD GetTvtpStretch();
-std::wstring convertUtf8ToWstring(const std::string& utf8);
-std::string convertWstringToUtf8(const std::wstring& wstr);
-static void SimulateDropFiles(HWND hwndTarget, const std::wstring& filePath);
-static std::string WideCharToUTF8(const WCHAR* pWideChar);
-std::wstring ConvertToWString(const char* str);
-static int ParseTimeToMilliseconds(const std::string& input);
 std::filesystem::path findRecentBMPFile(const std::wstring& directory, const std::chrono::system_clock::time_point& lastSaveTime);
 std::vector<char> readFile(const std::filesystem::path& filePath);
-std::wstring EscapeJsonString(const std::wstring& input);
-std::wstring GetAribGenre(TVTest::EpgEventContentInfo& content);
 
 
 static std::wstring& trim(std::wstring& s) {
@@ -62,16 +58,30 @@ static std::wstring& trim(std::wstring& s) {
 class CHttpRemocon : public TVTest::CTVTestPlugin
 {
 	bool m_fEnabled = false;
-	httplib::Server m_server;
+	// TVTest の API だけを使うハンドラと HTTP サーバ
+	// Captions が ZapTracer を指しているので、止めた後も次に起動するまで残しておく
+	std::unique_ptr<HttpRemoconCore> m_core;
 	std::thread m_serverThread;
 	std::unique_ptr<Captions> m_captions;
+	CaptionStore m_captionStore;
+	CaptionExport m_captionExport;
+	CaptionJournal m_journal;
+	CaptionSearch m_search;
+	LiveStream m_liveStream;
+	HlsSegmenter m_hls{ m_liveStream };
+	TimeShiftBuffer m_timeShift;
+	TsAnalyzer m_tsAnalyzer;
 
 	static LRESULT CALLBACK EventCallback(UINT Event, LPARAM lParam1, LPARAM lParam2, void* pClientData);
 	static CHttpRemocon* GetThis(HWND hwnd);
 	void StartHttpServer();
+	void AddPluginRoutes();
 	void StopHttpServer();
-	std::string GetTunerList();
-	void SetChannel(const std::string& body, httplib::Response& res);
+	std::unique_ptr<Captions> CreateCaptions();
+	void QueryJournal(const httplib::Request& req, httplib::Response& res);
+	void SearchCaptions(const httplib::Request& req, httplib::Response& res);
+	void StreamLive(const httplib::Request& req, httplib::Response& res);
+	void WriteTsStats(StructuredWriter& w);
 
 public:
 	bool GetPluginInfo(TVTest::PluginInfo* pInfo) override;
@@ -93,7 +103,6 @@ bool CHttpRemocon::GetPluginInfo(TVTest::PluginInfo* pInfo)
 bool CHttpRemocon::Initialize()
 {
 	// 初期化処理
-
 	// イベントコールバック関数を登録
 	m_pApp->SetEventCallback(EventCallback, this);
 
@@ -108,6 +117,7 @@ bool CHttpRemocon::Finalize()
 		StopHttpServer();
 		m_pApp->SetStreamCallback(TVTest::STREAM_CALLBACK_REMOVE, m_captions->StreamCallback, nullptr);
 		m_captions.reset();
+		m_timeShift.Close();
 	}
 
 	return true;
@@ -121,738 +131,505 @@ void CHttpRemocon::StartHttpServer()
 		return;  // サーバがすでに起動中の場合は何もしない
 	}
 
-	m_serverThread = std::thread([this]() {
-		m_server.Post("/", [this](const httplib::Request& req, httplib::Response& res) {
-			if (req.body == "close") {
-				m_pApp->SetDriverName(nullptr);
-				res.status = 200;
-			}
-			else if (req.body == "sleep") {
-				// レスポンスを返すためスリープ処理を別スレッドで実行
-				std::thread([this]() {
-					m_pApp->SetDriverName(nullptr);
-
-					// 画面オフにならずモダンスタンバイになるらしい
-					SendNotifyMessage(HWND_BROADCAST, WM_SYSCOMMAND, SC_MONITORPOWER, 2);
-					}).detach();
-
-				res.status = 200;
-			}
-			else {
-				res.status = 400;
-				res.set_content("Invalid operation value", "text/plain");
-			}
-			});
-
-		m_server.Post("/play", [this](const httplib::Request& req, httplib::Response& res) {
-			std::wstring filePath = convertUtf8ToWstring(req.body);
-
-			// /tvtpipe はすでにあるものとみなす
-			if (!m_pApp->SetDriverName(L"BonDriver_Pipe.dll")) {
-				res.status = 500;
-				res.set_content("Failed SetDriverName", "text/plain");
-				return;
-			}
-			// ServiceId が正常に 0 なのにエラー発生が返る。エラーチェックはしない
-			m_pApp->SetChannel(0, 0);
-
-			// ドラッグアンドドロップとしてファイルを開く
-			HWND hwndDnd = FindWindowW(L"TVTest Window", NULL);
-			if (!hwndDnd) {
-				res.status = 500;
-				res.set_content("Failed FindWindow", "text/plain");
-				return;
-			}
-
-			SimulateDropFiles(hwndDnd, filePath);
-
-			HWND hwndFrame = FindWindowW(L"TvtPlay Frame", NULL);
-			int retry = 0;
-			while (!SendMessage(hwndFrame, WM_TVTP_IS_OPEN, 0, 0)) {
-				retry++;
-				if (retry > 5) {
-					res.status = 500;
-					res.set_content("Failed Open", "text/plain");
-					return;
-				}
-				Sleep(500);
-			}
-
-			res.status = 200;
-			});
-
-		m_server.Get("/play/pause", [this](const httplib::Request& req, httplib::Response& res) {
-			HWND hwnd = FindWindowW(L"TvtPlay Frame", NULL);
-			if (hwnd == NULL) {
-				res.status = 500;
-				res.set_content("Failed FindWindow: TvtPlay Frame", "text/plain");
-				return;
-			}
-
-			bool paused = SendMessage(hwnd, WM_TVTP_IS_PAUSED, 0, 0);
-			res.status = 200;
-			res.set_content(std::to_string(paused), "text/plain");
-			});
-
-		m_server.Post("/play/pause", [this](const httplib::Request& req, httplib::Response& res) {
-			// トグルしかできないので body は見ない
-			if (!m_pApp->DoCommand(L"tvtplay.tvtp:Pause")) {
-				res.status = 500;
-				res.set_content("Failed DoCommand: tvtplay.tvtp:Pause", "text/plain");
-				return;
-			}
-			res.status = 200;
-			});
-
-		m_server.Get("/play/pos", [this](const httplib::Request& req, httplib::Response& res) {
-			auto pos = GetTvtpPosition();
-			if (pos < 0) {
-				res.status = 500;
-				res.set_content("Failed FindWindow: TvtPlay Frame", "text/plain");
-				return;
-			}
-			res.set_content(MsecToTime(pos), "text/plain");
-			res.status = 200;
-			});
-
-		m_server.Post("/play/pos", [this](const httplib::Request& req, httplib::Response& res) {
-			HWND hwnd = FindWindowW(L"TvtPlay Frame", NULL);
-			if (hwnd == NULL) {
-				res.status = 500;
-				res.set_content("Failed FindWindow: TvtPlay Frame", "text/plain");
-				return;
-			}
+	ServerConfig config = ServerConfig::Load(ServerConfig::GetIniPath(g_hinstDLL));
+	std::unique_ptr<ITVTestApp> app;
+	std::unique_ptr<ITvtPlay> tvtPlay;
+#if HTTPREMOCON_FAKE_BACKEND
+	if (config.FakeBackend) {
+		// 負荷試験用: TVTest と TvtPlay を呼ばずに作り物のチャンネルと番組表を返す
+		CreateFakeBackend(config, app, tvtPlay);
+	}
+#else
+	if (config.FakeBackend) {
+		OutputDebugStringW(L"HttpRemocon: [Fake] Enabled is ignored (built without HTTPREMOCON_FAKE_BACKEND)\n");
+	}
+#endif
+	if (!app) {
+		app = std::make_unique<TVTestAppAdapter>(m_pApp);
+		tvtPlay = std::make_unique<TvtPlayWindow>();
+	}
+	m_core = std::make_unique<HttpRemoconCore>(std::move(app), std::move(tvtPlay), config);
+	m_core->SetTotSource([this] { return m_captions ? m_captions->GetTOTTime() : std::string(); });
+	m_core->Start(ServerConfig::GetPluginDirectory(g_hinstDLL));
+
+	// ストリームコールバックより先に開いておく (CreateCaptions で渡す)
+	if (config.TimeShiftMinutes > 0 && !m_timeShift.IsOpen()) {
+		std::wstring path = config.TimeShiftFile;
+		if (path.empty()) {
+			WCHAR szTemp[MAX_PATH] = {};
+			GetTempPathW(_countof(szTemp), szTemp);
+			path = std::wstring(szTemp) + L"HttpRemoconTimeShift.ts";
+		}
+		const uint64_t capacity = static_cast<uint64_t>(config.TimeShiftMinutes) * 60 * config.TimeShiftBitRate * 1000 * 1000 / 8;
+		m_timeShift.Open(path, capacity);
+	}
 
-			const auto& command = req.body;
-			char sign = command[0] == '-' || command[0] == '+';
-			int msec = ParseTimeToMilliseconds(sign ? command.substr(1) : command);
+	if (config.CaptionJournal) {
+		auto directory = config.CaptionJournalDirectory.empty()
+			? ServerConfig::GetPluginDirectory(g_hinstDLL) + L"Captions"
+			: config.CaptionJournalDirectory;
+		if (m_journal.Open(directory)) {
+			m_search.Build(m_journal);
+		}
+	}
 
-			if (sign || command.find(':') == std::string::npos) {
-				msec = command[0] == '-' ? -msec : msec;
-				SendMessage(hwnd, WM_TVTP_SEEK, 0, (LPARAM)msec);
-			}
-			else {
-				SendMessage(hwnd, WM_TVTP_SEEK_ABSOLUTE, 0, (LPARAM)msec);
-			}
+	m_liveStream.Open();
 
-			// 現在時刻への反映に時間がかかるので返すのはやめる
-			res.status = 200;
-			});
+	m_serverThread = std::thread([this]() {
+		m_core->Listen([this] { AddPluginRoutes(); });
+		});
+}
 
-		m_server.Get("/play/speed", [this](const httplib::Request& req, httplib::Response& res) {
-			auto stretch = GetTvtpStretch();
-			if (stretch < 0) {
-				res.status = 500;
-				res.set_content("Failed FindWindow: TvtPlay Frame", "text/plain");
-				return;
-			}
-			res.set_content(std::to_string(stretch), "text/plain");
+// TS を受け取るもの (字幕やライブ配信) と、Win32 の API を使うもののルート
+void CHttpRemocon::AddPluginRoutes()
+{
+	m_core->Post("/", [this](const httplib::Request& req, httplib::Response& res) {
+		if (req.body == "close") {
+			m_core->CallApi(HttpRemoconCore::API_SET_DRIVER_NAME, [&] { return m_core->GetApp().SetDriverName(nullptr); });
 			res.status = 200;
-			});
-
-		m_server.Post("/play/speed", [this](const httplib::Request& req, httplib::Response& res) {
-			// TvtPlay を見てもあんまり柔軟なことはできなそう
-			std::wstring command = L"tvtplay.tvtp:Stretch";
-			if (req.body.length() == 1 && 'A' <= req.body[0] && req.body[0] <= 'Z') {
-				command += req.body[0];
-			}
+		}
+		else if (req.body == "sleep") {
+			// レスポンスを返すためスリープ処理を別スレッドで実行
+			std::thread([this]() {
+				m_core->CallApi(HttpRemoconCore::API_SET_DRIVER_NAME, [&] { return m_core->GetApp().SetDriverName(nullptr); });
 
-			if (!m_pApp->DoCommand(command.c_str())) {
-				res.status = 500;
-				std::string error_message = "Failed DoCommand: " + convertWstringToUtf8(command);
-				res.set_content(error_message, "text/plain");
-				return;
-			}
+				// 画面オフにならずモダンスタンバイになるらしい
+				SendNotifyMessage(HWND_BROADCAST, WM_SYSCOMMAND, SC_MONITORPOWER, 2);
+				}).detach();
 
 			res.status = 200;
-			});
-
-		m_server.Get("/vol", [this](const httplib::Request& req, httplib::Response& res) {
-			int vol = m_pApp->GetVolume();
-			res.set_content(std::to_string(vol), "text/plain");
-			res.status = 200;
-			});
-
-		m_server.Post("/vol", [this](const httplib::Request& req, httplib::Response& res) {
-			int volumeChange = std::stoi(req.body);
-			int currentVolume = m_pApp->GetVolume();
-
-			if (req.body[0] == '+' || req.body[0] == '-') {
-				// 相対値として設定
-				currentVolume += volumeChange;
-			}
-			else {
-				// 絶対値として設定
-				currentVolume = volumeChange;
-			}
+		}
+		else {
+			res.status = 400;
+			res.set_content("Invalid operation value", "text/plain");
+		}
+		});
 
-			// 音量が範囲内に収まるように制限
-			if (currentVolume < 0) currentVolume = 0;
-			if (currentVolume > 100) currentVolume = 100;
+	m_core->Get("/live.ts", [this](const httplib::Request& req, httplib::Response& res) {
+		StreamLive(req, res);
+		});
 
-			if (!m_pApp->SetVolume(currentVolume)) {
-				res.status = 500;
-				res.set_content("Failed SetVolume", "text/plain");
-				return;
-			}
-			res.set_content(std::to_string(currentVolume), "text/plain");
+	// タイムシフトで戻れる範囲 (UNIX 時間のミリ秒)
+	m_core->Get("/timeshift", [this](const httplib::Request& req, httplib::Response& res) {
+		int64_t oldestMs = 0, newestMs = 0;
+		if (!m_timeShift.IsOpen() || !m_timeShift.GetRange(oldestMs, newestMs)) {
+			res.status = 404;
+			res.set_content("Time-shift buffer is empty or disabled", "text/plain");
+			return;
+		}
+		auto writer = StructuredWriter::Create(req.get_header_value("Accept"));
+		writer->BeginObject();
+		writer->Field("oldest_ms", oldestMs);
+		writer->Field("newest_ms", newestMs);
+		writer->EndObject();
+		res.set_content(writer->Output(), writer->ContentType());
+		res.status = 200;
+		});
 
-			res.status = 200;
-			});
+	// ブラウザ向け。視聴中のサービスを HLS で流す
+	m_core->Get("/live/index.m3u8", [this](const httplib::Request& req, httplib::Response& res) {
+		m_hls.Touch();
+		res.set_header("Cache-Control", "no-cache");
+		res.set_content(m_hls.GetM3u8(), "application/vnd.apple.mpegurl");
+		res.status = 200;
+		});
 
-		m_server.Get("/ch", [this](const httplib::Request& req, httplib::Response& res) {
-			res.set_content(GetTunerList(), "text/plain");
-			res.status = 200;
+	m_core->Get("/live/{seq}.ts", [this](const httplib::Request& req, httplib::Response& res, const Router::Params& params) {
+		m_hls.Touch();
+		uint64_t seq = 0;
+		auto segment = RequestParser::ParseInt(params[0], seq) ? m_hls.GetSegment(seq) : nullptr;
+		if (!segment) {
+			res.status = 404;
+			res.set_content("Segment not found", "text/plain");
+			return;
+		}
+		// セグメントは書き換えないので、コピーせずにそのまま送る
+		res.set_header("Cache-Control", "max-age=60, immutable");
+		res.set_content_provider(segment->size(), "video/mp2t",
+			[segment](size_t offset, size_t length, httplib::DataSink& sink) {
+				return sink.write(reinterpret_cast<const char*>(segment->data()) + offset, length);
 			});
+		res.status = 200;
+		});
 
-		m_server.Post("/ch", [this](const httplib::Request& req, httplib::Response& res) {
-			SetChannel(req.body, res);
-			});
+	m_core->Get("/ts/stats", [this](const httplib::Request& req, httplib::Response& res) {
+		auto writer = StructuredWriter::Create(req.get_header_value("Accept"));
+		WriteTsStats(*writer);
+		res.set_content(writer->Output(), writer->ContentType());
+		res.status = 200;
+		});
 
-		m_server.Get("/rec", [this](const httplib::Request& req, httplib::Response& res) {
-			TVTest::RecordStatusInfo status = {};
-			m_pApp->GetRecordStatus(&status);
+	m_core->Delete("/ts/stats", [this](const httplib::Request& req, httplib::Response& res) {
+		m_tsAnalyzer.Reset();
+		res.status = 200;
+		});
 
+	m_core->Get("/captions", [this](const httplib::Request& req, httplib::Response& res) {
+		// 過去の字幕はジャーナルから引く
+		if (req.has_param("event") || req.has_param("from") || req.has_param("to")) {
+			QueryJournal(req, res);
+			return;
+		}
+		// Accept で構造化した形式を指定されたら、タイムスタンプ付きで 1 字幕ずつ返す
+		auto accept = req.get_header_value("Accept");
+		if (StructuredWriter::IsRequested(accept)) {
+			auto writer = StructuredWriter::Create(accept);
+			writer->BeginArray();
+			m_captionStore.ForEach(0, [&writer](size_t, const CaptionStore::Caption& caption) {
+				if (caption.Flags & CaptionStore::FLAG_MARKER) return;
+				writer->BeginObject();
+				if (caption.Pts != CaptionStore::NoPts) writer->Field("pts", caption.Pts);
+				else writer->NullField("pts");
+				writer->Field("tot_ms", caption.TotMs);
+				writer->Field("service_id", caption.ServiceID);
+				writer->Field("event_id", caption.EventID);
+				writer->Field("text", convertWstringToUtf8(std::wstring(caption.Text)));
+				writer->EndObject();
+				});
+			writer->EndArray();
+			res.set_content(writer->Output(), writer->ContentType());
 			res.status = 200;
-			switch (status.Status) {
-			case TVTest::RECORD_STATUS_NOTRECORDING:
-				res.set_content("Not recording", "text/plain");
-				return;
+			return;
+		}
+		auto caption = convertWstringToUtf8(m_captionStore.GetText());
+		res.set_content(caption, "text/plain; charset=utf-8");
+		res.status = 200;
+		});
 
-			case TVTest::RECORD_STATUS_RECORDING:
-				res.set_content("Recording", "text/plain");
-				return;
+	m_core->Get("/captions.vtt", [this](const httplib::Request& req, httplib::Response& res) {
+		m_captionExport.Update(m_captionStore);
+		res.set_content(m_captionExport.GetVtt(), "text/vtt; charset=utf-8");
+		res.status = 200;
+		});
 
-			case TVTest::RECORD_STATUS_PAUSED:
-				res.set_content("Paused", "text/plain");
-				return;
+	m_core->Get("/captions.srt", [this](const httplib::Request& req, httplib::Response& res) {
+		m_captionExport.Update(m_captionStore);
+		res.set_content(m_captionExport.GetSrt(), "application/x-subrip; charset=utf-8");
+		res.status = 200;
+		});
 
-			default:
-				res.status = 500;
-				res.set_content("Invalid status", "text/plain");
-				return;
-			}
-			});
+	m_core->Get("/captions/search", [this](const httplib::Request& req, httplib::Response& res) {
+		SearchCaptions(req, res);
+		});
 
-		m_server.Post("/rec", [this](const httplib::Request& req, httplib::Response& res) {
-			TVTest::RecordStatusInfo status = {};
+	m_core->Delete("/captions", [this](const httplib::Request& req, httplib::Response& res) {
+		m_captionStore.Clear();
+		res.status = 200;
+		});
 
-			if (req.body == "start") {
-				m_pApp->GetRecordStatus(&status);
-				if (status.Status == TVTest::RECORD_STATUS_RECORDING) {
-					res.status = 400;
-					res.set_content("Already start recording", "text/plain");
-					return;
-				}
+	m_core->Post("/view/cap", [this](const httplib::Request& req, httplib::Response& res) {
+		std::future<std::vector<char>> futureResult = std::async(std::launch::async,
+			[this, &res]() {
+				// たぶん保存したキャプチャのファイル名がわからない。
+				// ファイルのタイムスタンプで頑張って探す。
+				// CaptureImageをした後にSaveImageは時間差ができるのでダメだった
+				auto saveStartTime = std::chrono::system_clock::now();
 
-				if (!m_pApp->DoCommand(L"TimeShiftRecording")) {
+				auto saved = m_core->CallApi(HttpRemoconCore::API_SAVE_IMAGE, [&] { return m_core->GetApp().SaveImage(); });
+				if (!saved) {
 					res.status = 500;
-					res.set_content("Failed DoCommand: TimeShiftRecording", "text/plain");
-					return;
+					res.set_content("Failed SaveImage", "text/plain");
+					return std::vector<char>{};
 				}
 
-				if (!m_pApp->DoCommand(L"RecordEvent")) {
+				// 相対パスの場合、あきらめる
+				WCHAR szFolder[MAX_PATH] = {};
+				if (m_core->CallApi(HttpRemoconCore::API_GET_SETTING, [&] { return m_core->GetApp().GetSetting(L"CaptureFolder", szFolder, MAX_PATH); }) < 1) {
 					res.status = 500;
-					res.set_content("Failed DoCommand: RecordEvent", "text/plain");
-					return;
+					res.set_content("Failed GetSetting; CaptureFolder", "text/plain");
+					return std::vector<char>{};
 				}
 
-				// 録画ファイル名を取得
-				WCHAR fileName[MAX_PATH] = {};
-				status.pszFileName = fileName;
-				status.MaxFileName = MAX_PATH;
-				m_pApp->GetRecordStatus(&status);
-
-				res.set_content(WideCharToUTF8(fileName), "text/plain");
-				res.status = 200;
-			}
-			else if (req.body == "stop") {
-
-				// 録画ファイル名を取得
-				WCHAR fileName[MAX_PATH] = {};
-				status.pszFileName = fileName;
-				status.MaxFileName = MAX_PATH;
-				m_pApp->GetRecordStatus(&status);
-
-				if (status.Status != TVTest::RECORD_STATUS_RECORDING) {
-					res.status = 400;
-					res.set_content("Not yet started recording", "text/plain");
-					return;
-				}
-
-				if (!m_pApp->StopRecord()) {
+				auto bmpFilePath = findRecentBMPFile(std::wstring(szFolder), saveStartTime);
+				if (bmpFilePath.empty()) {
 					res.status = 500;
-					res.set_content("Failed StopRecord", "text/plain");
-					return;
-				}
-
-				res.set_content(WideCharToUTF8(fileName), "text/plain");
-				res.status = 200;
-			}
-			else {
-				res.status = 400;
-				res.set_content("Invalid operation value", "text/plain");
-			}
-			});
-
-		m_server.Get("/captions", [this](const httplib::Request& req, httplib::Response& res) {
-			auto caption = convertWstringToUtf8(m_captions->GetStockedCaptions());
-			res.set_content(caption, "text/plain; charset=utf-8");
-			res.status = 200;
-			});
-
-		m_server.Delete("/captions", [this](const httplib::Request& req, httplib::Response& res) {
-			m_captions->ClearStockedCaptions();
-			res.status = 200;
-			});
-
-		m_server.Post("/view/cap", [this](const httplib::Request& req, httplib::Response& res) {
-			std::future<std::vector<char>> futureResult = std::async(std::launch::async,
-				[this, &res]() {
-					// たぶん保存したキャプチャのファイル名がわからない。
-					// ファイルのタイムスタンプで頑張って探す。
-					// CaptureImageをした後にSaveImageは時間差ができるのでダメだった
-					auto saveStartTime = std::chrono::system_clock::now();
-
-					auto saved = m_pApp->SaveImage();
-					if (!saved) {
-						res.status = 500;
-						res.set_content("Failed SaveImage", "text/plain");
-						return std::vector<char>{};
-					}
-
-					// 相対パスの場合、あきらめる
-					WCHAR szFolder[MAX_PATH] = {};
-					if (m_pApp->GetSetting(L"CaptureFolder", szFolder, MAX_PATH) < 1) {
-						res.status = 500;
-						res.set_content("Failed GetSetting; CaptureFolder", "text/plain");
-						return std::vector<char>{};
-					}
-
-					auto bmpFilePath = findRecentBMPFile(std::wstring(szFolder), saveStartTime);
-					if (bmpFilePath.empty()) {
-						res.status = 500;
-						res.set_content("Invalid bmp file path", "text/plain");
-						return std::vector<char>{};
-					}
-
-					auto bmpData = readFile(bmpFilePath);
-					if (bmpData.empty()) {
-						res.status = 500;
-						res.set_content("Failed to read bmp file", "text/plain");
-						return std::vector<char>{};
-					}
-
-					return bmpData;
-				});
-			auto bmpData = futureResult.get();
-			if (bmpData.empty()) return;
-			res.set_content(bmpData.data(), bmpData.size(), "image/bmp");
-			res.status = 200;
-			});
-
-		m_server.Post("/view/panel", [this](const httplib::Request& req, httplib::Response& res) {
-			// トグルしかできないので body は見ない
-			if (!m_pApp->DoCommand(L"Panel")) {
-				res.status = 500;
-				res.set_content("Failed DoCommand: Panel", "text/plain");
-				return;
-			}
-
-			res.status = 200;
-			});
-
-		m_server.Post("/view/reset", [this](const httplib::Request& req, httplib::Response& res) {
-			TVTest::ResetFlag flag = std::stoi(req.body);
-			if (!m_pApp->Reset(flag)) {
-				res.status = 500;
-				res.set_content("Failed Reset", "text/plain");
-				return;
-			}
-
-			res.status = 200;
-			});
-
-		m_server.Post("/view/rebuild", [this](const httplib::Request& req, httplib::Response& res) {
-			if (!m_pApp->DoCommand(L"RebuildViewer")) {
-				res.status = 500;
-				res.set_content("Failed Rebuild", "text/plain");
-				return;
-			}
-
-			res.status = 200;
-			});
-
-		m_server.Get("/status", [this](const httplib::Request& req, httplib::Response& res) {
-			std::wstringstream wss;
-			wss << "{";
-
-			// 録画中
-			{
-				TVTest::RecordStatusInfo info = {};
-				if (m_pApp->GetRecordStatus(&info)) {
-					wss << "\"record_status\":" << info.Status << ",";
-					wss << "\"record_time\":" << info.RecordTime << ",";
-				}
-			}
-
-			// チャンネル
-			{
-				TVTest::ChannelInfo info = {};
-				if (m_pApp->GetCurrentChannelInfo(&info) && info.szChannelName && info.szChannelName[0] != '\0') {
-					wss << "\"channel_name\":\"" << EscapeJsonString(info.szChannelName) << "\",";
+					res.set_content("Invalid bmp file path", "text/plain");
+					return std::vector<char>{};
 				}
-			}
 
-			// 今の番組
-			{
-				static constexpr int maxEventName = 1000;
-				static constexpr int maxEventText = 10000;
-				static constexpr int maxEventExtText = 10000;
-				WCHAR eventName[maxEventName] = {};
-				WCHAR eventText[maxEventText] = {};
-				WCHAR eventExtText[maxEventExtText] = {};
-				TVTest::ProgramInfo info = {};
-				info.MaxEventName = maxEventName;
-				info.pszEventName = eventName;
-				info.MaxEventText = maxEventText;
-				info.pszEventText = eventText;
-				info.MaxEventExtText = maxEventExtText;
-				info.pszEventExtText = eventExtText;
-				if (m_pApp->GetCurrentProgramInfo(&info) && info.pszEventName && info.pszEventName[0] != '\0') {
-					wss << "\"current_event_id\":" << info.EventID << ",";
-					wss << "\"current_event_service_id\":" << info.ServiceID << ",";
-					wss << "\"current_event_name\":\"" << EscapeJsonString(info.pszEventName) << "\",";
-					wss << "\"current_event_start_time\":\"" << SystemTimeToIsoString(info.StartTime) << "\",";
-					wss << "\"current_event_text\":\"" << EscapeJsonString(info.pszEventText) << "\",";
-					wss << "\"current_event_ext_text\":\"" << EscapeJsonString(info.pszEventExtText) << "\",";
-					wss << "\"current_event_duration\":" << info.Duration << ",";
-					TVTest::ChannelInfo ChInfo;
-					if (m_pApp->GetCurrentChannelInfo(&ChInfo)) {
-						TVTest::EpgEventQueryInfo QueryInfo;
-						QueryInfo.NetworkID = ChInfo.NetworkID;
-						QueryInfo.TransportStreamID = ChInfo.TransportStreamID;
-						QueryInfo.ServiceID = info.ServiceID;
-						QueryInfo.EventID = info.EventID;
-						QueryInfo.Type = TVTest::EPG_EVENT_QUERY_EVENTID;
-						QueryInfo.Flags = TVTest::EPG_EVENT_QUERY_FLAG_NONE;
-						TVTest::EpgEventInfo* pEvent = m_pApp->GetEpgEventInfo(&QueryInfo);
-						if (pEvent != nullptr) {
-							wss << "\"current_content_nibble_level1\":" << pEvent->ContentList->ContentNibbleLevel1<< ",";
-							wss << "\"current_content_nibble_level2\":" << pEvent->ContentList->ContentNibbleLevel2 << ",";
-							wss << "\"current_content_nibble\":\"" << GetAribGenre(*pEvent->ContentList) << "\",";
-							m_pApp->FreeEpgEventInfo(pEvent);
-						}
-						else {
-							wss << "\"current_content_nibble_level1\":null,";
-							wss << "\"current_content_nibble_level2\":null,";
-							wss << "\"current_content_nibble\":null,";
-						}
-					}
-				}
-			}
-
-			// 次の番組
-			{
-				static constexpr int maxEventName = 1000;
-				static constexpr int maxEventText = 10000;
-				static constexpr int maxEventExtText = 10000;
-				WCHAR eventName[maxEventName] = {};
-				WCHAR eventText[maxEventText] = {};
-				WCHAR eventExtText[maxEventExtText] = {};
-				TVTest::ProgramInfo info = {};
-				info.MaxEventName = maxEventName;
-				info.pszEventName = eventName;
-				info.MaxEventText = maxEventText;
-				info.pszEventText = eventText;
-				info.MaxEventExtText = maxEventExtText;
-				info.pszEventExtText = eventExtText;
-				if (m_pApp->GetCurrentProgramInfo(&info, true) && info.pszEventName && info.pszEventName[0] != '\0') {
-					wss << "\"next_event_id\":" << info.EventID << ",";
-					wss << "\"next_event_service_id\":" << info.ServiceID << ",";
-					wss << "\"next_event_name\":\"" << EscapeJsonString(info.pszEventName) << "\",";
-					wss << "\"next_event_start_time\":\"" << SystemTimeToIsoString(info.StartTime) << "\",";
-					wss << "\"next_event_text\":\"" << EscapeJsonString(info.pszEventText) << "\",";
-					wss << "\"next_event_ext_text\":\"" << EscapeJsonString(info.pszEventExtText) << "\",";
-					wss << "\"next_event_duration\":" << info.Duration << ",";
-				}
-			}
-
-			// 信号
-			{
-				TVTest::StatusInfo status = {};
-				if (m_pApp->GetStatus(&status)) {
-					wss << "\"signal_level\":" << status.SignalLevel << ",";
-					wss << "\"drop\":" << status.DropPacketCount << ",";
-					wss << "\"error\":" << status.ErrorPacketCount << ",";
-					wss << "\"scramble\":" << status.ScramblePacketCount << ",";
-					wss << "\"bit_rate\":" << status.BitRate << ",";
-				}
-			}
-
-			// TVTPlay
-			HWND hwndFrame = FindWindowW(L"TvtPlay Frame", NULL);
-			if (hwndFrame) {
-				auto elapsed = GetTvtpPosition();
-				if (elapsed >= 0) {
-					wss << "\"elapsed_time\":\"" << convertUtf8ToWstring(MsecToTime(elapsed)) << "\",";
-					wss << "\"elapsed_ms\":" << elapsed << ",";
-				}
-				auto total = GetTvtpDuration();
-				if (total >= 0) {
-					wss << "\"total_time\":\"" << convertUtf8ToWstring(MsecToTime(total)) << "\",";
-					wss << "\"total_ms\":" << total << ",";
-				}
-				auto status = GetTvtpStatus(elapsed, total);
-				wss << "\"play_status\":\"" << status << "\",";
-				auto speed = GetTvtpStretch();
-				wss << "\"speed\":" << speed << ",";
-			}
-
-			// TOT
-			{
-				auto tot = m_captions->GetTOTTime();
-				if (!tot.empty()) {
-					wss << "\"tot\":\"" << convertUtf8ToWstring(tot) << "\",";
+				auto bmpData = readFile(bmpFilePath);
+				if (bmpData.empty()) {
+					res.status = 500;
+					res.set_content("Failed to read bmp file", "text/plain");
+					return std::vector<char>{};
 				}
-			}
-
-			wss << "\"volume\":" << m_pApp->GetVolume();
-			wss << "}";
 
-			res.set_content(convertWstringToUtf8(wss.str()), "application/json");
-			res.status = 200;
-			});
-
-		m_server.set_exception_handler([](const auto& req, auto& res, std::exception_ptr ep) {
-			try {
-				std::rethrow_exception(ep);
-			}
-			catch (std::exception& e) {
-				const char* a = e.what();
-				auto w = ConvertToWString(a);
-				res.set_content(convertWstringToUtf8(w), "text/plain");
-			}
-			catch (...) {
-				res.set_content("Unknown Exception", "text/plain");
-			}
-			res.status = 500;
+				return bmpData;
 			});
-
-		m_server.Get("/", [](const auto& req, auto& res) {
-			res.set_file_content("Plugins/HttpRemoconCli.html");
-			});
-		m_server.set_file_extension_and_mimetype_mapping("html", "text/html");
-		m_server.set_default_headers({
-			{ "Access-Control-Allow-Origin", allowOrigin },
-			});
-		m_server.listen(defaultHost, defaultPort);
+		auto bmpData = futureResult.get();
+		if (bmpData.empty()) return;
+		res.set_content(bmpData.data(), bmpData.size(), "image/bmp");
+		res.status = 200;
 		});
 }
 
-std::string MsecToTime(int msec) {
-	int total_sec = msec / 1000;
-	int s = total_sec % 60;
-	int m = (total_sec / 60) % 60;
-	int h = total_sec / 3600;
-
-	std::ostringstream oss;
-	if (h > 0) oss << h << ":";
-	oss << std::setw(2) << std::setfill('0') << m << ":"
-		<< std::setw(2) << std::setfill('0') << s;
-	return oss.str();
-}
 
-std::wstring SystemTimeToIsoString(const SYSTEMTIME& st) {
-	wchar_t dateBuffer[std::size("yyyy-MM-dd")];
-	wchar_t timeBuffer[std::size("hh:mm:ss")];
+// 確定した字幕はジャーナルにも書いておく
+std::unique_ptr<Captions> CHttpRemocon::CreateCaptions()
+{
+	auto result = std::make_unique<Captions>(m_captionStore,
+		[this](int64_t totMs, uint16_t serviceID, uint16_t eventID, const std::wstring& text) {
+			m_captionExport.Update(m_captionStore);
+			auto utf8 = convertWstringToUtf8(text);
+			auto index = m_journal.Append(totMs, serviceID, eventID, utf8);
+			if (index >= 0) m_search.Add(index, utf8);
+		});
+	result->SetZapTracer(&m_core->GetZapTracer());
+	result->SetLiveStream(&m_liveStream);
+	if (m_timeShift.IsOpen()) result->SetTimeShift(&m_timeShift);
+	result->SetTsAnalyzer(&m_tsAnalyzer);
+	TVTest::ChannelInfo info = {};
+	if (m_core->CallApi(HttpRemoconCore::API_GET_CURRENT_CHANNEL_INFO, [&] { return m_core->GetApp().GetCurrentChannelInfo(&info); })) {
+		result->SetServiceID(info.ServiceID);
+		m_hls.SetServiceID(info.ServiceID);
+	}
+	return result;
+}
 
-	int dateResult = GetDateFormatEx(LOCALE_NAME_USER_DEFAULT, 0, &st, L"yyyy-MM-dd", std::data(dateBuffer), std::size(dateBuffer), nullptr);
-	int timeResult = GetTimeFormatEx(LOCALE_NAME_USER_DEFAULT, 0, &st, L"HH':'mm':'ss", std::data(timeBuffer), std::size(timeBuffer));
 
-	if (dateResult == 0 && timeResult == 0) {
-		return std::wstring();
-	}
+// ジャーナルから過去の字幕を返す
+// ?event=(&service=) で番組、?from=&to= (UNIX 時間) で期間を指定する
+void CHttpRemocon::QueryJournal(const httplib::Request& req, httplib::Response& res)
+{
+	if (!m_journal.IsOpen()) {
+		res.status = 404;
+		res.set_content("Caption journal is disabled", "text/plain");
+		return;
+	}
+
+	// Record の文字列はマップしたビューを指しているので、コールバックの中で書き出す
+	auto accept = req.get_header_value("Accept");
+	std::unique_ptr<StructuredWriter> writer;
+	if (StructuredWriter::IsRequested(accept)) {
+		writer = StructuredWriter::Create(accept);
+		writer->BeginArray();
+	}
+	std::string text;
+	auto callback = [&writer, &text](const CaptionJournal::Record& record) {
+		if (writer) {
+			writer->BeginObject();
+			writer->Field("tot_ms", record.TotMs);
+			writer->Field("service_id", record.ServiceID);
+			writer->Field("event_id", record.EventID);
+			writer->Field("text", record.Text);
+			writer->EndObject();
+		}
+		else {
+			text.append(record.Text);
+		}
+		};
 
-	std::wostringstream oss;
-	if (dateResult != 0) {
-		oss << std::wstring(dateBuffer).c_str();
-	}
-	if (dateResult != 0 && timeResult != 0) {
-		oss << L'T';
-	}
-	if (timeResult != 0) {
-		oss << std::wstring(timeBuffer).c_str();
+	if (req.has_param("event")) {
+		WORD serviceID = 0;
+		WORD eventID = 0;
+		if (req.has_param("service")) {
+			if (!RequestParser::ParseInt(req.get_param_value("service"), serviceID)) {
+				res.status = 400;
+				res.set_content("Invalid service", "text/plain");
+				return;
+			}
+		}
+		else {
+			TVTest::ChannelInfo info = {};
+			if (m_core->CallApi(HttpRemoconCore::API_GET_CURRENT_CHANNEL_INFO, [&] { return m_core->GetApp().GetCurrentChannelInfo(&info); })) serviceID = info.ServiceID;
+		}
+		if (!RequestParser::ParseInt(req.get_param_value("event"), eventID)) {
+			res.status = 400;
+			res.set_content("Invalid event", "text/plain");
+			return;
+		}
+		m_journal.QueryByEvent(serviceID, eventID, callback);
 	}
-	if (dateResult != 0 && timeResult != 0) {
-		oss << L"+09:00";
+	else {
+		long long from = 0;
+		long long to = std::numeric_limits<long long>::max() / 1000;
+		if ((req.has_param("from") && !RequestParser::ParseSeconds(req.get_param_value("from"), from))
+			|| (req.has_param("to") && !RequestParser::ParseSeconds(req.get_param_value("to"), to))) {
+			res.status = 400;
+			res.set_content("Invalid query value", "text/plain");
+			return;
+		}
+		m_journal.QueryByTime(from * 1000, to * 1000, callback);
 	}
 
-	return oss.str();
-}
-
-long GetTvtpPosition() {
-	HWND hwnd = FindWindowW(L"TvtPlay Frame", NULL);
-	if (hwnd == NULL) {
-		return -1;
+	if (writer) {
+		writer->EndArray();
+		res.set_content(writer->Output(), writer->ContentType());
 	}
-
-	return SendMessage(hwnd, WM_TVTP_GET_POSITION, 0, 0);
-}
-
-long GetTvtpDuration() {
-	HWND hwnd = FindWindowW(L"TvtPlay Frame", NULL);
-	if (hwnd == NULL) {
-		return -1;
+	else {
+		res.set_content(text, "text/plain; charset=utf-8");
 	}
-
-	return SendMessage(hwnd, WM_TVTP_GET_DURATION, 0, 0);
+	res.status = 200;
 }
 
-std::wstring GetTvtpStatus(long position, long duration) {
-	if (position == -1) {
-		return std::wstring();
-	}
-	if (position >= duration || (position == 0 && duration == 0)) {
-		return L"finished";
-	}
 
-	HWND hwnd = FindWindowW(L"TvtPlay Frame", NULL);
-	if (hwnd == NULL) {
-		return std::wstring();
+// 字幕の全文検索。TvtPlay でシークできるように TOT を返す
+void CHttpRemocon::SearchCaptions(const httplib::Request& req, httplib::Response& res)
+{
+	if (!m_journal.IsOpen()) {
+		res.status = 404;
+		res.set_content("Caption journal is disabled", "text/plain");
+		return;
 	}
-	auto isPaused = SendMessage(hwnd, WM_TVTP_IS_PAUSED, 0, 0) == 1;
-	return isPaused ? L"paused" : L"playing";
-}
 
-WORD GetTvtpStretch() {
-	HWND hwnd = FindWindowW(L"TvtPlay Frame", NULL);
-	if (hwnd == NULL) {
-		return -1;
+	auto query = req.get_param_value("q");
+	if (convertUtf8ToWstring(query).size() < CaptionSearch::MinQueryLength) {
+		res.status = 400;
+		res.set_content("Query must be at least 2 characters", "text/plain");
+		return;
 	}
-	return HIWORD(SendMessage(hwnd, WM_TVTP_GET_STRETCH, 0, 0));
+	size_t limit = 100;
+	if (req.has_param("limit") && !RequestParser::ParseInt(req.get_param_value("limit"), limit)) {
+		res.status = 400;
+		res.set_content("Invalid limit value", "text/plain");
+		return;
+	}
+
+	auto writer = StructuredWriter::Create(req.get_header_value("Accept"));
+	writer->BeginArray();
+	m_search.Search(m_journal, query, limit, [&writer](const CaptionJournal::Record& record) {
+		writer->BeginObject();
+		writer->Field("tot_ms", record.TotMs);
+		writer->Field("service_id", record.ServiceID);
+		writer->Field("event_id", record.EventID);
+		writer->Field("text", record.Text);
+		writer->EndObject();
+		});
+	writer->EndArray();
+	res.set_content(writer->Output(), writer->ContentType());
+	res.status = 200;
 }
 
-void PrintChannel(std::ostringstream& output, const WCHAR* szDriver, const TVTest::ChannelInfo& ch) {
-	std::string sDriver = WideCharToUTF8(szDriver);
-	std::string sChannelName = WideCharToUTF8(ch.szChannelName);
 
-	output << sDriver << delimiter
-		<< ch.Space << delimiter
-		<< ch.Channel << delimiter
-		<< ch.ServiceID << ": "
-		<< sChannelName << "\n";
-}
-
-// チューナー/チャンネルのリストを取得する
-std::string CHttpRemocon::GetTunerList()
+// PID ごとの統計。チャンネル変更か DELETE /ts/stats からの値
+void CHttpRemocon::WriteTsStats(StructuredWriter& w)
 {
-	std::ostringstream tunerList;
-	WCHAR szDriver[MAX_PATH];
-
-	{
-		TVTest::ChannelInfo ch;
-		m_pApp->GetCurrentChannelInfo(&ch);
-		m_pApp->GetDriverName(szDriver, _countof(szDriver));
-		PrintChannel(tunerList, szDriver, ch);
-		tunerList << "\n";
-	}
-	{
-		for (int i = 0; m_pApp->EnumDriver(i, szDriver, _countof(szDriver)) > 0; i++) {
-			TVTest::DriverTuningSpaceList spaces;
-			if (m_pApp->GetDriverTuningSpaceList(szDriver, &spaces)) {
-				for (DWORD j = 0; j < spaces.NumSpaces; j++) {
-					const TVTest::DriverTuningSpaceInfo& chs = *spaces.SpaceList[j];
-					for (DWORD k = 0; k < chs.NumChannels; k++) {
-						const TVTest::ChannelInfo& ch = *chs.ChannelList[k];
-						if (!(ch.Flags & TVTest::CHANNEL_FLAG_DISABLED)) {
-							PrintChannel(tunerList, szDriver, ch);
-						}
-					}
-				}
-
-				m_pApp->FreeDriverTuningSpaceList(&spaces);
-			}
+	static constexpr const char* bitRateNames[] = { "bit_rate_1s", "bit_rate_10s", "bit_rate_60s" };
+	static_assert(std::size(bitRateNames) == std::size(TsAnalyzer::Windows));
+
+	w.BeginObject();
+	w.Field("elapsed", m_tsAnalyzer.GetElapsedSeconds());
+	w.Key("pids");
+	w.BeginArray();
+	m_tsAnalyzer.ForEach([&w](const TsAnalyzer::PidSnapshot& s) {
+		w.BeginObject();
+		w.Field("pid", s.PID);
+		w.Field("packets", s.Packets);
+		w.Field("cc_errors", s.CcErrors);
+		w.Field("transport_errors", s.TransportErrors);
+		w.Field("scrambled", s.Scrambled);
+		for (size_t i = 0; i < std::size(bitRateNames); i++) w.Field(bitRateNames[i], s.BitRates[i]);
+		if (s.Pcr.Count > 0) {
+			w.Key("pcr");
+			w.BeginObject();
+			w.Field("count", s.Pcr.Count);
+			w.Field("discontinuities", s.Pcr.Discontinuities);
+			w.Field("interval_max_ms", s.Pcr.IntervalMaxMs);
+			w.Field("interval_avg_ms", s.Pcr.IntervalAvgMs);
+			w.Field("jitter_max_us", s.Pcr.JitterMaxUs);
+			w.Field("jitter_avg_us", s.Pcr.JitterAvgUs);
+			w.EndObject();
 		}
-	}
-
-	return tunerList.str();
+		w.EndObject();
+		});
+	w.EndArray();
+	w.EndObject();
 }
 
 
-void CHttpRemocon::SetChannel(const std::string& body, httplib::Response& res) {
-	TVTest::ChannelSelectInfo info = {};
-	info.Size = sizeof(info);
-	info.pszTuner = nullptr;
-	info.Space = -1;
-	info.Channel = -1;
-	info.ServiceID = 0;
-
-	// req.body は "pszTuner,Channel,ServiceID" の形式
-	std::istringstream iss(body);
-	std::string tuner, space, channelStr, serviceIdStr;
-	std::wstring wTuner;
-
-	if (std::getline(iss, tuner, delimiter) && std::getline(iss, space, delimiter) && std::getline(iss, channelStr, delimiter) && std::getline(iss, serviceIdStr)) {
-		if (!tuner.empty()) {
-			wTuner = std::wstring(tuner.begin(), tuner.end());
-			info.pszTuner = wTuner.c_str();
+// 受信中の TS をそのまま流す。?sid= を付けるとそのサービスだけにする
+// ?at=-300s (最新から 5 分前) や ?at=<UNIX 時間> でタイムシフトのバッファから流す
+// 接続している間はサーバのスレッドを 1 つ使うので、[Concurrency] の /live.ts で数を抑える
+void CHttpRemocon::StreamLive(const httplib::Request& req, httplib::Response& res)
+{
+	// どちらか一方から読む
+	struct State {
+		std::optional<LiveStream::Subscriber> Subscriber;
+		std::optional<TimeShiftBuffer::Reader> TimeShift;
+		std::vector<uint8_t> Input;   // タイムシフトのバッファからコピーしたもの
+		std::unique_ptr<ServiceRemux> Remux;
+		std::vector<uint8_t> Output;  // 絞り込んだパケット。クライアントごとに使い回す
+		std::shared_ptr<RouteLimiter::Permit> Permit = RouteLimiter::Hold();  // 接続が終わるまで上限に数える
+	};
+	auto state = std::make_shared<State>();
+	if (req.has_param("sid")) {
+		uint16_t sid;
+		if (!RequestParser::ParseInt(req.get_param_value("sid"), sid)) {
+			res.status = 400;
+			res.set_content("Invalid parameter", "text/plain");
+			return;
 		}
-
-		if (!channelStr.empty()) {
-			try {
-				info.Channel = std::stoi(channelStr);
-			}
-			catch (const std::invalid_argument&) {
-				res.status = 400;
-				res.set_content("Invalid Channel value", "text/plain");
-				return;
-			}
+		state->Remux = std::make_unique<ServiceRemux>(sid);
+	}
+	if (req.has_param("at")) {
+		if (!m_timeShift.IsOpen()) {
+			res.status = 404;
+			res.set_content("Time-shift buffer is disabled", "text/plain");
+			return;
 		}
-
-		if (!space.empty()) {
-			try {
-				info.Space = std::stoi(space);
-			}
-			catch (const std::invalid_argument&) {
-				res.status = 400;
-				res.set_content("Invalid Space value", "text/plain");
-				return;
-			}
+		long long at;
+		if (!RequestParser::ParseTimeShiftAt(req.get_param_value("at"), at)) {
+			res.status = 400;
+			res.set_content("Invalid parameter", "text/plain");
+			return;
 		}
-
-		if (!serviceIdStr.empty()) {
-			try {
-				info.ServiceID = std::stoi(serviceIdStr);
+		state->TimeShift = at < 0 ? m_timeShift.Seek(at * 1000, true) : m_timeShift.Seek(at * 1000, false);
+	}
+	if (!state->TimeShift) state->Subscriber.emplace(m_liveStream);
+
+	res.set_header("Cache-Control", "no-store");
+	res.set_chunked_content_provider("video/mp2t",
+		[this, state](size_t offset, httplib::DataSink& sink) {
+			// ?sid= のときは絞り込んでから書く
+			std::shared_ptr<const ServiceMap> services;
+			if (state->Remux) {
+				services = m_liveStream.GetServiceMap();
+				state->Output.clear();
+			}
+			auto write = [&](const uint8_t* data, size_t size) {
+				if (state->Remux) {
+					if (services) state->Remux->Process(*services, data, size, state->Output);
+					return true;
+				}
+				if (!sink.write(reinterpret_cast<const char*>(data), size)) return false;
+				Metrics::Add(Metrics::COUNTER_LIVE_BYTES, size);
+				return true;
+				};
+
+			if (state->TimeShift) {
+				state->TimeShift->Read(state->Input);
+				if (state->Input.empty()) {
+					// 最新まで追いついたので書き込みを待つ。サーバを止めたときに抜けられるように、待つのは短くする
+					state->TimeShift->Wait(std::chrono::milliseconds(500));
+					return m_core->IsRunning();
+				}
+				if (!write(state->Input.data(), state->Input.size())) return false;
 			}
-			catch (const std::invalid_argument&) {
-				res.status = 400;
-				res.set_content("Invalid ServiceID value", "text/plain");
-				return;
+			else {
+				// サーバを止めたときに抜けられるように、待つのは短くする
+				auto chunks = state->Subscriber->Read(std::chrono::milliseconds(500));
+				if (!chunks) return false;
+				for (const auto& chunk : *chunks) {
+					if (!write(chunk->data(), chunk->size())) return false;
+				}
 			}
-		}
 
-		// チャンネル選択
-		if (!m_pApp->SelectChannel(&info)) {
-			res.status = 500;
-			res.set_content("Failed SelectChannel", "text/plain");
-			return;
-		}
-
-		res.status = 200;
-	}
-	else {
-		// パースエラー
-		res.status = 400;
-		res.set_content("Invalid request format", "text/plain");
-	}
+			auto& output = state->Output;
+			if (output.empty()) return true;
+			if (!sink.write(reinterpret_cast<const char*>(output.data()), output.size())) return false;
+			Metrics::Add(Metrics::COUNTER_LIVE_BYTES, output.size());
+			return true;
+		});
+	res.status = 200;
 }
 
 
 void CHttpRemocon::StopHttpServer()
 {
-	if (m_server.is_running()) {
-		m_server.stop();
+	m_liveStream.Close();  // 配信中のクライアントを終わらせる
+	m_hls.Stop();
+	if (m_core) {
+		m_core->Stop();
 	}
 	if (m_serverThread.joinable()) {
 		m_serverThread.join();  // サーバスレッドの終了を待機
@@ -873,34 +650,55 @@ LRESULT CALLBACK CHttpRemocon::EventCallback(UINT Event, LPARAM lParam1, LPARAM
 			pThis->StartHttpServer();
 
 			// チャンネル名を追加して初期化
+			pThis->m_captionStore.Clear();
 			TVTest::ChannelInfo info = {};
-			std::wstring channel;
 			if (pThis->m_pApp->GetCurrentChannelInfo(&info) && info.szChannelName && info.szChannelName[0] != '\0') {
-				channel = info.szChannelName;
-				pThis->m_captions = std::make_unique<Captions>(L"-- " + channel + L" --\n\n");
+				pThis->m_captionStore.AddMarker(L"-- " + std::wstring(info.szChannelName) + L" --\n\n");
 			}
-			pThis->m_captions = std::make_unique<Captions>();
+			pThis->m_captions = pThis->CreateCaptions();
 			pThis->m_pApp->SetStreamCallback(0, pThis->m_captions->StreamCallback, pThis->m_captions.get());
 		}
 		else {
 			pThis->StopHttpServer();
 			pThis->m_pApp->SetStreamCallback(TVTest::STREAM_CALLBACK_REMOVE, pThis->m_captions->StreamCallback, nullptr);
 			pThis->m_captions.reset();
+			pThis->m_timeShift.Close();
 		}
 		return TRUE;
 
+	case TVTest::EVENT_EVENTINFOCHANGED:
+		// 番組情報が更新されたのでジャンルなどを取り直す
+		if (pThis->m_core) pThis->m_core->GetEpgCache().Clear();
+		return 0;
+
+	case TVTest::EVENT_SERVICECHANGE:
+		// ジャーナルに記録するサービスIDと HLS で流すサービスを切り替える
+		if (pThis->m_captions) {
+			TVTest::ChannelInfo info = {};
+			if (pThis->m_pApp->GetCurrentChannelInfo(&info)) {
+				pThis->m_captions->SetServiceID(info.ServiceID);
+				pThis->m_hls.SetServiceID(info.ServiceID);
+			}
+		}
+		return 0;
+
 	case TVTest::EVENT_CHANNELCHANGE:
-		pThis->m_pApp->SetStreamCallback(TVTest::STREAM_CALLBACK_REMOVE, pThis->m_captions->StreamCallback, nullptr);
-		std::wstring prevCaptions = pThis->m_captions->GetStockedCaptions();
+		if (!pThis->m_captions) return 0;
 
-		// チャンネル名を追加して初期化
+		// チャンネル名を追加 (これまでの字幕はストアに残る)
 		TVTest::ChannelInfo info = {};
 		std::wstring channel;
 		if (pThis->m_pApp->GetCurrentChannelInfo(&info) && info.szChannelName && info.szChannelName[0] != '\0') {
 			channel = info.szChannelName;
 		}
-		pThis->m_captions = std::make_unique<Captions>(prevCaptions + L"\n-- " + channel + L" --\n");
-		pThis->m_pApp->SetStreamCallback(0, pThis->m_captions->StreamCallback, pThis->m_captions.get());
+		pThis->m_captionStore.AddMarker(L"\n-- " + channel + L" --\n");
+
+		// フィルタグラフは作り直さずに状態だけ初期化する。ストリームコールバックも登録したまま
+		pThis->m_captions->Reset();
+		pThis->m_captions->SetServiceID(info.ServiceID);
+		pThis->m_hls.SetServiceID(info.ServiceID);
+		pThis->m_tsAnalyzer.Reset();
+		pThis->m_core->GetZapTracer().Mark(ZapTracer::STAGE_CHANNEL_CHANGE);
 	}
 
 	return 0;
@@ -918,123 +716,6 @@ TVTest::CTVTestPlugin* CreatePluginClass()
 	return new CHttpRemocon;
 }
 
-// UTF-8 から UTF-16 への変換
-std::wstring convertUtf8ToWstring(const std::string& utf8) {
-	int wideCharSize = MultiByteToWideChar(CP_UTF8, 0, utf8.c_str(), -1, nullptr, 0);
-	if (wideCharSize == 0) {
-		throw std::runtime_error("Failed to convert UTF-8 to UTF-16");
-	}
-
-	std::wstring wstr(wideCharSize, L'\0');
-	MultiByteToWideChar(CP_UTF8, 0, utf8.c_str(), -1, &wstr[0], wideCharSize);
-	wstr.resize(wideCharSize - 1);  // 末尾のヌル文字（'\0'）を除去
-	return wstr;
-}
-
-// UTF-16 から UTF-8 への変換
-std::string convertWstringToUtf8(const std::wstring& wstr) {
-	int utf8Size = WideCharToMultiByte(CP_UTF8, 0, wstr.c_str(), -1, nullptr, 0, nullptr, nullptr);
-	if (utf8Size == 0) {
-		throw std::runtime_error("Failed to convert UTF-16 to UTF-8");
-	}
-
-	std::string utf8(utf8Size, '\0');
-	WideCharToMultiByte(CP_UTF8, 0, wstr.c_str(), -1, &utf8[0], utf8Size, nullptr, nullptr);
-	utf8.resize(utf8Size - 1);  // 末尾のヌル文字（'\0'）を除去
-	return utf8;
-}
-
-// ファイルのドラッグアンドドロップをシミュレートする関数
-void SimulateDropFiles(HWND hwndTarget, const std::wstring& filePath)
-{
-	// ドロップするファイルのリストを準備
-	DROPFILES dropFiles = { 0 };
-	dropFiles.pFiles = sizeof(DROPFILES);  // ファイルリストのオフセット
-	dropFiles.fNC = TRUE;                  // 非クライアントエリアのフラグ
-	dropFiles.pt.x = 0;                    // ドロップ位置（相対座標）
-	dropFiles.pt.y = 0;
-	dropFiles.fWide = TRUE;
-
-	// ファイルパスを二重終端で準備（必要な形式）
-	size_t filePathSize = (filePath.length() + 1) * sizeof(wchar_t);
-	size_t totalSize = sizeof(DROPFILES) + filePathSize;
-
-	// メモリを確保
-	HGLOBAL hGlobal = GlobalAlloc(GHND, totalSize);
-	if (hGlobal) {
-		// メモリをロックしてアクセス可能にする
-		BYTE* pData = (BYTE*)GlobalLock(hGlobal);
-		if (pData) {
-			// DROPFILES構造体をコピー
-			memcpy(pData, &dropFiles, sizeof(DROPFILES));
-
-			// ファイルパスをコピー（DROPFILES構造体の直後に）
-			memcpy(pData + sizeof(DROPFILES), filePath.c_str(), filePathSize);
-
-			// メモリをアンロック
-			GlobalUnlock(hGlobal);
-
-			// ターゲットウィンドウにWM_DROPFILESメッセージを送信
-			PostMessage(hwndTarget, WM_DROPFILES, (WPARAM)hGlobal, 0);
-		}
-		else {
-			// メモリのロックに失敗した場合
-			GlobalFree(hGlobal);
-		}
-	}
-}
-
-std::wstring ConvertToWString(const char* str) {
-	// 文字列の長さを取得します。
-	int len = MultiByteToWideChar(CP_ACP, 0, str, -1, nullptr, 0);
-	if (len == 0) {
-		// エラー処理（必要に応じて追加）
-		return L"";
-	}
-
-	// wchar_tバッファを確保します。
-	std::wstring wstr(len - 1, L'\0'); // 終端文字分を引く
-	MultiByteToWideChar(CP_ACP, 0, str, -1, &wstr[0], len);
-
-	return wstr;
-}
-
-std::string WideCharToUTF8(const WCHAR* pWideChar)
-{
-	int len = WideCharToMultiByte(CP_UTF8, 0, pWideChar, -1, nullptr, 0, nullptr, nullptr);
-	if (len == 0) {
-		return "";
-	}
-	std::string utf8Str(len - 1, '\0'); // 終端文字分を引く
-	WideCharToMultiByte(CP_UTF8, 0, pWideChar, -1, &utf8Str[0], len, nullptr, nullptr);
-	return utf8Str;
-}
-
-int ParseTimeToMilliseconds(const std::string& input) {
-	int hours = 0, minutes = 0, seconds = 0;
-	char _;
-
-	std::istringstream iss(input);
-	auto count = std::count(input.begin(), input.end(), ':');
-	if (count == 0) {
-		// 秒のみの場合 (例: "1")
-		iss >> seconds;
-	}
-	else if (count == 1) {
-		// 分:秒 の場合 (例: "0:10")
-		iss >> minutes >> _ >> seconds;
-	}
-	else if (count == 2) {
-		// 時:分:秒 の場合 (例: "1:00:00")
-		iss >> hours >> _ >> minutes >> _ >> seconds;
-	}
-	else {
-		throw std::invalid_argument("Invalid time format");
-	}
-
-	return (hours * 3600 + minutes * 60 + seconds) * 1000;
-}
-
 #ifdef _DEBUG
 static void debugPrintFileTime(const wchar_t* label, const FILETIME& fileTime) {
 	SYSTEMTIME systemTime;
@@ -1109,205 +790,3 @@ std::vector<char> readFile(const std::filesystem::path& filePath) {
 
 	return buffer;
 }
-
-std::wstring EscapeJsonString(const std::wstring& input)
-{
-	std::wstring output;
-	for (wchar_t ch : input)
-	{
-		switch (ch)
-		{
-		case L'"':  output += L"\\\""; break;
-		case L'\\': output += L"\\\\"; break;
-		case L'/':  output += L"\\/";  break;
-		case L'\b': output += L"\\b";  break;
-		case L'\f': output += L"\\f";  break;
-		case L'\n': output += L"\\n";  break;
-		case L'\r': output += L"\\r";  break;
-		case L'\t': output += L"\\t";  break;
-		default:
-			if (ch < 0x20) {
-				wchar_t buf[7];
-				swprintf(buf, 7, L"\\u%04x", ch);
-				output += buf;
-			}
-			else {
-				output += ch;
-			}
-			break;
-		}
-	}
-	return output;
-}
-
-std::wstring GetAribGenre(TVTest::EpgEventContentInfo& content)
-{
-	switch (content.ContentNibbleLevel1)
-	{
-	case 0x0: // ニュース／報道
-		switch (content.ContentNibbleLevel2)
-		{
-		case 0x0: return L"ニュース／報道 - 定時・総合";
-		case 0x1: return L"ニュース／報道 - 天気";
-		case 0x2: return L"ニュース／報道 - 特集・ドキュメント";
-		case 0x3: return L"ニュース／報道 - 政治・国会";
-		case 0x4: return L"ニュース／報道 - 経済・市況";
-		case 0x5: return L"ニュース／報道 - 海外・国際";
-		case 0x6: return L"ニュース／報道 - 解説";
-		case 0x7: return L"ニュース／報道 - 討論・会談";
-		case 0x8: return L"ニュース／報道 - 報道特番";
-		case 0x9: return L"ニュース／報道 - ローカル・地域";
-		case 0xA: return L"ニュース／報道 - 交通";
-		default: return L"ニュース／報道 - その他";
-		}
-
-	case 0x1: // スポーツ
-		switch (content.ContentNibbleLevel2)
-		{
-		case 0x0: return L"スポーツ - スポーツニュース";
-		case 0x1: return L"スポーツ - 野球";
-		case 0x2: return L"スポーツ - サッカー";
-		case 0x3: return L"スポーツ - ゴルフ";
-		case 0x4: return L"スポーツ - その他の球技";
-		case 0x5: return L"スポーツ - 相撲・格闘技";
-		case 0x6: return L"スポーツ - 国際大会";
-		case 0x7: return L"スポーツ - 陸上・マラソン";
-		case 0x8: return L"スポーツ - モータースポーツ";
-		case 0x9: return L"スポーツ - マリン・ウィンタースポーツ";
-		case 0xA: return L"スポーツ - 競馬・公営競技";
-		default: return L"スポーツ - その他";
-		}
-
-	case 0x2: // 情報／ワイドショー
-		switch (content.ContentNibbleLevel2)
-		{
-		case 0x0: return L"情報／ワイドショー - 芸能・ワイドショー";
-		case 0x1: return L"情報／ワイドショー - ファッション";
-		case 0x2: return L"情報／ワイドショー - 暮らし・住まい";
-		case 0x3: return L"情報／ワイドショー - 健康・医療";
-		case 0x4: return L"情報／ワイドショー - ショッピング・通販";
-		case 0x5: return L"情報／ワイドショー - グルメ・料理";
-		case 0x6: return L"情報／ワイドショー - イベント";
-		case 0x7: return L"情報／ワイドショー - 番組紹介・お知らせ";
-		default: return L"情報／ワイドショー - その他";
-		}
-
-	case 0x3: // ドラマ
-		switch (content.ContentNibbleLevel2)
-		{
-		case 0x0: return L"ドラマ - 国内ドラマ";
-		case 0x1: return L"ドラマ - 海外ドラマ";
-		case 0x2: return L"ドラマ - 時代劇";
-		default: return L"ドラマ - その他";
-		}
-
-	case 0x4: // 音楽
-		switch (content.ContentNibbleLevel2)
-		{
-		case 0x0: return L"音楽 - 国内ロック・ポップス";
-		case 0x1: return L"音楽 - 海外ロック・ポップス";
-		case 0x2: return L"音楽 - クラシック・オペラ";
-		case 0x3: return L"音楽 - ジャズ・フュージョン";
-		case 0x4: return L"音楽 - 歌謡曲・演歌";
-		case 0x5: return L"音楽 - ライブ・コンサート";
-		case 0x6: return L"音楽 - ランキング・リクエスト";
-		case 0x7: return L"音楽 - カラオケ・のど自慢";
-		case 0x8: return L"音楽 - 民謡・邦楽";
-		case 0x9: return L"音楽 - 童謡・キッズ";
-		case 0xA: return L"音楽 - 民族音楽・ワールドミュージック";
-		default: return L"音楽 - その他";
-		}
-
-	case 0x5: // バラエティ
-		switch (content.ContentNibbleLevel2)
-		{
-		case 0x0: return L"バラエティ - クイズ";
-		case 0x1: return L"バラエティ - ゲーム";
-		case 0x2: return L"バラエティ - トークバラエティ";
-		case 0x3: return L"バラエティ - お笑い・コメディ";
-		case 0x4: return L"バラエティ - 音楽バラエティ";
-		case 0x5: return L"バラエティ - 旅バラエティ";
-		case 0x6: return L"バラエティ - 料理バラエティ";
-		default: return L"バラエティ - その他";
-		}
-
-	case 0x6: // 映画
-		switch (content.ContentNibbleLevel2)
-		{
-		case 0x0: return L"映画 - 洋画";
-		case 0x1: return L"映画 - 邦画";
-		case 0x2: return L"映画 - アニメ";
-		default: return L"映画 - その他";
-		}
-
-	case 0x7: // アニメ／特撮
-		switch (content.ContentNibbleLevel2)
-		{
-		case 0x0: return L"アニメ／特撮 - 国内アニメ";
-		case 0x1: return L"アニメ／特撮 - 海外アニメ";
-		case 0x2: return L"アニメ／特撮 - 特撮";
-		default: return L"アニメ／特撮 - その他";
-		}
-
-	case 0x8: // ドキュメンタリー／教養
-		switch (content.ContentNibbleLevel2)
-		{
-		case 0x0: return L"ドキュメンタリー／教養 - 社会・時事";
-		case 0x1: return L"ドキュメンタリー／教養 - 歴史・紀行";
-		case 0x2: return L"ドキュメンタリー／教養 - 自然・動物・環境";
-		case 0x3: return L"ドキュメンタリー／教養 - 宇宙・科学・医学";
-		case 0x4: return L"ドキュメンタリー／教養 - カルチャー・伝統文化";
-		case 0x5: return L"ドキュメンタリー／教養 - 文学・文芸";
-		case 0x6: return L"ドキュメンタリー／教養 - スポーツ";
-		case 0x7: return L"ドキュメンタリー／教養 - ドキュメンタリー全般";
-		case 0x8: return L"ドキュメンタリー／教養 - インタビュー・討論";
-		default: return L"ドキュメンタリー／教養 - その他";
-		}
-
-	case 0x9: // 劇場／公演
-		switch (content.ContentNibbleLevel2)
-		{
-		case 0x0: return L"劇場／公演 - 現代劇・新劇";
-		case 0x1: return L"劇場／公演 - ミュージカル";
-		case 0x2: return L"劇場／公演 - ダンス・バレエ";
-		case 0x3: return L"劇場／公演 - 落語・演芸";
-		case 0x4: return L"劇場／公演 - 歌舞伎・古典";
-		default: return L"劇場／公演 - その他";
-		}
-
-	case 0xA: // 趣味／教育
-		switch (content.ContentNibbleLevel2)
-		{
-		case 0x0: return L"趣味／教育 - 旅・釣り・アウトドア";
-		case 0x1: return L"趣味／教育 - 園芸・ペット・手芸";
-		case 0x2: return L"趣味／教育 - 音楽・美術・工芸";
-		case 0x3: return L"趣味／教育 - 囲碁・将棋";
-		case 0x4: return L"趣味／教育 - 麻雀・パチンコ";
-		case 0x5: return L"趣味／教育 - 車・オートバイ";
-		case 0x6: return L"趣味／教育 - コンピュータ・TVゲーム";
-		case 0x7: return L"趣味／教育 - 会話・語学";
-		case 0x8: return L"趣味／教育 - 幼児・小学生";
-		case 0x9: return L"趣味／教育 - 中学生・高校生";
-		case 0xA: return L"趣味／教育 - 大学生・受験";
-		case 0xB: return L"趣味／教育 - 生涯教育・資格";
-		case 0xC: return L"趣味／教育 - 教育問題";
-		default: return L"趣味／教育 - その他";
-		}
-
-	case 0xB: // 福祉
-		switch (content.ContentNibbleLevel2)
-		{
-		case 0x0: return L"福祉 - 高齢者";
-		case 0x1: return L"福祉 - 障害者";
-		case 0x2: return L"福祉 - 社会福祉";
-		case 0x3: return L"福祉 - ボランティア";
-		case 0x4: return L"福祉 - 手話";
-		case 0x5: return L"福祉 - 文字（字幕）";
-		case 0x6: return L"福祉 - 音声解説";
-		default: return L"福祉 - その他";
-		}
-
-	default:
-		return L"その他";
-	}
-}
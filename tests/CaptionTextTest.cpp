@@ -0,0 +1,111 @@
+﻿// CaptionText::Compact を以前の OnCaption の実装 (erase/replace を繰り返すもの) と乱数の入力で突き合わせる
+// LibISDB なしでビルドできる。引数でシードと回数を指定できる: CaptionTextTest [seed] [iterations]
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+#include "../CaptionText.cpp"
+
+namespace {
+
+// ARIBStringDecoder::FormatInfo の代わり
+struct Format {
+	size_t Pos;
+	bool fSmall;
+};
+
+// 以前の OnCaption の実装をそのまま写したもの
+// Buff は NUL で終わる文字列から作っていたので、入力に NUL は含めない
+std::wstring CompactOld(const wchar_t* pText, const std::vector<Format>& formats, bool fIgnoreSmall, bool fContinue) {
+	std::wstring Buff = pText;
+	if (fIgnoreSmall) {
+		for (int i = static_cast<int>(formats.size()) - 1; i >= 0; i--) {
+			if (formats[i].fSmall) {
+				size_t Pos = formats[i].Pos;
+				if (Pos < Buff.length()) {
+					if (i + 1 < static_cast<int>(formats.size())) {
+						size_t NextPos = std::min(Buff.length(), formats[i + 1].Pos);
+						Buff.erase(Pos, NextPos - Pos);
+					}
+					else {
+						Buff.erase(Pos);
+					}
+				}
+			}
+		}
+	}
+	for (size_t i = 0; i < Buff.length(); i++) {
+		if (Buff[i] == L'\f') {
+			if (i == 0 && !fContinue) {
+				Buff.replace(0, 1, L"\n");
+				i++;
+			}
+			else {
+				Buff.erase(i, 1);
+			}
+		}
+	}
+	return Buff;
+}
+
+std::wstring CompactNew(const std::wstring& text, const std::vector<Format>& formats, bool fIgnoreSmall, bool fContinue) {
+	std::wstring out;
+	CaptionText::Compact(text.c_str(), static_cast<int>(text.length()), formats, fIgnoreSmall ? formats.size() : 0,
+		[](const Format& format) { return format.fSmall; }, fContinue, out);
+	return out;
+}
+
+std::string Dump(const std::wstring& s) {
+	std::string out;
+	for (wchar_t c : s) {
+		if (c == L'\f') out += "\\f";
+		else if (c == L'\n') out += "\\n";
+		else if (c == L'→') out += "->";
+		else out += static_cast<char>(c);
+	}
+	return out;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+	const unsigned long seed = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1;
+	const long iterations = argc > 2 ? std::strtol(argv[2], nullptr, 10) : 200000;
+	std::mt19937 rng(seed);
+	// \f が続く・先頭にある・小さい文字の範囲の境目にある、といった場合が出やすいように文字の種類を絞る
+	const wchar_t chars[] = { L'a', L'b', L' ', L'\f', L'\f', L'→' };
+
+	for (long n = 0; n < iterations; n++) {
+		std::wstring text(rng() % 24, L'\0');
+		for (wchar_t& c : text)
+			c = chars[rng() % std::size(chars)];
+
+		// 書式の変わり目は昇順。同じ位置や文字列の長さを超える位置も含める
+		std::vector<Format> formats(rng() % 6);
+		size_t pos = 0;
+		for (Format& format : formats) {
+			pos += rng() % 6;
+			format.Pos = pos;
+			format.fSmall = rng() % 2 != 0;
+		}
+		const bool fIgnoreSmall = rng() % 4 != 0;
+		const bool fContinue = rng() % 2 != 0;
+
+		const std::wstring expected = CompactOld(text.c_str(), formats, fIgnoreSmall, fContinue);
+		const std::wstring actual = CompactNew(text, formats, fIgnoreSmall, fContinue);
+		if (expected != actual) {
+			std::printf("mismatch (seed %lu, iteration %ld)\n", seed, n);
+			std::printf("  text:     \"%s\"\n  formats: ", Dump(text).c_str());
+			for (const Format& format : formats)
+				std::printf(" %zu%s", format.Pos, format.fSmall ? "s" : "");
+			std::printf("\n  ignoreSmall=%d continue=%d\n", fIgnoreSmall, fContinue);
+			std::printf("  old:      \"%s\"\n  new:      \"%s\"\n", Dump(expected).c_str(), Dump(actual).c_str());
+			return 1;
+		}
+	}
+	std::printf("%ld cases ok (seed %lu)\n", iterations, seed);
+	return 0;
+}
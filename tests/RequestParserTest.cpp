@@ -0,0 +1,238 @@
+﻿// RequestParser の各形式 (テキスト、JSON、フォーム) とエラー、数の範囲を確かめる
+// LibISDB なしでビルドできる
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include "../RequestParser.cpp"
+
+namespace {
+
+int failures = 0;
+
+void Check(bool fOK, const char* what, std::string_view body) {
+	if (!fOK) {
+		std::printf("failed: %s (body \"%.*s\")\n", what, static_cast<int>(body.size()), body.data());
+		failures++;
+	}
+}
+
+bool IsError(const char* error, const char* expected) {
+	return error && std::strcmp(error, expected) == 0;
+}
+
+void TestVolume() {
+	const struct {
+		const char* Body;
+		int Value;
+		bool fRelative;
+	} cases[] = {
+		{ "50", 50, false },
+		{ " 50\n", 50, false },
+		{ "+5", 5, true },
+		{ "-5", -5, true },
+		{ "{\"volume\": 30}", 30, false },
+		{ "{\"volume\": \"30\"}", 30, false },
+		{ "{\"delta\": -10}", -10, true },
+		{ "{\"delta\": \"+10\", \"volume\": 1}", 10, true },
+		{ "volume=70", 70, false },
+		{ "volume=%2B3", 3, true },
+		{ "delta=-2&volume=9", -2, true },
+	};
+	for (const auto& c : cases) {
+		RequestParser::Volume volume;
+		const char* error = RequestParser::ParseVolume(c.Body, volume);
+		Check(!error && volume.Value == c.Value && volume.fRelative == c.fRelative, "ParseVolume", c.Body);
+	}
+
+	const struct {
+		const char* Body;
+		const char* Error;
+	} errors[] = {
+		{ "", "Missing volume" },
+		{ "abc", "Invalid volume value" },
+		{ "5x", "Invalid volume value" },
+		{ "99999999999", "Invalid volume value" },
+		{ "{\"volume\": null}", "Invalid volume value" },
+		{ "{}", "Missing volume" },
+		{ "{\"volume\": 1", "Invalid JSON" },
+		{ "{\"volume\": {\"a\": 1}}", "Nested JSON is not supported" },
+		{ "{\"delta\": \"x\"}", "Invalid delta value" },
+		{ "volume=%zz", "Invalid volume value" },
+		{ "level=5", "Missing volume" },
+	};
+	for (const auto& e : errors) {
+		RequestParser::Volume volume;
+		Check(IsError(RequestParser::ParseVolume(e.Body, volume), e.Error), e.Error, e.Body);
+	}
+}
+
+void TestSeek() {
+	const struct {
+		const char* Body;
+		int Msec;
+		bool fRelative;
+	} cases[] = {
+		{ "10", 10000, true },
+		{ "-10", -10000, true },
+		{ "+1.5", 1500, true },
+		{ "0.0625", 62, true },
+		{ "1:30", 90000, false },
+		{ "1:00:00", 3600000, false },
+		{ "-1:00", -60000, true },
+		{ "{\"pos\": \"1:00:00\"}", 3600000, false },
+		{ "{\"pos\": -30}", -30000, true },
+		{ "pos=-10", -10000, true },
+		{ "pos=1%3A00", 60000, false },
+		{ "596:31:23.647", INT_MAX, false },
+	};
+	for (const auto& c : cases) {
+		RequestParser::Seek seek;
+		const char* error = RequestParser::ParseSeek(c.Body, seek);
+		Check(!error && seek.Msec == c.Msec && seek.fRelative == c.fRelative, "ParseSeek", c.Body);
+	}
+
+	const struct {
+		const char* Body;
+		const char* Error;
+	} errors[] = {
+		{ "", "Missing position" },
+		{ "1:2:3:4", "Invalid time format" },
+		{ "1:-2", "Invalid time format" },
+		{ "1.", "Invalid time format" },
+		{ "1.2x", "Invalid time format" },
+		{ "::", "Invalid time format" },
+		{ "596:31:23.648", "Time out of range" },
+		{ "{}", "Missing pos" },
+		{ "pos=", "Missing position" },
+	};
+	for (const auto& e : errors) {
+		RequestParser::Seek seek;
+		Check(IsError(RequestParser::ParseSeek(e.Body, seek), e.Error), e.Error, e.Body);
+	}
+}
+
+void TestChannel() {
+	const struct {
+		const char* Body;
+		const char* Tuner;
+		int Space;
+		int Channel;
+		int ServiceID;
+	} cases[] = {
+		{ "BonDriver_A.dll,0,13,1024", "BonDriver_A.dll", 0, 13, 1024 },
+		{ ",,,1024\n", "", -1, -1, 1024 },
+		{ "BonDriver_A.dll, 1 , 2 ,", "BonDriver_A.dll", 1, 2, 0 },
+		{ "{\"tuner\": \"BonDriver_A.dll\", \"space\": 0, \"channel\": 13, \"service_id\": 1024}", "BonDriver_A.dll", 0, 13, 1024 },
+		{ "{\"tuner\": \"C:\\\\TV\\\\BonDriver \\\"B\\\".dll\"}", "C:\\TV\\BonDriver \"B\".dll", -1, -1, 0 },
+		{ "{\"tuner\": null, \"space\": null, \"channel\": \"5\"}", "", -1, 5, 0 },
+		{ "tuner=BonDriver_A.dll&channel=13", "BonDriver_A.dll", -1, 13, 0 },
+		{ "tuner=BonDriver+PT+S.dll&service_id=101", "BonDriver PT S.dll", -1, -1, 101 },
+		{ "tuner=BonDriver%20PT%2BS.dll&space=1", "BonDriver PT+S.dll", 1, -1, 0 },
+	};
+	for (const auto& c : cases) {
+		RequestParser::ChannelSelect channel;
+		const char* error = RequestParser::ParseChannel(c.Body, channel);
+		Check(!error && channel.GetTuner() == c.Tuner && channel.Space == c.Space && channel.Channel == c.Channel
+			&& channel.ServiceID == c.ServiceID, "ParseChannel", c.Body);
+	}
+
+	const std::string longTuner(RequestParser::ChannelSelect::MaxTunerLength, 'a');
+	const std::string longText = longTuner + ",0,0,0";
+	const std::string longForm = "tuner=" + longTuner;
+	const struct {
+		std::string_view Body;
+		const char* Error;
+	} errors[] = {
+		{ "BonDriver_A.dll,0,13", "Invalid request format" },
+		{ "BonDriver_A.dll,x,13,1024", "Invalid Space value" },
+		{ "BonDriver_A.dll,0,1.5,1024", "Invalid Channel value" },
+		{ "BonDriver_A.dll,0,13,id", "Invalid ServiceID value" },
+		{ longText, "Tuner name too long" },
+		{ longForm, "Invalid tuner value" },
+		{ "{\"tuner\": \"\\u0041\"}", "Invalid tuner value" },
+		{ "{\"channel\": true}", "Invalid Channel value" },
+		{ "{\"service_id\": 1024,}", "Invalid JSON" },
+		{ "{\"tuner\": [1]}", "Nested JSON is not supported" },
+		{ "tuner=%4", "Invalid tuner value" },
+		{ "channel=abc", "Invalid Channel value" },
+	};
+	for (const auto& e : errors) {
+		RequestParser::ChannelSelect channel;
+		Check(IsError(RequestParser::ParseChannel(e.Body, channel), e.Error), e.Error, e.Body.substr(0, 40));
+	}
+}
+
+void TestReset() {
+	const struct {
+		const char* Body;
+		uint32_t Flags;
+	} cases[] = {
+		{ "all", 0 },
+		{ "viewer", 1 },
+		{ "3", 3 },
+		{ "{\"flags\": 1}", 1 },
+		{ "{\"flags\": \"viewer\"}", 1 },
+		{ "flags=all", 0 },
+	};
+	for (const auto& c : cases) {
+		RequestParser::Reset reset;
+		reset.Flags = 99;
+		const char* error = RequestParser::ParseReset(c.Body, reset);
+		Check(!error && reset.Flags == c.Flags, "ParseReset", c.Body);
+	}
+	RequestParser::Reset reset;
+	Check(IsError(RequestParser::ParseReset("-1", reset), "Invalid reset flags"), "Invalid reset flags", "-1");
+	Check(IsError(RequestParser::ParseReset("{}", reset), "Missing flags"), "Missing flags", "{}");
+}
+
+void TestNumbers() {
+	int value = 7;
+	Check(RequestParser::ParseInt("+12", value) && value == 12, "ParseInt", "+12");
+	Check(!RequestParser::ParseInt("++1", value) && value == 12, "ParseInt rejects", "++1");
+	Check(!RequestParser::ParseInt("", value), "ParseInt rejects", "");
+	Check(!RequestParser::ParseInt("1 ", value), "ParseInt rejects", "1 ");
+	Check(!RequestParser::ParseInt("2147483648", value), "ParseInt rejects", "2147483648");
+	uint16_t sid = 0;
+	Check(RequestParser::ParseInt("65535", sid) && sid == 65535, "ParseInt uint16_t", "65535");
+	Check(!RequestParser::ParseInt("65536", sid) && !RequestParser::ParseInt("-1", sid), "ParseInt uint16_t rejects", "65536");
+
+	// ミリ秒にしてもあふれない範囲
+	const long long limit = LLONG_MAX / 1000;
+	const std::string max = std::to_string(limit);
+	const std::string min = std::to_string(-limit);
+	const std::string over = std::to_string(limit + 1);
+	const std::string under = std::to_string(-limit - 1);
+	long long seconds = 0;
+	Check(RequestParser::ParseSeconds(max, seconds) && seconds == limit, "ParseSeconds max", max);
+	Check(RequestParser::ParseSeconds(min, seconds) && seconds == -limit, "ParseSeconds min", min);
+	Check(!RequestParser::ParseSeconds(over, seconds) && seconds == -limit, "ParseSeconds rejects", over);
+	Check(!RequestParser::ParseSeconds(under, seconds), "ParseSeconds rejects", under);
+	Check(!RequestParser::ParseSeconds("9223372036854775808", seconds), "ParseSeconds rejects", "9223372036854775808");
+
+	Check(RequestParser::ParseTimeShiftAt("-300s", seconds) && seconds == -300, "ParseTimeShiftAt", "-300s");
+	Check(RequestParser::ParseTimeShiftAt("-300", seconds) && seconds == -300, "ParseTimeShiftAt", "-300");
+	Check(RequestParser::ParseTimeShiftAt("1700000000", seconds) && seconds == 1700000000, "ParseTimeShiftAt", "1700000000");
+	Check(RequestParser::ParseTimeShiftAt(min + "s", seconds) && seconds == -limit, "ParseTimeShiftAt min", min + "s");
+	Check(!RequestParser::ParseTimeShiftAt(under + "s", seconds), "ParseTimeShiftAt rejects", under + "s");
+	Check(!RequestParser::ParseTimeShiftAt("300s", seconds), "ParseTimeShiftAt rejects", "300s");
+	Check(!RequestParser::ParseTimeShiftAt("-s", seconds), "ParseTimeShiftAt rejects", "-s");
+	Check(!RequestParser::ParseTimeShiftAt("-300ss", seconds), "ParseTimeShiftAt rejects", "-300ss");
+}
+
+}
+
+int main() {
+	TestVolume();
+	TestSeek();
+	TestChannel();
+	TestReset();
+	TestNumbers();
+	if (failures > 0) {
+		std::printf("%d checks failed\n", failures);
+		return 1;
+	}
+	std::printf("all checks ok\n");
+	return 0;
+}
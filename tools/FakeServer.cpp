@@ -0,0 +1,31 @@
+﻿// HttpRemoconCore を FakeTVTestApp につないで動かす (TVTest なしで負荷試験やクライアントの開発をするため)
+// 設定は環境変数 (HTTPREMOCON_PORT など) と Config.cpp の既定値。ini の [Fake] [FakeLatency] [Concurrency] の代わりに
+// HTTPREMOCON_FAKE_LATENCY_US、HTTPREMOCON_FAKE_LATENCY (API 名=マイクロ秒,...)、HTTPREMOCON_FAKE_SERVICES、
+// HTTPREMOCON_FAKE_EVENTS_PER_SERVICE、HTTPREMOCON_CONCURRENCY (ルート=上限,...) を使う
+// 使い方: HttpRemoconFakeServer [HttpRemoconCli.html のあるフォルダ]
+#include <cstdio>
+#include <memory>
+#include "../HttpRemoconCore.h"
+#include "../FakeTVTestApp.cpp"
+
+int main(int argc, char* argv[]) {
+	ServerConfig config;
+	config.LoadEnvironment();
+	config.FakeBackend = true;
+
+	std::unique_ptr<ITVTestApp> app;
+	std::unique_ptr<ITvtPlay> tvtPlay;
+	CreateFakeBackend(config, app, tvtPlay);
+	HttpRemoconCore core(std::move(app), std::move(tvtPlay), config);
+	core.Start(argc > 1 ? argv[1] : ".");
+
+	std::printf("HttpRemoconFakeServer: listening on %s:%d\n", config.Host.c_str(), config.Port);
+	std::fflush(stdout);
+	if (!core.Listen({})) {
+		std::fprintf(stderr, "HttpRemoconFakeServer: failed to listen on %s:%d\n", config.Host.c_str(), config.Port);
+		core.Stop();
+		return 1;
+	}
+	core.Stop();
+	return 0;
+}